@@ -0,0 +1,5 @@
+# Usage: compare_core_benchmarks.sh <baseline.json> <contender.json>
+# Both files are produced by core_benchmarks.sh, e.g. at two different library versions.
+# Requires Python packages numpy and scipy.
+python3 "$(bazel info output_base)/external/benchmark/tools/compare.py" benchmarks \
+  "$(realpath "$1")" "$(realpath "$2")"
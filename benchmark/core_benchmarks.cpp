@@ -0,0 +1,159 @@
+// Microbenchmarks for core kernels.
+//
+// Run with JSON output in order to compare library versions:
+//   bazel run -c opt //benchmark:core_benchmarks -- \
+//     --benchmark_out=core_benchmarks.json --benchmark_out_format=json
+// See compare_core_benchmarks.sh.
+
+#include "benchmark/benchmark.h"
+
+#include "cpp/lib/coalgebra.h"
+#include "cpp/lib/compression.h"
+#include "cpp/lib/delta.h"
+#include "cpp/lib/expr_matrix_builder.h"
+#include "cpp/lib/linalg.h"
+#include "cpp/lib/lyndon.h"
+#include "cpp/lib/polylog_qli.h"
+#include "cpp/lib/polylog_space.h"
+#include "cpp/lib/pvector.h"
+#include "cpp/lib/shuffle.h"
+
+
+static std::vector<int> make_word(int length, int first_letter) {
+  return mapped(range(length), [&](int i) { return first_letter + i; });
+}
+
+static DeltaExpr qli_expr(int weight, int num_points) {
+  return QLiVec(weight, to_vector(range_incl(1, num_points))).without_annotations();
+}
+
+// CB space on 7 points in Lyndon basis, used by the matrix benchmarks.
+static std::vector<DeltaExpr> prepared_cb_space(int weight) {
+  return mapped(CB(weight, to_vector(range_incl(1, 7))), DISAMBIGUATE(to_lyndon_basis));
+}
+
+static Matrix cb_matrix(int weight) {
+  GetExprMatrixBuilder_t<DeltaExpr> matrix_builder;
+  for (const auto& expr : prepared_cb_space(weight)) {
+    matrix_builder.add_expr(expr);
+  }
+  return matrix_builder.make_matrix();
+}
+
+
+// Arguments: lengths of the two words.
+static void BM_ShuffleProduct(benchmark::State& state) {
+  const auto u = make_word(state.range(0), 0);
+  const auto v = make_word(state.range(1), 100);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(shuffle_product(u, v));
+  }
+}
+BENCHMARK(BM_ShuffleProduct)->ArgsProduct({{1, 2, 3, 4, 5}, {1, 2, 3, 4, 5}});
+
+// Arguments: weight.
+static void BM_ToLyndonBasis(benchmark::State& state) {
+  const auto expr = qli_expr(state.range(0), 6);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(to_lyndon_basis(expr));
+  }
+  state.counters["terms"] = expr.num_terms();
+}
+BENCHMARK(BM_ToLyndonBasis)->DenseRange(2, 4)->Unit(benchmark::kMicrosecond);
+
+// Arguments: weights of the two factors.
+static void BM_TensorProduct(benchmark::State& state) {
+  const auto lhs = qli_expr(state.range(0), 6);
+  const auto rhs = qli_expr(state.range(1), 6);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tensor_product(lhs, rhs));
+  }
+}
+BENCHMARK(BM_TensorProduct)->ArgsProduct({{2, 3}, {2, 3}})->Unit(benchmark::kMicrosecond);
+
+// Arguments: weight. Comultiplies into weights (1, weight-1).
+static void BM_NComultiply(benchmark::State& state) {
+  const int weight = state.range(0);
+  const auto expr = qli_expr(weight, 6);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ncomultiply(expr, {1, weight - 1}));
+  }
+}
+BENCHMARK(BM_NComultiply)->DenseRange(3, 5)->Unit(benchmark::kMillisecond);
+
+// Arguments: weight. Comultiplies into weights (1, weight-1).
+static void BM_IComultiply(benchmark::State& state) {
+  const int weight = state.range(0);
+  const auto expr = qli_expr(weight, 6);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(icomultiply(expr, {1, weight - 1}));
+  }
+}
+BENCHMARK(BM_IComultiply)->DenseRange(3, 5)->Unit(benchmark::kMillisecond);
+
+// Arguments: weight.
+static void BM_SubstituteVariables(benchmark::State& state) {
+  const auto expr = qli_expr(state.range(0), 6);
+  const XArgs new_points = std::vector{x1, x2, x3, x4, x5, Inf};
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(substitute_variables(expr, new_points));
+  }
+}
+BENCHMARK(BM_SubstituteVariables)->DenseRange(2, 5);
+
+// Arguments: vector size.
+static void BM_PVectorHash(benchmark::State& state) {
+  const PVector<int, 8> v(state.range(0), 7);
+  const absl::Hash<PVector<int, 8>> hasher;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hasher(v));
+  }
+}
+BENCHMARK(BM_PVectorHash)->RangeMultiplier(2)->Range(1, 32);
+
+// Arguments: segment length.
+static void BM_Compressor(benchmark::State& state) {
+  struct Tag {};
+  const auto segment = mapped(range(state.range(0)), [](int i) { return i % 12; });
+  for (auto _ : state) {
+    Compressor compressor;
+    compressor.push_segment(segment);
+    benchmark::DoNotOptimize(std::move(compressor).result<CompressedBlob<Tag>>());
+  }
+}
+BENCHMARK(BM_Compressor)->RangeMultiplier(2)->Range(2, 64);
+
+// Arguments: weight.
+static void BM_ExprMatrixBuilder(benchmark::State& state) {
+  const auto space = prepared_cb_space(state.range(0));
+  for (auto _ : state) {
+    GetExprMatrixBuilder_t<DeltaExpr> matrix_builder;
+    for (const auto& expr : space) {
+      matrix_builder.add_expr(expr);
+    }
+    benchmark::DoNotOptimize(matrix_builder.make_matrix());
+  }
+  state.counters["rows"] = space.size();
+}
+BENCHMARK(BM_ExprMatrixBuilder)->DenseRange(2, 4)->Unit(benchmark::kMillisecond);
+
+// Arguments: weight.
+static void BM_MatrixRankRaw(benchmark::State& state) {
+  const Matrix matrix = cb_matrix(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(matrix_rank_raw_linbox(matrix));
+  }
+}
+BENCHMARK(BM_MatrixRankRaw)->DenseRange(2, 4)->Unit(benchmark::kMillisecond);
+
+// Arguments: weight.
+static void BM_MatrixRankFancy(benchmark::State& state) {
+  const Matrix matrix = cb_matrix(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(matrix_rank(matrix));
+  }
+}
+BENCHMARK(BM_MatrixRankFancy)->DenseRange(2, 4)->Unit(benchmark::kMillisecond);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,3 @@
+# Usage: core_benchmarks.sh <output.json>
+bazel run -c opt --config=clang :core_benchmarks -- \
+  --benchmark_out="$(realpath -m "$1")" --benchmark_out_format=json --benchmark_repetitions=5
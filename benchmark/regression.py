@@ -0,0 +1,210 @@
+# Performance regression check.
+#
+# Builds and runs `regression_benchmark` for one or more build variants, prints timings side
+# by side and compares them against the baseline. Exits with a nonzero code if any workload
+# became slower than the baseline by more than the tolerance, if it produced a different result,
+# or if there is nothing to compare against.
+#
+# Usage (from the repository root):
+#   python3 benchmark/regression.py                              # check the default build
+#   python3 benchmark/regression.py --variants default,no_packing,no_unroll
+#   python3 benchmark/regression.py --update-baseline            # re-record the baseline
+#   python3 benchmark/regression.py --results-only               # on a machine without a baseline
+#   python3 benchmark/regression.py --binary=path/to/regression_benchmark --results-only
+#
+# Each baseline variant stores the exact command line and a description of the machine it was
+# recorded on. The baseline must be recorded on the reference machine through the bazel build,
+# with LinBox installed. Timings are only meaningful on the machine (CPU model and number of
+# logical CPUs) they were recorded on: elsewhere the check fails unless `--results-only` is given,
+# in which case only the results are compared.
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+
+
+BUILD_VARIANTS = {
+    'default': [],
+    'no_unroll': ['--cxxopt=-DUNROLL_SHUFFLE=0'],
+    'unroll_multi': ['--cxxopt=-DUNROLL_SHUFFLE_MULTI=1'],
+    'no_packing': ['--cxxopt=-DDISABLE_PACKING=1'],
+    'no_parallelism': ['--cxxopt=-DPARALLELISM_IMPLEMENTATION=0'],
+}
+
+DEFAULT_BASELINE = 'benchmark/regression_baseline.json'
+
+
+def describe_machine():
+    cpu = platform.processor()
+    try:
+        with open('/proc/cpuinfo') as f:
+            for line in f:
+                if line.startswith('model name'):
+                    cpu = line.split(':', 1)[1].strip()
+                    break
+    except OSError:
+        pass
+    return {
+        'cpu': cpu,
+        'logical_cpus': os.cpu_count(),
+        'os': f'{platform.system()} {platform.release()} {platform.machine()}',
+    }
+
+
+def run_variant(variant, repetitions, workload_filter, binary):
+    if binary:
+        command = [binary]
+    else:
+        command = (
+            ['bazel', 'run', '-c', 'opt', '--config=clang'] + BUILD_VARIANTS[variant] +
+            ['//benchmark:regression_benchmark', '--']
+        )
+    command.append(f'--repetitions={repetitions}')
+    if workload_filter:
+        command.append(f'--filter={workload_filter}')
+    print(f'Running variant "{variant}": {" ".join(command)}', file=sys.stderr)
+    output = subprocess.run(command, check=True, stdout=subprocess.PIPE, text=True).stdout
+    run = json.loads(output)
+    run['command'] = ' '.join(command)
+    run['machine'] = describe_machine()
+    return run
+
+
+def workloads_by_name(run):
+    return {w['name']: w for w in run['workloads']}
+
+
+def same_machine(a, b):
+    return (a['cpu'], a['logical_cpus']) == (b['cpu'], b['logical_cpus'])
+
+
+def compare_with_baseline(variant, run, baseline_run, tolerance, results_only):
+    problems = []
+    if run['build_flags'] != baseline_run['build_flags']:
+        problems.append(
+            f'{variant}: build flags differ from the baseline: '
+            f'{run["build_flags"]} vs {baseline_run["build_flags"]}'
+        )
+        return problems
+    if run['num_threads'] != baseline_run['num_threads']:
+        problems.append(
+            f'{variant}: {run["num_threads"]} threads, baseline was recorded with '
+            f'{baseline_run["num_threads"]}'
+        )
+        return problems
+    if not results_only and not same_machine(run['machine'], baseline_run['machine']):
+        problems.append(
+            f'{variant}: baseline was recorded on {baseline_run["machine"]}, this is '
+            f'{run["machine"]}; timings are not comparable (use --results-only to compare results)'
+        )
+        return problems
+    current = workloads_by_name(run)
+    for name, base in workloads_by_name(baseline_run).items():
+        if name not in current:
+            continue
+        actual = current[name]
+        if actual['result'] != base['result']:
+            problems.append(
+                f'{variant}/{name}: result changed: {base["result"]} -> {actual["result"]}'
+            )
+        if results_only:
+            continue
+        limit = base['seconds'] * (1 + tolerance)
+        if actual['seconds'] > limit:
+            problems.append(
+                f'{variant}/{name}: {actual["seconds"]:.3f}s exceeds baseline '
+                f'{base["seconds"]:.3f}s by more than {tolerance:.0%}'
+            )
+    return problems
+
+
+def print_side_by_side(runs, baseline):
+    names = []
+    for run in runs.values():
+        for workload in run['workloads']:
+            if workload['name'] not in names:
+                names.append(workload['name'])
+    columns = list(runs.keys())
+    header = f'{"workload":<28}' + ''.join(f'{c:>16}' for c in columns)
+    print(header)
+    print('-' * len(header))
+    for name in names:
+        row = f'{name:<28}'
+        for variant in columns:
+            workload = workloads_by_name(runs[variant]).get(name)
+            cell = '-'
+            if workload:
+                cell = f'{workload["seconds"]:.3f}'
+                base_run = baseline.get('variants', {}).get(variant)
+                base = workloads_by_name(base_run).get(name) if base_run else None
+                if base and base['seconds'] > 0:
+                    cell += f' ({workload["seconds"] / base["seconds"]:.2f}x)'
+            row += f'{cell:>16}'
+        print(row)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Performance regression check')
+    parser.add_argument('--baseline', default=DEFAULT_BASELINE)
+    parser.add_argument('--variants', default='default',
+                        help='comma-separated list of: ' + ', '.join(BUILD_VARIANTS))
+    parser.add_argument('--tolerance', type=float, default=None,
+                        help='allowed relative slowdown; defaults to the value stored in the baseline')
+    parser.add_argument('--repetitions', type=int, default=5)
+    parser.add_argument('--filter', default='', help='run only workloads containing this substring')
+    parser.add_argument('--binary', default='',
+                        help='prebuilt regression_benchmark to run instead of building with bazel; '
+                        'requires a single variant matching its build; cannot record a baseline')
+    parser.add_argument('--results-only', action='store_true',
+                        help='compare results but not timings, e.g. on a machine other than the one '
+                        'the baseline was recorded on')
+    parser.add_argument('--update-baseline', action='store_true')
+    args = parser.parse_args()
+
+    try:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+    except FileNotFoundError:
+        baseline = {'tolerance': 0.1, 'variants': {}}
+    tolerance = args.tolerance if args.tolerance is not None else baseline['tolerance']
+
+    variants = args.variants.split(',')
+    for variant in variants:
+        if variant not in BUILD_VARIANTS:
+            parser.error(f'Unknown variant: {variant}')
+    if args.binary and len(variants) != 1:
+        parser.error('--binary requires exactly one variant')
+    if args.binary and args.update_baseline:
+        parser.error('the baseline must be recorded through the bazel build, not with --binary')
+    runs = {v: run_variant(v, args.repetitions, args.filter, args.binary) for v in variants}
+
+    print_side_by_side(runs, baseline)
+
+    if args.update_baseline:
+        baseline['variants'].update(runs)
+        with open(args.baseline, 'w') as f:
+            json.dump(baseline, f, indent=2)
+            f.write('\n')
+        print(f'Baseline updated: {args.baseline}')
+        return 0
+
+    problems = []
+    for variant, run in runs.items():
+        if variant in baseline['variants']:
+            problems += compare_with_baseline(
+                variant, run, baseline['variants'][variant], tolerance, args.results_only
+            )
+        else:
+            problems.append(
+                f'{variant}: no baseline recorded; run with --update-baseline on the reference machine'
+            )
+    for problem in problems:
+        print('REGRESSION: ' + problem)
+    return 1 if problems else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,124 @@
+// Runs a fixed set of workloads and prints timings as JSON, together with the build flags
+// that affect performance. Used by regression.py, which compares the output against
+// regression_baseline.json.
+//
+// Usage: regression_benchmark [--repetitions=N] [--filter=substring]
+//
+// Each workload also reports a result (number of terms or rank) in order to make sure that
+// the timings compare the same computations.
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+
+#include "cpp/lib/linear_stats.h"
+#include "cpp/lib/lyndon.h"
+#include "cpp/lib/parallel_util.h"
+#include "cpp/lib/polylog_qli.h"
+#include "cpp/lib/polylog_space.h"
+#include "cpp/lib/sequence_iteration.h"
+#include "cpp/lib/shuffle.h"
+
+
+#ifndef DISABLE_PACKING
+#  define DISABLE_PACKING 0
+#endif
+
+struct Workload {
+  std::string name;
+  std::function<long()> run;  // returns the result used as a sanity check
+};
+
+static std::vector<Workload> all_workloads() {
+  std::vector<Workload> ret;
+  for (const int weight : range_incl(4, 7)) {
+    ret.push_back({absl::StrCat("QLi", weight, "_8_points"), [weight]() -> long {
+      return QLiVec(weight, to_vector(range_incl(1, 8))).num_terms();
+    }});
+  }
+  // Same identity as benchmark_equations.cpp: symmetrized QLi sum vanishes.
+  ret.push_back({"QLiSymm5_equation", []() -> long {
+    const int weight = 5;
+    const int total_points = 9;
+    DeltaExpr expr;
+    for (int num_args = 4; num_args <= total_points; num_args += 2) {
+      for (const auto& seq : increasing_sequences(total_points, num_args)) {
+        const auto args = mapped(seq, [](int x) { return x + 1; });
+        const int sign = neg_one_pow(sum(args) + num_args / 2);
+        expr += sign * QLiSymmVec(weight, args);
+      }
+    }
+    const auto lyndon = to_lyndon_basis(expr);
+    CHECK(lyndon.is_zero());
+    return expr.num_terms();
+  }});
+  ret.push_back({"CL4_7_points_rank", []() -> long {
+    return space_rank(CL4(to_vector(range_incl(1, 7))), DISAMBIGUATE(to_lyndon_basis));
+  }});
+  ret.push_back({"GrL2_dim3_6_points_rank", []() -> long {
+    return space_rank(GrL2(3, to_vector(range_incl(1, 6))), DISAMBIGUATE(to_lyndon_basis));
+  }});
+  return ret;
+}
+
+static void print_build_flags() {
+  std::cout << "  \"build_flags\": {\n";
+#ifdef NDEBUG
+  std::cout << "    \"NDEBUG\": 1,\n";
+#else
+  std::cout << "    \"NDEBUG\": 0,\n";
+#endif
+  std::cout << "    \"UNROLL_SHUFFLE\": " << UNROLL_SHUFFLE << ",\n";
+  std::cout << "    \"UNROLL_SHUFFLE_MULTI\": " << UNROLL_SHUFFLE_MULTI << ",\n";
+  std::cout << "    \"DISABLE_PACKING\": " << DISABLE_PACKING << ",\n";
+  std::cout << "    \"LINEAR_STATS\": " << LINEAR_STATS << ",\n";
+  std::cout << "    \"PARALLELISM_IMPLEMENTATION\": " << PARALLELISM_IMPLEMENTATION << "\n";
+  std::cout << "  },\n";
+}
+
+int main(int argc, char *argv[]) {
+  int repetitions = 3;
+  std::string filter;
+  for (const int i : range(1, argc)) {
+    const std::string arg = argv[i];
+    if (absl::StartsWith(arg, "--repetitions=")) {
+      repetitions = std::stoi(arg.substr(std::string("--repetitions=").size()));
+    } else if (absl::StartsWith(arg, "--filter=")) {
+      filter = arg.substr(std::string("--filter=").size());
+    } else {
+      FATAL(absl::StrCat("Unknown argument: ", arg));
+    }
+  }
+  CHECK_GE(repetitions, 1);
+
+  std::cout << "{\n";
+  print_build_flags();
+  std::cout << "  \"num_threads\": " << parallelism_num_threads() << ",\n";
+  std::cout << "  \"repetitions\": " << repetitions << ",\n";
+  std::cout << "  \"workloads\": [";
+  bool first = true;
+  for (const auto& workload : all_workloads()) {
+    if (!absl::StrContains(workload.name, filter)) {
+      continue;
+    }
+    double best_sec = std::numeric_limits<double>::infinity();
+    long result = 0;
+    for (EACH : range(repetitions)) {
+      const auto start = std::chrono::steady_clock::now();
+      result = workload.run();
+      const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+      best_sec = std::min(best_sec, duration.count());
+    }
+    std::cerr << workload.name << ": " << best_sec << " sec\n";
+    std::cout << (first ? "\n" : ",\n")
+      << "    {\"name\": \"" << workload.name << "\", \"seconds\": " << best_sec
+      << ", \"result\": " << result << "}";
+    first = false;
+  }
+  std::cout << "\n  ]\n}\n";
+}
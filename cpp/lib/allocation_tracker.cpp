@@ -0,0 +1,217 @@
+#include "allocation_tracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+
+#include "profiler.h"
+#include "string.h"
+#include "util.h"
+
+
+// Counters are constant-initialized, because operator new may be called before dynamic
+// initialization of this translation unit.
+constexpr int kMaxAllocationStages = 1024;
+
+struct AtomicStageStats {
+  std::atomic<int64_t> num_allocations = 0;
+  std::atomic<int64_t> allocated_bytes = 0;
+  std::atomic<int64_t> live_bytes = 0;
+  std::atomic<int64_t> peak_live_bytes = 0;
+};
+
+static AtomicStageStats stage_stats[kMaxAllocationStages];
+static std::atomic<int64_t> total_live_bytes = 0;
+static std::atomic<int64_t> total_peak_live_bytes = 0;
+
+thread_local int internal::current_allocation_stage = internal::kNoAllocationStage;
+
+static void update_max(std::atomic<int64_t>& max_value, int64_t value) {
+  int64_t prev = max_value.load(std::memory_order_relaxed);
+  while (prev < value && !max_value.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {}
+}
+
+void internal::track_allocation(int stage, int64_t bytes) {
+  auto& stats = stage_stats[stage];
+  stats.num_allocations.fetch_add(1, std::memory_order_relaxed);
+  stats.allocated_bytes.fetch_add(bytes, std::memory_order_relaxed);
+  update_max(stats.peak_live_bytes, stats.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+  update_max(total_peak_live_bytes, total_live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+}
+
+void internal::track_deallocation(int stage, int64_t bytes) {
+  stage_stats[stage].live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+  total_live_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+static std::mutex stage_names_mutex;
+static std::vector<std::string>& stage_names() {
+  static auto* names = new std::vector<std::string>{"(no scope)"};
+  return *names;
+}
+
+int register_allocation_stage(std::string name) {
+  std::lock_guard lock(stage_names_mutex);
+  auto& names = stage_names();
+  if (names.size() >= kMaxAllocationStages) {
+    return internal::kNoAllocationStage;
+  }
+  names.push_back(std::move(name));
+  return names.size() - 1;
+}
+
+AllocationReport allocation_report() {
+  AllocationReport ret;
+  ret.live_bytes = total_live_bytes.load(std::memory_order_relaxed);
+  ret.peak_live_bytes = total_peak_live_bytes.load(std::memory_order_relaxed);
+  std::lock_guard lock(stage_names_mutex);
+  const auto& names = stage_names();
+  for (const int i : range(names.size())) {
+    const auto& stats = stage_stats[i];
+    if (stats.num_allocations.load(std::memory_order_relaxed) == 0) {
+      continue;
+    }
+    AllocationStageStats stage;
+    stage.stage = names[i];
+    stage.num_allocations = stats.num_allocations.load(std::memory_order_relaxed);
+    stage.allocated_bytes = stats.allocated_bytes.load(std::memory_order_relaxed);
+    stage.live_bytes = stats.live_bytes.load(std::memory_order_relaxed);
+    stage.peak_live_bytes = stats.peak_live_bytes.load(std::memory_order_relaxed);
+    ret.stages.push_back(std::move(stage));
+  }
+  return ret;
+}
+
+std::ostream& operator<<(std::ostream& os, const AllocationReport& report) {
+  constexpr int kWidth = 18;
+  os << "=== Allocation statistics ===\n";
+  os << "live: " << to_string_with_thousand_sep(report.live_bytes) << " bytes, "
+    << "peak: " << to_string_with_thousand_sep(report.peak_live_bytes) << " bytes\n";
+  os << pad_left("allocations", kWidth) << pad_left("allocated", kWidth)
+    << pad_left("live", kWidth) << pad_left("peak live", kWidth) << "\n";
+  for (const auto& stage : report.stages) {
+    os
+      << pad_left(to_string_with_thousand_sep(stage.num_allocations), kWidth)
+      << pad_left(to_string_with_thousand_sep(stage.allocated_bytes), kWidth)
+      << pad_left(to_string_with_thousand_sep(stage.live_bytes), kWidth)
+      << pad_left(to_string_with_thousand_sep(stage.peak_live_bytes), kWidth)
+      << "  @  " << stage.stage << "\n"
+    ;
+  }
+  return os;
+}
+
+std::string to_json(const AllocationReport& report) {
+  std::stringstream ss;
+  ss << "{\"live_bytes\": " << report.live_bytes
+    << ", \"peak_live_bytes\": " << report.peak_live_bytes
+    << ", \"stages\": [";
+  bool first = true;
+  for (const auto& stage : report.stages) {
+    ss << (first ? "\n" : ",\n")
+      << "  {\"stage\": \"" << stage.stage << "\""
+      << ", \"allocations\": " << stage.num_allocations
+      << ", \"allocated_bytes\": " << stage.allocated_bytes
+      << ", \"live_bytes\": " << stage.live_bytes
+      << ", \"peak_live_bytes\": " << stage.peak_live_bytes
+      << "}";
+    first = false;
+  }
+  ss << (first ? "]}" : "\n]}");
+  return ss.str();
+}
+
+
+#if TRACK_ALLOCATIONS
+
+// Each block is prefixed with a header that stores allocation size and stage. For over-aligned
+// allocations the header is placed at the end of a padding of `alignment` bytes.
+struct AllocationHeader {
+  uint64_t size;
+  int32_t stage;
+  uint32_t offset;  // from the start of the underlying block to the user pointer
+};
+static_assert(sizeof(AllocationHeader) == 16);
+static_assert(alignof(std::max_align_t) <= sizeof(AllocationHeader));
+
+static void* tracked_allocate(size_t size, size_t alignment) {
+  const size_t offset = std::max(alignment, sizeof(AllocationHeader));
+  void* block = alignment <= alignof(std::max_align_t)
+    ? std::malloc(size + offset)
+    : std::aligned_alloc(alignment, (size + offset + alignment - 1) / alignment * alignment);
+  if (block == nullptr) {
+    return nullptr;
+  }
+  char* ptr = static_cast<char*>(block) + offset;
+  const int stage = internal::current_allocation_stage;
+  new (ptr - sizeof(AllocationHeader)) AllocationHeader{size, stage, static_cast<uint32_t>(offset)};
+  internal::track_allocation(stage, size);
+  return ptr;
+}
+
+static void tracked_deallocate(void* ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  char* p = static_cast<char*>(ptr);
+  const auto* header = reinterpret_cast<const AllocationHeader*>(p - sizeof(AllocationHeader));
+  internal::track_deallocation(header->stage, header->size);
+  std::free(p - header->offset);
+}
+
+static void* tracked_allocate_or_throw(size_t size, size_t alignment) {
+  void* ptr = tracked_allocate(size, alignment);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void* operator new(size_t size) { return tracked_allocate_or_throw(size, 0); }
+void* operator new[](size_t size) { return tracked_allocate_or_throw(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return tracked_allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return tracked_allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t alignment) {
+  return tracked_allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment) {
+  return tracked_allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return tracked_allocate(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return tracked_allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept { tracked_deallocate(ptr); }
+void operator delete[](void* ptr) noexcept { tracked_deallocate(ptr); }
+void operator delete(void* ptr, size_t) noexcept { tracked_deallocate(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { tracked_deallocate(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { tracked_deallocate(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { tracked_deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { tracked_deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { tracked_deallocate(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { tracked_deallocate(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { tracked_deallocate(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { tracked_deallocate(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { tracked_deallocate(ptr); }
+
+class AllocationReportAtExitPrinter {
+public:
+  AllocationReportAtExitPrinter() {
+    // Construct the static locale used for printing now, so that it outlives this object.
+    to_string_with_thousand_sep(0);
+    add_profiler_report("allocations", []() { return to_json(allocation_report()); });
+  }
+  ~AllocationReportAtExitPrinter() {
+    std::cerr << allocation_report();
+  }
+};
+
+static AllocationReportAtExitPrinter allocation_report_at_exit_printer;
+
+#endif
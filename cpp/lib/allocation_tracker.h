@@ -0,0 +1,54 @@
+// Allocation tracking per pipeline stage. Enabled by TRACK_ALLOCATIONS compilation macro, see
+// compilation-macros.md.
+//
+// When enabled, global operator new/delete are replaced with versions that attribute every
+// allocation to the current stage. Stages are profiler scopes (see PROFILE_SCOPE in profiler.h),
+// so the hierarchical profiler must be enabled to get a per-stage breakdown; otherwise all
+// allocations go to the "(no scope)" stage. A deallocation is attributed to the stage that made
+// the allocation, so live bytes of a stage include memory that outlived the scope.
+//
+// The report is printed to stderr at exit and is included in the profiler JSON dump.
+
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+
+#ifndef TRACK_ALLOCATIONS
+#  define TRACK_ALLOCATIONS 0
+#endif
+
+struct AllocationStageStats {
+  std::string stage;
+  int64_t num_allocations = 0;
+  int64_t allocated_bytes = 0;
+  int64_t live_bytes = 0;
+  int64_t peak_live_bytes = 0;
+};
+
+struct AllocationReport {
+  int64_t live_bytes = 0;
+  int64_t peak_live_bytes = 0;
+  std::vector<AllocationStageStats> stages;  // stages without allocations are omitted
+};
+
+AllocationReport allocation_report();
+
+std::ostream& operator<<(std::ostream& os, const AllocationReport& report);
+std::string to_json(const AllocationReport& report);
+
+// Returns stage id to be used for allocations made within the stage. Stage names must be unique.
+int register_allocation_stage(std::string name);
+
+namespace internal {
+constexpr int kNoAllocationStage = 0;
+// Stage of the allocations made on this thread.
+extern thread_local int current_allocation_stage;
+
+// Used by operator new/delete hooks. Exposed for testing.
+void track_allocation(int stage, int64_t bytes);
+void track_deallocation(int stage, int64_t bytes);
+}  // namespace internal
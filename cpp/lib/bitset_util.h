@@ -1,6 +1,7 @@
 #pragma once
 
 #include <bitset>
+#include <cstdint>
 #include <vector>
 
 #include "check.h"
@@ -60,3 +61,41 @@ std::vector<int> bitset_to_vector(std::bitset<N> bitset, int offset = 0) {
   }
   return vector;
 }
+
+// Returns the bits from the lowest set bit of `x` to the highest set bit inclusive, or zero if `x`
+// is zero. Branch-free.
+inline uint32_t bit_hull(uint32_t x) {
+  uint32_t up_to_highest = x;
+  up_to_highest |= up_to_highest >> 1;
+  up_to_highest |= up_to_highest >> 2;
+  up_to_highest |= up_to_highest >> 4;
+  up_to_highest |= up_to_highest >> 8;
+  up_to_highest |= up_to_highest >> 16;
+  const uint32_t lowest = x & (~x + 1);
+  const uint32_t from_lowest = ~lowest + 1;
+  return up_to_highest & from_lowest;
+}
+
+// Checks whether point sets `s1` and `s2`, given as bitmasks, are weakly separated, i.e. whether
+// points of A = s1 \ s2 and points of B = s2 \ s1 don't interleave when drawn as vertices of
+// a polygon. Equivalently, either A has no points between the first and the last point of B or
+// vice versa. Branch-free.
+inline bool bitmasks_weakly_separated(uint32_t s1, uint32_t s2) {
+  const uint32_t a = s1 & ~s2;
+  const uint32_t b = s2 & ~s1;
+  return ((a & bit_hull(b)) == 0) | ((b & bit_hull(a)) == 0);
+}
+
+// Checks that all pairs of `masks` are weakly separated. Pairs are checked without early exit, so
+// that the inner loop can be vectorized.
+template<typename Container>
+bool all_bitmasks_weakly_separated(const Container& masks) {
+  bool ret = true;
+  for (size_t i = 0; i < masks.size(); ++i) {
+    const uint32_t mask = masks[i];
+    for (size_t j = 0; j < i; ++j) {
+      ret &= bitmasks_weakly_separated(mask, masks[j]);
+    }
+  }
+  return ret;
+}
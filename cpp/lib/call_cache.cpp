@@ -0,0 +1,90 @@
+#include "call_cache.h"
+
+#include <sstream>
+
+#include "absl/algorithm/container.h"
+
+#include "profiler.h"
+#include "string.h"
+#include "util.h"
+
+
+static std::mutex registry_mutex;
+
+static std::vector<CallCacheBase*>& registry() {
+  // Never destroyed: static caches unregister themselves during static destruction.
+  static auto* registry = new std::vector<CallCacheBase*>;
+  return *registry;
+}
+
+CallCacheBase::CallCacheBase(std::string name) : name_(std::move(name)) {
+  std::lock_guard lock(registry_mutex);
+  registry().push_back(this);
+}
+
+CallCacheBase::~CallCacheBase() {
+  std::lock_guard lock(registry_mutex);
+  auto& caches = registry();
+  caches.erase(absl::c_find(caches, this));
+}
+
+std::vector<CallCacheStats> all_call_cache_stats() {
+  std::vector<CallCacheStats> ret;
+  {
+    std::lock_guard lock(registry_mutex);
+    for (const CallCacheBase* cache : registry()) {
+      ret.push_back(cache->stats());
+    }
+  }
+  absl::c_stable_sort(ret, [](const auto& a, const auto& b) { return a.name < b.name; });
+  return ret;
+}
+
+void clear_all_call_caches() {
+  std::lock_guard lock(registry_mutex);
+  for (CallCacheBase* cache : registry()) {
+    cache->clear();
+  }
+}
+
+std::ostream& operator<<(std::ostream& os, const std::vector<CallCacheStats>& stats) {
+  constexpr int kWidth = 16;
+  os << "=== Call cache statistics ===\n";
+  os << pad_left("hits", kWidth) << pad_left("misses", kWidth) << pad_left("evictions", kWidth)
+    << pad_left("entries", kWidth) << pad_left("bytes", kWidth) << "\n";
+  for (const auto& cache : stats) {
+    os
+      << pad_left(to_string_with_thousand_sep(cache.hits), kWidth)
+      << pad_left(to_string_with_thousand_sep(cache.misses), kWidth)
+      << pad_left(to_string_with_thousand_sep(cache.evictions), kWidth)
+      << pad_left(to_string_with_thousand_sep(cache.entries), kWidth)
+      << pad_left(to_string_with_thousand_sep(cache.bytes), kWidth)
+      << "  @  " << cache.name << "\n"
+    ;
+  }
+  return os;
+}
+
+std::string to_json(const std::vector<CallCacheStats>& stats) {
+  std::stringstream ss;
+  ss << "[";
+  bool first = true;
+  for (const auto& cache : stats) {
+    ss << (first ? "\n" : ",\n")
+      << "  {\"name\": \"" << cache.name << "\""
+      << ", \"hits\": " << cache.hits
+      << ", \"misses\": " << cache.misses
+      << ", \"evictions\": " << cache.evictions
+      << ", \"entries\": " << cache.entries
+      << ", \"bytes\": " << cache.bytes
+      << "}";
+    first = false;
+  }
+  ss << (first ? "]" : "\n]");
+  return ss.str();
+}
+
+static const bool call_cache_report_registered = (
+  add_profiler_report("call_caches", []() { return to_json(all_call_cache_stats()); }),
+  true
+);
@@ -1,30 +1,222 @@
-#pragma once
-
-#include "absl/container/flat_hash_map.h"
-
-
+// Memoization of pure functions.
+//
+// `CallCache` is thread-safe and optionally bounded by the number of entries and/or the total
+// size of values. When a limit is exceeded, least recently used entries are evicted. Values are
+// stored as `std::shared_ptr<const Value>`, so a hit doesn't copy the value and an evicted value
+// stays alive while somebody holds it. Concurrent calls with the same arguments compute the
+// value once: other callers wait for the result. If `func` throws, the exception is propagated
+// to all callers waiting for it and nothing is cached.
+//
+// All caches are registered in a global registry, which allows to clear them or collect their
+// statistics at once. Statistics are also included in the profiler JSON dump (see profiler.h).
+//
 // Sample usage:
 //    return QLi_impl(weight, asc_points);
 // =>
-//    static CallCache<DeltaExpr, int, std::vector<int>> call_cache;
+//    static CallCache<DeltaExpr, int, std::vector<int>> call_cache(
+//      "QLi", {.max_entries = 10'000}
+//    );
 //    return call_cache.apply(&QLi_impl, weight, asc_points);
 //
+// A waiting caller sleeps until the value is ready. This is safe inside `parallel_for_chunks`:
+// a thread that waits for its own loop never picks up unrelated tasks (see thread_pool.h), so it
+// cannot end up waiting for a value that it is computing itself. If that happens anyway, i.e.
+// `func` calls the same cache with the same arguments on the same thread, the nested call
+// computes the value directly instead of waiting.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "absl/container/node_hash_map.h"
+
+#include "check.h"
+
+
+struct CallCacheLimits {
+  int64_t max_entries = 0;  // 0 means no limit
+  int64_t max_bytes = 0;  // 0 means no limit; requires a size function
+};
+
+struct CallCacheStats {
+  std::string name;
+  int64_t hits = 0;
+  int64_t misses = 0;
+  int64_t evictions = 0;
+  int64_t entries = 0;
+  int64_t bytes = 0;
+};
+
+std::ostream& operator<<(std::ostream& os, const std::vector<CallCacheStats>& stats);
+std::string to_json(const std::vector<CallCacheStats>& stats);
+
+// Returns statistics of all existing caches, sorted by name.
+std::vector<CallCacheStats> all_call_cache_stats();
+// Removes all entries from all caches. Statistics are kept.
+void clear_all_call_caches();
+
+
+// Type-erased interface used by the registry.
+class CallCacheBase {
+public:
+  explicit CallCacheBase(std::string name);
+  virtual ~CallCacheBase();
+  CallCacheBase(const CallCacheBase&) = delete;
+  CallCacheBase& operator=(const CallCacheBase&) = delete;
+
+  const std::string& name() const { return name_; }
+  virtual void clear() = 0;
+  virtual CallCacheStats stats() const = 0;
+
+private:
+  std::string name_;
+};
+
+
 template<typename Value, typename... Args>
-class CallCache {
+class CallCache : public CallCacheBase {
 public:
+  using ValuePtr = std::shared_ptr<const Value>;
+  using SizeFunc = std::function<int64_t(const Value&)>;
+
+  explicit CallCache(std::string name, CallCacheLimits limits = {}, SizeFunc size_func = nullptr)
+    : CallCacheBase(std::move(name)), limits_(limits), size_func_(std::move(size_func)) {
+    CHECK(limits_.max_bytes == 0 || size_func_) << "Cache size in bytes requires a size function";
+  }
+  ~CallCache() override = default;
+
+  template<typename F>
+  ValuePtr apply_shared(F&& func, Args... args) {
+    Key key{std::move(args)...};
+    std::shared_ptr<Entry> entry;
+    {
+      std::unique_lock lock(mutex_);
+      auto [it, inserted] = entries_.try_emplace(key);
+      if (!inserted) {
+        entry = it->second;
+        ++hits_;
+        if (entry->ready) {
+          lru_.splice(lru_.begin(), lru_, entry->lru_it);
+          return entry->value;
+        }
+        if (entry->owner == std::this_thread::get_id()) {
+          lock.unlock();
+          return std::make_shared<const Value>(std::apply(std::forward<F>(func), key));
+        }
+        entry_ready_.wait(lock, [&]() { return entry->ready; });
+        if (entry->error) {
+          std::rethrow_exception(entry->error);
+        }
+        return entry->value;
+      }
+      ++misses_;
+      entry = std::make_shared<Entry>();
+      entry->owner = std::this_thread::get_id();
+      it->second = entry;
+    }
+    ValuePtr value;
+    std::exception_ptr error;
+    try {
+      value = std::make_shared<const Value>(std::apply(std::forward<F>(func), key));
+    } catch (...) {
+      error = std::current_exception();
+    }
+    const int64_t bytes = value && size_func_ ? size_func_(*value) : 0;
+    {
+      std::lock_guard lock(mutex_);
+      entry->ready = true;
+      entry->value = value;
+      entry->error = error;
+      const auto it = entries_.find(key);
+      // The entry could have been removed by `clear` while computing.
+      const bool still_present = it != entries_.end() && it->second == entry;
+      if (still_present) {
+        if (error) {
+          entries_.erase(it);
+        } else {
+          lru_.push_front(&it->first);
+          entry->lru_it = lru_.begin();
+          entry->bytes = bytes;
+          total_bytes_ += bytes;
+          evict_if_needed();
+        }
+      }
+    }
+    entry_ready_.notify_all();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+    return value;
+  }
+
   template<typename F>
   Value apply(F&& func, Args... args) {
-    const std::tuple<Args...> args_tuple{std::move(args)...};
-    const auto it = cache_.find(args_tuple);
-    if (it != cache_.end()) {
-      return it->second;
-    } else {
-      Value ret = std::apply(std::forward<F>(func), args_tuple);
-      cache_[args_tuple] = ret;
-      return ret;
+    return *apply_shared(std::forward<F>(func), std::move(args)...);
+  }
+
+  void clear() override {
+    std::lock_guard lock(mutex_);
+    // Keep entries that are being computed: other threads are waiting for them.
+    for (const Key* key : lru_) {
+      entries_.erase(entries_.find(*key));
     }
+    lru_.clear();
+    total_bytes_ = 0;
+  }
+
+  CallCacheStats stats() const override {
+    std::lock_guard lock(mutex_);
+    return {name(), hits_, misses_, evictions_, static_cast<int64_t>(lru_.size()), total_bytes_};
   }
 
 private:
-  absl::flat_hash_map<std::tuple<Args...>, Value> cache_;
+  using Key = std::tuple<Args...>;
+  // List of ready entries, most recently used first. Points to keys in `entries_`, which have
+  // stable addresses.
+  using LruList = std::list<const Key*>;
+
+  struct Entry {
+    bool ready = false;
+    std::thread::id owner;  // the thread computing the value
+    ValuePtr value;
+    std::exception_ptr error;
+    typename LruList::iterator lru_it;
+    int64_t bytes = 0;
+  };
+
+  void evict_if_needed() {
+    // Note: the most recently added entry is never evicted, even if it exceeds the limit alone.
+    while (lru_.size() > 1 && (
+      (limits_.max_entries > 0 && static_cast<int64_t>(lru_.size()) > limits_.max_entries) ||
+      (limits_.max_bytes > 0 && total_bytes_ > limits_.max_bytes)
+    )) {
+      const auto it = entries_.find(*lru_.back());
+      total_bytes_ -= it->second->bytes;
+      lru_.pop_back();
+      entries_.erase(it);
+      ++evictions_;
+    }
+  }
+
+  const CallCacheLimits limits_;
+  const SizeFunc size_func_;
+  mutable std::mutex mutex_;
+  std::condition_variable entry_ready_;
+  absl::node_hash_map<Key, std::shared_ptr<Entry>> entries_;
+  LruList lru_;
+  int64_t total_bytes_ = 0;
+  int64_t hits_ = 0;
+  int64_t misses_ = 0;
+  int64_t evictions_ = 0;
 };
@@ -0,0 +1,78 @@
+#include "cancellation.h"
+
+#include <fstream>
+
+#ifndef _WIN32
+#  include <unistd.h>
+#endif
+
+#include "absl/strings/str_cat.h"
+
+#include "profiler.h"
+
+
+thread_local const CancellationToken* internal::current_cancellation_token = nullptr;
+thread_local int internal::cancellation_countdown = internal::kCancellationCheckPeriod;
+
+// Returns current resident set size. Falls back to peak RSS where the current value is not
+// available.
+static int64_t current_rss_bytes() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  int64_t total_pages = 0;
+  int64_t resident_pages = 0;
+  if (statm >> total_pages >> resident_pages) {
+    return resident_pages * sysconf(_SC_PAGESIZE);
+  }
+#endif
+  return int64_t(process_resource_usage().max_rss_kb) * 1024;
+}
+
+static void throw_memory_budget_exceeded [[noreturn]] (int64_t memory_used, int64_t budget) {
+  throw MemoryBudgetExceeded(absl::StrCat(
+    "Memory budget exceeded: using ", memory_used, " bytes, budget is ", budget, " bytes"
+  ));
+}
+
+void CancellationToken::set_timeout(double seconds) {
+  set_deadline(
+    std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+      std::chrono::duration<double>(seconds)
+    )
+  );
+}
+
+void CancellationToken::check() const {
+  if (is_cancelled()) {
+    throw OperationCancelled();
+  }
+  if (deadline_ == std::chrono::steady_clock::time_point::max() && memory_budget_bytes_ == 0) {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (now >= deadline_) {
+    throw DeadlineExceeded();
+  }
+  if (memory_budget_bytes_ > 0) {
+    // Once over budget, stop all threads, not only the one that sampled memory usage.
+    const int64_t memory_used = memory_used_over_budget_.load(std::memory_order_relaxed);
+    if (memory_used > 0) {
+      throw_memory_budget_exceeded(memory_used, memory_budget_bytes_);
+    }
+    const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      now.time_since_epoch()
+    ).count();
+    int64_t next_check_ns = next_memory_check_ns_.load(std::memory_order_relaxed);
+    // Only one thread samples memory usage per interval.
+    if (now_ns >= next_check_ns && next_memory_check_ns_.compare_exchange_strong(
+          next_check_ns, now_ns + int64_t(kMemoryCheckIntervalMs) * 1'000'000,
+          std::memory_order_relaxed)) {
+      const int64_t rss_bytes = current_rss_bytes();
+      if (rss_bytes > memory_budget_bytes_) {
+        memory_used_over_budget_.store(rss_bytes, std::memory_order_relaxed);
+        throw_memory_budget_exceeded(rss_bytes, memory_budget_bytes_);
+      }
+    }
+  }
+}
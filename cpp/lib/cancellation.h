@@ -0,0 +1,124 @@
+// Cooperative cancellation of long computations.
+//
+// A `CancellationToken` describes when a computation should stop: when `cancel` is called (from
+// any thread), when the deadline passes or when the process uses more memory than the budget.
+// The token is installed for the current thread via `ScopedCancellationToken` and inherited by
+// parallel tasks started from it. Main loops (Lyndon basis conversion, shuffle, space processing,
+// matrix rank) call `check_cancellation` or `check_cancellation_periodically`, which throw
+// a subclass of `OperationCancelled` if the computation must stop. The exception propagates out
+// of parallel primitives to the caller like any other exception.
+//
+// Memory budget is soft: it is compared against the resident set size of the whole process,
+// which is sampled at most every `kMemoryCheckIntervalMs` milliseconds. Memory allocated between
+// checks, e.g. by a single LinBox call, can exceed the budget.
+//
+// Usage:
+//   CancellationToken token;
+//   token.set_timeout(60);
+//   token.set_memory_budget_bytes(int64_t(16) << 30);
+//   ScopedCancellationToken cancellation_guard(&token);
+//   try {
+//     ... = space_rank(...);
+//   } catch (const OperationCancelled& error) {
+//     ...
+//   }
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+
+class OperationCancelled : public std::runtime_error {
+public:
+  explicit OperationCancelled(const std::string& what = "Operation cancelled")
+    : std::runtime_error(what) {}
+};
+
+class DeadlineExceeded : public OperationCancelled {
+public:
+  DeadlineExceeded() : OperationCancelled("Deadline exceeded") {}
+};
+
+class MemoryBudgetExceeded : public OperationCancelled {
+public:
+  explicit MemoryBudgetExceeded(const std::string& what) : OperationCancelled(what) {}
+};
+
+
+// Setters must be called before the token is installed. `cancel` can be called at any time from
+// any thread.
+class CancellationToken {
+public:
+  static constexpr int kMemoryCheckIntervalMs = 50;
+
+  void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+  bool is_cancelled() const { return cancelled_.load(std::memory_order_relaxed); }
+
+  void set_deadline(std::chrono::steady_clock::time_point deadline) { deadline_ = deadline; }
+  void set_timeout(double seconds);
+
+  // Budget for the resident set size of the process; 0 means no limit.
+  void set_memory_budget_bytes(int64_t bytes) { memory_budget_bytes_ = bytes; }
+
+  // Throws if the computation must stop.
+  void check() const;
+
+private:
+  std::atomic<bool> cancelled_ = false;
+  std::chrono::steady_clock::time_point deadline_ = std::chrono::steady_clock::time_point::max();
+  int64_t memory_budget_bytes_ = 0;
+  mutable std::atomic<int64_t> next_memory_check_ns_ = 0;
+  mutable std::atomic<int64_t> memory_used_over_budget_ = 0;  // last sampled RSS, if over budget
+};
+
+
+namespace internal {
+extern thread_local const CancellationToken* current_cancellation_token;
+extern thread_local int cancellation_countdown;
+constexpr int kCancellationCheckPeriod = 64;
+}  // namespace internal
+
+// Token that applies to computations on this thread; nullptr if none.
+inline const CancellationToken* current_cancellation_token() {
+  return internal::current_cancellation_token;
+}
+
+class ScopedCancellationToken {
+public:
+  explicit ScopedCancellationToken(const CancellationToken* token)
+    : previous_(internal::current_cancellation_token) {
+    internal::current_cancellation_token = token;
+  }
+  ~ScopedCancellationToken() {
+    internal::current_cancellation_token = previous_;
+  }
+  ScopedCancellationToken(const ScopedCancellationToken&) = delete;
+  ScopedCancellationToken& operator=(const ScopedCancellationToken&) = delete;
+
+private:
+  const CancellationToken* previous_ = nullptr;
+};
+
+// Throws if the current token requires to stop. For coarse-grained loops.
+inline void check_cancellation() {
+  if (const CancellationToken* token = internal::current_cancellation_token) {
+    token->check();
+  }
+}
+
+// Like `check_cancellation`, but only checks the deadline and the memory budget on every
+// `kCancellationCheckPeriod`-th call. For hot loops.
+inline void check_cancellation_periodically() {
+  if (const CancellationToken* token = internal::current_cancellation_token) {
+    if (--internal::cancellation_countdown <= 0) {
+      internal::cancellation_countdown = internal::kCancellationCheckPeriod;
+      token->check();
+    } else if (token->is_cancelled()) {
+      throw OperationCancelled();
+    }
+  }
+}
@@ -0,0 +1,185 @@
+#include "checkpoint.h"
+
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+
+#include "fingerprint.h"
+
+
+// File format versions. Must be changed whenever the layout changes.
+static constexpr uint64_t kSnapshotMagic = 0x706b'736e'6170'0001;
+static constexpr uint64_t kJournalMagic = 0x706b'6a72'6e6c'0001;
+
+static std::chrono::steady_clock::duration to_duration(double seconds) {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(seconds)
+  );
+}
+
+static std::string read_file(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  CHECK(in.good()) << "Cannot open " << path;
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// Payload size is fixed-width, so that a truncated journal record can be detected without parsing.
+static void write_payload(BinaryWriter& writer, const std::string& payload) {
+  writer.write_pod<uint64_t>(payload.size());
+  writer.write_bytes(payload.data(), payload.size());
+  writer.write_pod(fingerprint(payload));
+}
+
+static void check_key(const std::string& saved_key, const std::string& key, const std::string& path) {
+  CHECK_EQ(saved_key, key) << "Checkpoint " << path << " was written for a different computation";
+}
+
+
+SnapshotCheckpoint::SnapshotCheckpoint(std::string path, std::string key, double interval_sec)
+  : path_(std::move(path)),
+    key_(std::move(key)),
+    interval_(to_duration(interval_sec)),
+    last_save_(std::chrono::steady_clock::now()) {}
+
+bool SnapshotCheckpoint::load(const std::function<void(BinaryReader&)>& read_state) {
+  if (!std::filesystem::exists(path_)) {
+    return false;
+  }
+  std::stringstream file(read_file(path_));
+  BinaryReader file_reader(file);
+  CHECK_EQ(file_reader.read_pod<uint64_t>(), kSnapshotMagic) << "Not a checkpoint: " << path_;
+  std::string saved_key;
+  deserialize(file_reader, saved_key);
+  check_key(saved_key, key_, path_);
+  std::string payload(file_reader.read_pod<uint64_t>(), '\0');
+  file_reader.read_bytes(payload.data(), payload.size());
+  CHECK(file_reader.read_pod<Fingerprint128>() == fingerprint(payload))
+    << "Checkpoint " << path_ << " is corrupted";
+  BinaryReader reader(payload.data(), payload.size());
+  read_state(reader);
+  return true;
+}
+
+bool SnapshotCheckpoint::due() const {
+  return std::chrono::steady_clock::now() - last_save_ >= interval_;
+}
+
+void SnapshotCheckpoint::save(const std::function<void(BinaryWriter&)>& write_state) {
+  std::string payload;
+  BinaryWriter payload_writer(payload);
+  write_state(payload_writer);
+  const std::string tmp_path = path_ + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+    BinaryWriter writer(out);
+    writer.write_pod(kSnapshotMagic);
+    serialize(writer, key_);
+    write_payload(writer, payload);
+    out.flush();
+    CHECK(writer.ok()) << "Cannot write " << tmp_path;
+  }
+  std::filesystem::rename(tmp_path, path_);
+  last_save_ = std::chrono::steady_clock::now();
+}
+
+void SnapshotCheckpoint::remove() {
+  std::filesystem::remove(path_);
+}
+
+
+JournalCheckpoint::JournalCheckpoint(std::string path, std::string key, double interval_sec)
+  : path_(std::move(path)),
+    key_(std::move(key)),
+    interval_(to_duration(interval_sec)),
+    last_flush_(std::chrono::steady_clock::now()) {}
+
+JournalCheckpoint::~JournalCheckpoint() {
+  if (out_.is_open()) {
+    out_.flush();
+  }
+}
+
+int JournalCheckpoint::replay(const std::function<void(BinaryReader&)>& read_record) {
+  std::lock_guard lock(mutex_);
+  CHECK(!replayed_);
+  replayed_ = true;
+  if (!std::filesystem::exists(path_)) {
+    out_.open(path_, std::ios::binary | std::ios::trunc);
+    BinaryWriter writer(out_);
+    writer.write_pod(kJournalMagic);
+    serialize(writer, key_);
+    out_.flush();
+    CHECK(writer.ok()) << "Cannot write " << path_;
+    return 0;
+  }
+
+  const std::string data = read_file(path_);
+  std::stringstream file(data);
+  BinaryReader file_reader(file);
+  CHECK_EQ(file_reader.read_pod<uint64_t>(), kJournalMagic) << "Not a journal: " << path_;
+  std::string saved_key;
+  deserialize(file_reader, saved_key);
+  check_key(saved_key, key_, path_);
+
+  // Records are read manually rather than via `BinaryReader`, because a truncated record at the
+  // end is expected after a crash and must not be fatal.
+  size_t pos = file.tellg();
+  int num_records = 0;
+  while (true) {
+    uint64_t size = 0;
+    if (pos + sizeof(size) > data.size()) {
+      break;
+    }
+    std::memcpy(&size, data.data() + pos, sizeof(size));
+    const size_t record_end = pos + sizeof(size) + size + sizeof(Fingerprint128);
+    if (size > data.size() || record_end > data.size()) {
+      break;
+    }
+    const std::string_view payload(data.data() + pos + sizeof(size), size);
+    Fingerprint128 checksum;
+    std::memcpy(&checksum, payload.data() + size, sizeof(checksum));
+    if (checksum != fingerprint(payload)) {
+      break;
+    }
+    BinaryReader reader(payload.data(), payload.size());
+    read_record(reader);
+    ++num_records;
+    pos = record_end;
+  }
+  if (pos < data.size()) {
+    std::filesystem::resize_file(path_, pos);
+  }
+  out_.open(path_, std::ios::binary | std::ios::app);
+  CHECK(out_.good()) << "Cannot write " << path_;
+  return num_records;
+}
+
+void JournalCheckpoint::append(const std::function<void(BinaryWriter&)>& write_record) {
+  std::string payload;
+  BinaryWriter payload_writer(payload);
+  write_record(payload_writer);
+  std::lock_guard lock(mutex_);
+  CHECK(replayed_) << "JournalCheckpoint::replay must be called first";
+  BinaryWriter writer(out_);
+  write_payload(writer, payload);
+  CHECK(writer.ok()) << "Cannot write " << path_;
+  const auto now = std::chrono::steady_clock::now();
+  if (now - last_flush_ >= interval_) {
+    out_.flush();
+    last_flush_ = now;
+  }
+}
+
+void JournalCheckpoint::flush() {
+  std::lock_guard lock(mutex_);
+  out_.flush();
+  last_flush_ = std::chrono::steady_clock::now();
+}
+
+void JournalCheckpoint::remove() {
+  std::lock_guard lock(mutex_);
+  out_.close();
+  std::filesystem::remove(path_);
+}
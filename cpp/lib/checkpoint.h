@@ -0,0 +1,135 @@
+// Checkpoints for long batch computations.
+//
+// A computation that runs for hours can periodically save its partial state, so that after a crash
+// (or a cancellation, see cancellation.h) it can be restarted from the last checkpoint rather than
+// from scratch. Two kinds of checkpoints are provided:
+//
+//   * `SnapshotCheckpoint` stores the whole state at once. It's suitable when the state is compact,
+//     e.g. a partial sum of expressions plus the set of completed tasks. Files are replaced
+//     atomically, so a crash during a save keeps the previous snapshot intact.
+//
+//   * `JournalCheckpoint` is an append-only log of records. It's suitable when each task produces
+//     a result that is large, but the results don't need to be combined, e.g. prepared space
+//     elements that are fed to a matrix builder. A record that was only partially written before
+//     a crash is detected via checksum and dropped.
+//
+// Each checkpoint has a `key` describing the computation (e.g. its parameters). Loading
+// a checkpoint written for a different key is a fatal error: it prevents resuming from stale data.
+// Checkpoints don't track code changes: if the code is modified, the old checkpoint must be removed.
+//
+// Sample usage:
+//   SnapshotCheckpoint checkpoint("/tmp/colivec.ckpt", "CoLiVec(3,[1,1])");
+//   const auto sequences = increasing_sequences(n);
+//   const auto ret = checkpointed_sum<EpsilonICoExpr>(checkpoint, sequences.size(), [&](int i) {
+//     return term_for_sequence(sequences[i]);
+//   });
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "parallel_util.h"
+#include "serialization.h"
+
+
+class SnapshotCheckpoint {
+public:
+  // `interval_sec` is the minimum time between two saves, see `due`.
+  SnapshotCheckpoint(std::string path, std::string key, double interval_sec = 60);
+
+  const std::string& path() const { return path_; }
+
+  // Returns false if there is no checkpoint. Otherwise calls `read_state` with the saved state.
+  bool load(const std::function<void(BinaryReader&)>& read_state);
+
+  // Whether enough time has passed since the last save (or since the checkpoint was created).
+  bool due() const;
+
+  void save(const std::function<void(BinaryWriter&)>& write_state);
+
+  // Should be called when the computation is finished.
+  void remove();
+
+private:
+  std::string path_;
+  std::string key_;
+  std::chrono::steady_clock::duration interval_;
+  std::chrono::steady_clock::time_point last_save_;
+};
+
+
+// Thread-safe.
+class JournalCheckpoint {
+public:
+  // `interval_sec` is the maximum time between a record being appended and being flushed to disk.
+  JournalCheckpoint(std::string path, std::string key, double interval_sec = 10);
+  ~JournalCheckpoint();
+
+  const std::string& path() const { return path_; }
+
+  // Calls `read_record` for each complete record in the journal and returns the number of
+  // records. Must be called once, before the first `append`. Creates the journal if it doesn't
+  // exist.
+  int replay(const std::function<void(BinaryReader&)>& read_record);
+
+  void append(const std::function<void(BinaryWriter&)>& write_record);
+
+  void flush();
+
+  // Should be called when the computation is finished.
+  void remove();
+
+private:
+  std::string path_;
+  std::string key_;
+  std::chrono::steady_clock::duration interval_;
+  std::chrono::steady_clock::time_point last_flush_;
+  std::mutex mutex_;
+  std::ofstream out_;
+  bool replayed_ = false;
+};
+
+
+// Computes `func(0) + ... + func(num_tasks - 1)` in parallel. The sum of completed tasks is saved
+// to `checkpoint` periodically. If `checkpoint` contains a saved state, completed tasks are skipped.
+// The checkpoint is removed once the sum is computed.
+// Note. The result is the same regardless of resumptions as long as `T` addition is commutative.
+template<typename T, typename F>
+T checkpointed_sum(SnapshotCheckpoint& checkpoint, int num_tasks, const F& func) {
+  std::vector<bool> completed(num_tasks, false);
+  T sum{};
+  checkpoint.load([&](BinaryReader& reader) {
+    deserialize(reader, completed);
+    deserialize(reader, sum);
+    CHECK_EQ(completed.size(), num_tasks) << "Checkpoint " << checkpoint.path() << " is stale";
+  });
+  std::vector<int> remaining;
+  for (const int i : range(num_tasks)) {
+    if (!completed[i]) {
+      remaining.push_back(i);
+    }
+  }
+  std::mutex mutex;
+  parallel_for(remaining.size(), [&](int idx) {
+    const int task = remaining[idx];
+    T term = func(task);
+    std::lock_guard lock(mutex);
+    sum += term;
+    completed[task] = true;
+    if (checkpoint.due()) {
+      checkpoint.save([&](BinaryWriter& writer) {
+        serialize(writer, completed);
+        serialize(writer, sum);
+      });
+    }
+  }, 1);
+  checkpoint.remove();
+  return sum;
+}
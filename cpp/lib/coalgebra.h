@@ -36,7 +36,10 @@
 
 #pragma once
 
+#include "absl/container/node_hash_map.h"
+
 #include "algebra.h"
+#include "cancellation.h"
 #include "lyndon.h"
 #include "sorting.h"
 
@@ -148,33 +151,144 @@ auto icoproduct(Args&&... args) {
 }
 
 
+namespace internal {
+// Lyndon basis expansions of single words. Not thread-safe: meant to be local to one operation.
 template<typename ExprT>
-auto icomultiply(const ExprT& expr, std::vector<int> form) {
-  using CoExprT = ICoExprForExpr_t<ExprT>;
-  static_assert(CoExprT::Param::coproduct_is_lie_algebra);
-  if (expr.is_zero()) {
-    return CoExprT{};
+class LyndonExpansionCache {
+public:
+  using KeyT = typename ExprT::StorageT;
+  using ExpansionT = std::vector<std::pair<KeyT, int>>;
+
+  // The reference stays valid for the lifetime of the cache.
+  const ExpansionT& expand(const KeyT& key) {
+    auto it = cache_.find(key);
+    if (it == cache_.end()) {
+      ExpansionT expansion;
+      to_lyndon_basis(ExprT::single_key(key)).foreach_key([&](const KeyT& term, int coeff) {
+        expansion.emplace_back(term, coeff);
+      });
+      it = cache_.emplace(key, std::move(expansion)).first;
+    }
+    return it->second;
+  }
+
+private:
+  absl::node_hash_map<KeyT, ExpansionT> cache_;
+};
+
+// Whether co-expression keys are plain vectors of part keys which are in turn plain vectors of
+// letters, so that comultiplication can be computed without converting keys to objects.
+// Optimization potential: support other key types (`CoExprT::StorageT` is not always a vector).
+template<typename CoParamT, typename = void>
+struct CoExprSupportsKeySpace : std::false_type {};
+template<typename CoParamT>
+struct CoExprSupportsKeySpace<CoParamT, std::void_t<typename CoParamT::PartExprParam>> : std::bool_constant<
+  std::is_same_v<typename CoParamT::VectorT, typename CoParamT::StorageT> &&
+  std::is_same_v<typename CoParamT::PartExprParam::VectorT, typename CoParamT::PartExprParam::StorageT> &&
+  std::is_same_v<typename CoParamT::StorageT::value_type, typename CoParamT::PartExprParam::StorageT>
+> {};
+template<typename CoParamT>
+constexpr bool coexpr_supports_key_space = CoExprSupportsKeySpace<CoParamT>::value;
+
+// Calls `func(co_key, coeff)` for each combination of terms from `expansions`, one term for each
+// part, with `coeff` multiplied by the term coefficients.
+template<typename CoKeyT, typename ExpansionT, typename F>
+void for_each_expansion_product(const std::vector<const ExpansionT*>& expansions, int coeff, const F& func) {
+  if (absl::c_any_of(expansions, [](const auto* expansion) { return expansion->empty(); })) {
+    return;
+  }
+  std::vector<int> indices(expansions.size(), 0);
+  while (true) {
+    CoKeyT co_key;
+    int term_coeff = coeff;
+    for (const int i : range(expansions.size())) {
+      const auto& [key, key_coeff] = (*expansions[i])[indices[i]];
+      co_key.push_back(key);
+      term_coeff *= key_coeff;
+    }
+    func(std::move(co_key), term_coeff);
+    int pos = expansions.size() - 1;
+    while (pos >= 0 && ++indices[pos] == expansions[pos]->size()) {
+      indices[pos] = 0;
+      --pos;
+    }
+    if (pos < 0) {
+      break;
+    }
+  }
+}
+
+// Adds the iterated comultiplication of a single term to `ret`. The result is not converted to
+// Lyndon basis: since the conversion is linear, it's enough to do it once after all terms have
+// been added. `form` must be sorted.
+template<typename CoExprT, typename KeyT, typename ExprT>
+void icomultiply_add_term_keys(
+  const KeyT& key, int coeff, const std::vector<int>& form,
+  LyndonExpansionCache<ExprT>& lyndon_cache, CoExprT& ret
+) {
+  using CoKeyT = typename CoExprT::StorageT;
+  using ExpansionT = typename LyndonExpansionCache<ExprT>::ExpansionT;
+
+  const auto add_products = [&](const std::vector<const ExpansionT*>& expansions, int coeff) {
+    for_each_expansion_product<CoKeyT>(expansions, coeff, [&](const CoKeyT& co_key, int term_coeff) {
+      ret.add_to_key(co_key, term_coeff);
+    });
+  };
+  const auto expand_slice = [&](int from, int to) {
+    return &lyndon_cache.expand(KeyT(key.begin() + from, key.begin() + to));
+  };
+
+  const int weight = sum(form);
+  CHECK_EQ(key.size(), weight);
+  if (form.size() == 2) {
+    add_products({expand_slice(0, form[0]), expand_slice(form[0], weight)}, coeff);
+    if (form[0] != form[1]) {
+      add_products({expand_slice(form[1], weight), expand_slice(0, form[1])}, -coeff);
+    }
+  } else {
+    std::vector<const ExpansionT*> expansions;
+    int part_begin = 0;
+    for (const int part_weight : form) {
+      expansions.push_back(expand_slice(part_begin, part_begin + part_weight));
+      part_begin += part_weight;
+    }
+    add_products(expansions, coeff);
   }
-  const int weight = expr.weight();
+}
+
+// Computes the same as `icomultiply_impl_objects` directly in key space. Lyndon expansions of
+// prefixes and suffixes are memoized; the co-expression is converted to Lyndon basis once at the
+// end rather than for each term.
+template<typename CoExprT, typename ExprT>
+CoExprT icomultiply_impl_keys(const ExprT& expr, const std::vector<int>& form) {
+  LyndonExpansionCache<ExprT> lyndon_cache;
+  CoExprT ret;
+  expr.foreach_key([&](const auto& key, int coeff) {
+    check_cancellation_periodically();
+    icomultiply_add_term_keys(key, coeff, form, lyndon_cache, ret);
+  });
+  return to_lyndon_basis(ret);
+}
+
+inline void icomultiply_check_form(int weight, const std::vector<int>& form) {
   CHECK_EQ(sum(form), weight)
       << "Cannot comultiply an expression of weight " << weight
       << " into parts " << str_join(form, " + ") << " = " << sum(form);
   CHECK(form.size() >= 2) << dump_to_string(form);
   CHECK(form.size() == 2 || all_equal(form))
       << "Iterated comultiplication into three or more unequal parts is not supported: " << dump_to_string(form);
-  absl::c_sort(form);  // avoid unnecessary work in `normalize_coproduct`
+}
 
+// Reference implementation that goes through `icoproduct`. Used for expressions with non-vector keys.
+template<typename CoExprT, typename ExprT>
+CoExprT icomultiply_impl_objects(const ExprT& expr, const std::vector<int>& form) {
   using MonomT = typename ExprT::StorageT;
-  // Optimization potential: remove conversion of vector form to key (here) and back
-  // (inside to_lyndon_basis inside coproduct). Idea: convert to Lyndon basis here
-  // and add a compile-time flag to `icoproduct` saying that this is no longer required;
-  // note that in this case it might be better to convert the entire expression first
-  // (see above).
   static auto make_copart = [](auto span) {
     return ExprT::single_key(
       ExprT::Param::vector_to_key(typename ExprT::Param::VectorT(span.begin(), span.end()))
     );
   };
+  const int weight = sum(form);
   CoExprT ret;
   expr.foreach_key([&](const MonomT& monom, int coeff) {
     const auto& monom_vec = ExprT::Param::key_to_vector(monom);
@@ -204,6 +318,26 @@ auto icomultiply(const ExprT& expr, std::vector<int> form) {
       ret += coeff * icoproduct_vec(parts);
     }
   });
+  return ret;
+}
+}  // namespace internal
+
+template<typename ExprT>
+auto icomultiply(const ExprT& expr, std::vector<int> form) {
+  using CoExprT = ICoExprForExpr_t<ExprT>;
+  static_assert(CoExprT::Param::coproduct_is_lie_algebra);
+  if (expr.is_zero()) {
+    return CoExprT{};
+  }
+  internal::icomultiply_check_form(expr.weight(), form);
+  absl::c_sort(form);  // avoid unnecessary work in `normalize_coproduct`
+
+  CoExprT ret;
+  if constexpr (internal::coexpr_supports_key_space<typename CoExprT::Param>) {
+    ret = internal::icomultiply_impl_keys<CoExprT>(expr, form);
+  } else {
+    ret = internal::icomultiply_impl_objects<CoExprT>(expr, form);
+  }
   return ret.copy_annotations_mapped(
     expr, [](const std::string& annotation) {
       return fmt::comult() + annotation;
@@ -212,28 +346,100 @@ auto icomultiply(const ExprT& expr, std::vector<int> form) {
 }
 
 namespace internal {
-template<typename CoExprT>
-auto ncomultiply_impl(const CoExprT& coexpr, std::vector<int> form) {
-  if (coexpr.is_zero()) {
-    return CoExprT{};
+// Returns the positions to cut a part of length `parts_lengths[i_cut_part]` at, such that the
+// lengths of the resulting parts form `form` (sorted). All positions if `form` is empty.
+inline std::vector<int> ncomultiply_cut_positions(
+  const std::vector<int>& parts_lengths, int i_cut_part, const std::vector<int>& form
+) {
+  const int cut_part_length = parts_lengths[i_cut_part];
+  if (form.empty()) {
+    return to_vector(range(1, cut_part_length));
   }
-  const int weight = coexpr.weight();
-  if (!form.empty()) {
-    CHECK_EQ(sum(form), weight)
-        << "Cannot comultiply an expression of weight " << weight
-        << " into parts " << str_join(form, " + ") << " = " << sum(form);
-    CHECK(form.size() == coexpr.element().first.size() + 1) << dump_to_string(form);
-    absl::c_sort(form);
+  std::vector<int> remaining = form;
+  for (const int i_part : range(parts_lengths.size())) {
+    if (i_part != i_cut_part) {
+      const auto it = absl::c_find(remaining, parts_lengths[i_part]);
+      if (it == remaining.end()) {
+        return {};
+      }
+      remaining.erase(it);
+    }
+  }
+  CHECK_EQ(remaining.size(), 2);
+  const auto [a, b] = std::pair{remaining[0], remaining[1]};
+  if (a + b != cut_part_length) {
+    return {};
   }
+  return a == b ? std::vector{a} : std::vector{a, b};
+}
+
+// Adds the normal comultiplication of a single term to `ret`. Cuts that don't match `form` are not
+// enumerated at all. `form` must be sorted or empty.
+template<typename CoExprT, typename PartExprT>
+void ncomultiply_add_term_keys(
+  const typename CoExprT::StorageT& parts, int coeff, const std::vector<int>& form,
+  LyndonExpansionCache<PartExprT>& lyndon_cache, CoExprT& ret
+) {
+  using PartKeyT = typename PartExprT::StorageT;
+  using CoKeyT = typename CoExprT::StorageT;
+  using ExpansionT = typename LyndonExpansionCache<PartExprT>::ExpansionT;
+
+  std::vector<const ExpansionT*> expansions;
+  const auto add_products = [&](int coeff) {
+    for_each_expansion_product<CoKeyT>(expansions, coeff, [&](CoKeyT co_key, int term_coeff) {
+      // Note: the comparator must match `normalize_coproduct`.
+      const int sign = sort_with_sign(co_key, DISAMBIGUATE(compare_length_first));
+      if (all_unique_sorted(co_key)) {
+        ret.add_to_key(co_key, sign * term_coeff);
+      }
+    });
+  };
+
+  const auto parts_lengths = mapped(parts, [](const PartKeyT& part) -> int { return part.size(); });
+  for (const int i_cut_part : range(parts.size())) {
+    const PartKeyT& cut_part = parts[i_cut_part];
+    for (const int cut_pos : ncomultiply_cut_positions(parts_lengths, i_cut_part, form)) {
+      expansions.clear();
+      for (const int i_part : range(parts.size())) {
+        if (i_part == i_cut_part) {
+          expansions.push_back(&lyndon_cache.expand(PartKeyT(cut_part.begin(), cut_part.begin() + cut_pos)));
+          expansions.push_back(&lyndon_cache.expand(PartKeyT(cut_part.begin() + cut_pos, cut_part.end())));
+        } else {
+          expansions.push_back(&lyndon_cache.expand(parts[i_part]));
+        }
+      }
+      add_products(neg_one_pow(i_cut_part) * coeff);
+    }
+  }
+}
 
+// Computes the same as `ncomultiply_impl_objects` directly in key space. Lyndon expansions of the
+// parts are memoized, because the same slices appear in many terms.
+template<typename CoExprT>
+CoExprT ncomultiply_impl_keys(const CoExprT& coexpr, const std::vector<int>& form) {
+  LyndonExpansionCache<Linear<typename CoExprT::Param::PartExprParam>> lyndon_cache;
+  CoExprT ret;
+  coexpr.foreach_key([&](const auto& parts, int coeff) {
+    check_cancellation_periodically();
+    ncomultiply_add_term_keys(parts, coeff, form, lyndon_cache, ret);
+  });
+  return ret;
+}
+
+inline void ncomultiply_check_form(int weight, int num_parts, const std::vector<int>& form) {
+  CHECK_EQ(sum(form), weight)
+      << "Cannot comultiply an expression of weight " << weight
+      << " into parts " << str_join(form, " + ") << " = " << sum(form);
+  CHECK(form.size() == num_parts + 1) << dump_to_string(form);
+}
+
+// Reference implementation in object space. Used for co-expressions with non-vector keys.
+template<typename CoExprT>
+CoExprT ncomultiply_impl_objects(const CoExprT& coexpr, const std::vector<int>& form) {
   using ExprT = Linear<typename CoExprT::Param::PartExprParam>;
-  // using MonomT = typename CoExprT::StorageT;
   using ObjectT = typename CoExprT::ObjectT;
   CoExprT ret;
-  // Optimization potential: operate in key space
-  // Optimization potential: smarter cut point iteration if form is given.
   coexpr.foreach([&](const ObjectT& parts, int coeff) {
-    // const ObjectT parts = CoExprT::Param::key_to_vector(monom);
     for (int i_cut_part : range(parts.size())) {
       const auto& cut_part = parts[i_cut_part];
       for (int cut_pos : range(1, cut_part.size())) {
@@ -258,6 +464,24 @@ auto ncomultiply_impl(const CoExprT& coexpr, std::vector<int> form) {
       return sizes == form;
     });
   }
+  return ret;
+}
+
+template<typename CoExprT>
+auto ncomultiply_impl(const CoExprT& coexpr, std::vector<int> form) {
+  if (coexpr.is_zero()) {
+    return CoExprT{};
+  }
+  if (!form.empty()) {
+    ncomultiply_check_form(coexpr.weight(), coexpr.element().first.size(), form);
+    absl::c_sort(form);
+  }
+  CoExprT ret;
+  if constexpr (coexpr_supports_key_space<typename CoExprT::Param>) {
+    ret = ncomultiply_impl_keys(coexpr, form);
+  } else {
+    ret = ncomultiply_impl_objects(coexpr, form);
+  }
   return ret.copy_annotations_mapped(
     coexpr, [](const std::string& annotation) {
       return fmt::comult() + annotation;
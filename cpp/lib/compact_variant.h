@@ -13,6 +13,12 @@ public:
   using std::variant<Ts...>::variant;
 };
 
+// Equivalent of `std::visit` for a single variant.
+template<typename F, typename... Ts>
+constexpr decltype(auto) compact_visit(F&& func, const CompactVariant<Ts...>& var) {
+  return std::visit(std::forward<F>(func), static_cast<const std::variant<Ts...>&>(var));
+}
+
 // TODO: Implement other `std::variant` methods and relevant non-member function.
 template<typename T>
 class CompactVariant<T> {
@@ -34,6 +40,11 @@ public:
     return H::combine(std::move(h), var.value_);
   }
 
+  template<typename F>
+  friend constexpr decltype(auto) compact_visit(F&& func, const CompactVariant& var) {
+    return std::forward<F>(func)(var.value_);
+  }
+
 private:
   T value_;
 };
@@ -11,6 +11,7 @@
 #include "absl/types/span.h"
 
 #include "pvector.h"
+#include "serialization.h"
 
 
 namespace internal {
@@ -34,6 +35,7 @@ using CompressedBlobData = PVector<unsigned char, 10>;
 template<typename Tag>
 class CompressedBlob {
 public:
+  CompressedBlob() {}
   CompressedBlob(internal::CompressedBlobData data) : data_(std::move(data)) {}
   const internal::CompressedBlobData& data() const { return data_; };
 
@@ -52,6 +54,17 @@ private:
   internal::CompressedBlobData data_;
 };
 
+template<typename T>
+void serialize(BinaryWriter& writer, const CompressedBlob<T>& blob) {
+  serialize(writer, blob.data());
+}
+template<typename T>
+void deserialize(BinaryReader& reader, CompressedBlob<T>& blob) {
+  internal::CompressedBlobData data;
+  deserialize(reader, data);
+  blob = CompressedBlob<T>(std::move(data));
+}
+
 namespace internal {
 template<typename T>
 struct IsCompressedBlob : std::false_type {};
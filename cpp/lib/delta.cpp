@@ -1,7 +1,10 @@
 #include "delta.h"
 
+#include <array>
+
 #include "absl/container/flat_hash_set.h"
 
+#include "bitset_util.h"
 #include "util.h"
 
 
@@ -90,6 +93,7 @@ static X substitution_result(X orig, const std::vector<X>& new_points) {
 
 DeltaExpr substitute_variables(const DeltaExpr& expr, const XArgs& new_points_arg) {
   const auto& new_points = new_points_arg.as_x();
+#if DISABLE_PACKING
   return expr.mapped_expanding([&](const DeltaExpr::ObjectT& term_old) -> DeltaExpr {
     std::vector<Delta> term_new;
     for (const Delta& d_old : term_old) {
@@ -104,42 +108,30 @@ DeltaExpr substitute_variables(const DeltaExpr& expr, const XArgs& new_points_ar
     }
     return DeltaExpr::single(term_new);
   }).without_annotations();
-}
-
-// TODO: Adopt optimized implementation to support X forms.
-#if 0
-#if DISABLE_PACKING
-// ...
 #else
-DeltaExpr substitute_variables(const DeltaExpr& expr, const XArgs& new_points_arg) {
-  constexpr int kMaxChar = std::numeric_limits<unsigned char>::max();
-  constexpr int kNoReplacement = kMaxChar;
-  constexpr int kNil = kMaxChar - 1;
-  const auto& new_points = new_points_arg.as_x();
-  std::array<unsigned char, kMaxChar> replacements;
-  replacements.fill(kNoReplacement);
-  const int num_src_vars = new_points.size();
-  for (int a : range_incl(1, num_src_vars)) {
-    for (int b : range_incl(a+1, num_src_vars)) {
-      const Delta before = Delta(a, b);
-      const Delta after = Delta(new_points[a-1], new_points[b-1]);
-      const unsigned char key_before = delta_alphabet_mapping.to_alphabet(before);
-      if (after.is_nil()) {
-        replacements.at(key_before) = kNil;
-      } else {
-        const unsigned char key_after = delta_alphabet_mapping.to_alphabet(after);
-        CHECK(key_after != kNoReplacement);
-        CHECK(key_after != kNil);
-        replacements.at(key_before) = key_after;
-      }
+  // Substitution acts on each letter independently, so it can be done in key space via
+  // a lookup table which is filled lazily.
+  constexpr int kNotComputed = -1;
+  constexpr int kNil = -2;
+  std::array<int, std::numeric_limits<internal::DeltaDiffT>::max() + 1> replacements;
+  replacements.fill(kNotComputed);
+  const auto replacement = [&](int ch) {
+    int& ch_new = replacements[ch];
+    if (ch_new == kNotComputed) {
+      const Delta d_old = delta_alphabet_mapping.from_alphabet(ch);
+      const Delta d_new(
+        substitution_result(d_old.a(), new_points),
+        substitution_result(d_old.b(), new_points)
+      );
+      ch_new = d_new.is_nil() ? kNil : delta_alphabet_mapping.to_alphabet(d_new);
     }
-  }
+    return ch_new;
+  };
   DeltaExpr ret;
   expr.foreach_key([&](const DeltaExpr::StorageT& term_old, int coeff) {
     DeltaExpr::StorageT term_new;
-    for (unsigned char ch : term_old) {
-      unsigned char ch_new = replacements.at(ch);
-      CHECK(ch_new != kNoReplacement);
+    for (const int ch : term_old) {
+      const int ch_new = replacement(ch);
       if (ch_new == kNil) {
         return;
       }
@@ -148,9 +140,8 @@ DeltaExpr substitute_variables(const DeltaExpr& expr, const XArgs& new_points_ar
     ret.add_to_key(term_new, coeff);
   });
   return ret;
-}
-#endif
 #endif
+}
 
 DeltaExpr involute(const DeltaExpr& expr, const std::vector<int>& points) {
   return expr.mapped_expanding([&](const std::vector<Delta>& term) {
@@ -223,42 +214,37 @@ DeltaExpr terms_without_variables(const DeltaExpr& expr, const std::vector<int>&
 }
 
 
-static bool between(int point, std::pair<int, int> segment) {
-  const auto [a, b] = segment;
-  CHECK_LT(a, b);
-  ASSERT(all_unique_unsorted(std::array{point, a, b}));
-  return a < point && point < b;
+// Nil deltas have no points, so that they are weakly separated from anything.
+static uint32_t delta_bitmask(const Delta& d) {
+  if (d.is_nil()) {
+    return 0;
+  }
+  const int x = d.a().as_simple_var();
+  const int y = d.b().as_simple_var();
+  CHECK_LT(std::max(x, y), 32);  // for `bitmasks_weakly_separated`
+  return (uint32_t(1) << x) | (uint32_t(1) << y);
 }
 
-// TODO: Test.
+// Deltas are weakly separated unless they have four distinct points and the segments intersect.
 bool are_weakly_separated(const Delta& d1, const Delta& d2) {
-  if (d1.is_nil() || d2.is_nil()) {
-    return true;
-  }
-  const int x1 = d1.a().as_simple_var();
-  const int y1 = d1.b().as_simple_var();
-  const int x2 = d2.a().as_simple_var();
-  const int y2 = d2.b().as_simple_var();
-  if (!all_unique_unsorted(std::array{x1, y1, x2, y2})) {
-    return true;
-  }
-  const bool itersect = between(x1, {x2, y2}) != between(y1, {x2, y2});
-  return !itersect;
+  return bitmasks_weakly_separated(delta_bitmask(d1), delta_bitmask(d2));
 }
 
-// Optimization potential: consider whether this can be done in O(N) time;
 bool is_weakly_separated(const DeltaExpr::ObjectT& term) {
-  for (int i : range(term.size())) {
-    for (int j : range(i)) {
-      if (!are_weakly_separated(term[i], term[j])) {
-        return false;
-      }
-    }
+  PVector<uint32_t, 16> masks;
+  for (const Delta& d : term) {
+    masks.push_back(delta_bitmask(d));
   }
-  return true;
+  return all_bitmasks_weakly_separated(masks);
 }
 bool is_weakly_separated(const DeltaNCoExpr::ObjectT& term) {
-  return is_weakly_separated(flatten(term));
+  PVector<uint32_t, 16> masks;
+  for (const auto& part : term) {
+    for (const Delta& d : part) {
+      masks.push_back(delta_bitmask(d));
+    }
+  }
+  return all_bitmasks_weakly_separated(masks);
 }
 
 bool is_totally_weakly_separated(const DeltaExpr& expr) {
@@ -1,7 +1,13 @@
 #pragma once
 
+#include <array>
+#include <mutex>
+
 #include "absl/container/flat_hash_map.h"
 
+#include "check.h"
+#include "range.h"
+
 
 template<typename T>
 class Enumerator {
@@ -24,3 +30,81 @@ public:
 private:
   absl::flat_hash_map<T, int> index_map_;
 };
+
+
+// Thread-safe counterpart of `Enumerator`. Keys are distributed between shards by hash and each
+// shard is guarded by its own mutex, so concurrent callers seldom contend.
+//
+// Indices returned by `index` are unique, but they are not dense and they depend on the order in
+// which threads reached each key. Once all keys have been added, use `dense_mapping` to convert
+// them into [0, size()). Dense indices are still order-dependent: callers that need a reproducible
+// numbering should sort the keys (see `ExprMatrixBuilder`).
+template<typename T>
+class ConcurrentEnumerator {
+public:
+  static constexpr int kShardBits = 6;
+  static constexpr int kNumShards = 1 << kShardBits;
+  static constexpr int kShardMask = kNumShards - 1;
+
+  class DenseMapping {
+  public:
+    int operator()(int index) const {
+      return offsets_[index & kShardMask] + (index >> kShardBits);
+    }
+  private:
+    friend class ConcurrentEnumerator;
+    std::array<int, kNumShards> offsets_;
+  };
+
+  int index(const T& key) {
+    const int shard_index = key_to_shard(key);
+    Shard& shard = shards_[shard_index];
+    std::lock_guard lock(shard.mutex);
+    const int local_index = shard.index_map.try_emplace(key, shard.index_map.size()).first->second;
+    CHECK_LT(local_index, 1 << (31 - kShardBits));
+    return (local_index << kShardBits) | shard_index;
+  }
+
+  // Not thread-safe with respect to `index`.
+  int size() const {
+    int ret = 0;
+    for (const auto& shard : shards_) {
+      ret += shard.index_map.size();
+    }
+    return ret;
+  }
+
+  // Calls `func(key, index)` for each key. Not thread-safe with respect to `index`.
+  template<typename F>
+  void foreach_key(const F& func) const {
+    for (const int shard_index : range(kNumShards)) {
+      for (const auto& [key, local_index] : shards_[shard_index].index_map) {
+        func(key, (local_index << kShardBits) | shard_index);
+      }
+    }
+  }
+
+  // Not thread-safe with respect to `index`.
+  DenseMapping dense_mapping() const {
+    DenseMapping mapping;
+    int offset = 0;
+    for (const int i : range(kNumShards)) {
+      mapping.offsets_[i] = offset;
+      offset += shards_[i].index_map.size();
+    }
+    return mapping;
+  }
+
+private:
+  struct Shard {
+    std::mutex mutex;
+    absl::flat_hash_map<T, int> index_map;
+  };
+
+  static int key_to_shard(const T& key) {
+    // Use high bits: low bits are used by the hash map itself to tell apart keys within a group.
+    return absl::Hash<T>{}(key) >> (sizeof(size_t) * 8 - kShardBits);
+  }
+
+  std::array<Shard, kNumShards> shards_;
+};
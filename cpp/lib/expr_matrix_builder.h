@@ -1,16 +1,109 @@
 #pragma once
 
+#include <array>
+#include <mutex>
+#include <numeric>
+
 #include "absl/container/flat_hash_set.h"
+#include "absl/types/span.h"
 
+#include "cancellation.h"
 #include "compact_variant.h"
 #include "enumerator.h"
+#include "fingerprint.h"
 #include "linalg.h"
+#include "profiler.h"
 #include "util.h"
 
 
+enum class MatrixDedupe {
+  exact,
+  // Rows (and columns) that differ only by a scalar factor are considered equal, e.g. `a + 2b`
+  // and `-3a - 6b`. This preserves matrix rank, but the matrix itself changes.
+  up_to_scale,
+};
+
+// Stores unique sparse vectors contiguously in a single arena. Each vector is identified by
+// a 128-bit fingerprint; full contents are compared only when fingerprints match.
+class UniqueSparseVectors {
+public:
+  using Element = std::pair<int, int>;  // (index, value)
+
+  UniqueSparseVectors() : index_(0, Hash{this}, Eq{this}) {}
+  UniqueSparseVectors(const UniqueSparseVectors&) = delete;
+  UniqueSparseVectors& operator=(const UniqueSparseVectors&) = delete;
+
+  // Returns true if the vector was new.
+  bool insert(absl::Span<const Element> elements) {
+    return insert(elements, fingerprint(elements));
+  }
+  bool insert(absl::Span<const Element> elements, const Fingerprint128& elements_fingerprint) {
+    records_.push_back({arena_.size(), static_cast<int>(elements.size()), elements_fingerprint});
+    arena_.insert(arena_.end(), elements.begin(), elements.end());
+    if (index_.insert(records_.size() - 1).second) {
+      return true;
+    }
+    arena_.resize(records_.back().offset);
+    records_.pop_back();
+    return false;
+  }
+
+  int size() const { return records_.size(); }
+  absl::Span<const Element> operator[](int idx) const {
+    const Record& record = records_[idx];
+    return absl::MakeConstSpan(arena_.data() + record.offset, record.size);
+  }
+
+private:
+  struct Record {
+    size_t offset = 0;
+    int size = 0;
+    Fingerprint128 fingerprint;
+  };
+  struct Hash {
+    const UniqueSparseVectors* self;
+    size_t operator()(int idx) const { return self->records_[idx].fingerprint.lo; }
+  };
+  struct Eq {
+    const UniqueSparseVectors* self;
+    bool operator()(int a, int b) const {
+      return self->records_[a].fingerprint == self->records_[b].fingerprint && (*self)[a] == (*self)[b];
+    }
+  };
+
+  std::vector<Element> arena_;
+  std::vector<Record> records_;
+  absl::flat_hash_set<int, Hash, Eq> index_;
+};
+
+namespace internal {
+template<typename... ExprTs>
+using MatrixKeyT = CompactVariant<typename ExprTs::ObjectT...>;
+
+// Appends (column, value) for each term of each expression to `row`.
+template<std::size_t Idx, typename KeyT, typename ElementT>
+void add_sparse_columns(ConcurrentEnumerator<KeyT>&, std::vector<ElementT>&) {}
+template<std::size_t Idx, typename KeyT, typename ElementT, typename Head, typename... Tail>
+void add_sparse_columns(
+  ConcurrentEnumerator<KeyT>& monoms, std::vector<ElementT>& row, const Head& head, const Tail&... tail
+) {
+  for (const auto& [term, coeff] : head) {
+    row.push_back({monoms.index(KeyT{std::in_place_index<Idx>, term}), coeff});
+  }
+  add_sparse_columns<Idx + 1>(monoms, row, tail...);
+}
+}  // namespace internal
+
+// Builds a matrix with a row for each added expression (or tuple of expressions) and a column for
+// each monom. Duplicate rows and columns are removed. Rows and columns are numbered canonically,
+// so the resulting matrix does not depend on the order in which expressions were added.
+//
+// `add_expr` is thread-safe. `make_matrix` must not be called concurrently with `add_expr`.
 template<typename... ExprTs>
 class ExprMatrixBuilder {
 public:
+  explicit ExprMatrixBuilder(MatrixDedupe dedupe = MatrixDedupe::exact) : dedupe_(dedupe) {}
+
   void add_expr(const std::tuple<ExprTs...>& expressions) {
     return std::apply(
       [this](const auto&... args) { return add_expr_impl(args...); },
@@ -22,61 +115,234 @@ public:
   }
 
   Matrix make_matrix() const {
-    const auto sparse_columns = unique_sparse_columns();
-    Matrix matrix;
-    int i_col = 0;
-    for (const auto& column : sparse_columns) {
-      for (const auto& [i_row, value] : column) {
-        matrix.insert(i_row, i_col) = value;
+    PROFILE_SCOPE("make_matrix");
+    return make_matrix_impl(canonical_layout(), nullptr);
+  }
+
+  // Like `make_matrix`, but splits the matrix into independent blocks, such that the rank of
+  // the matrix is the sum of block ranks.
+  //
+  // `grading` maps each monom to a hashable value, e.g. letter content. The decomposition is done
+  // on grades rather than on individual matrix elements: two grades end up in the same block iff
+  // they are connected via rows that mix them. Hence a coarse grading (or a hash collision between
+  // grades) merges blocks, which only affects performance, not correctness. Blocks are not
+  // necessarily minimal: use `get_matrix_diagonal_blocks` if this is important.
+  template<typename GradingF>
+  std::vector<Matrix> make_matrix_blocks(const GradingF& grading) const {
+    PROFILE_SCOPE("make_matrix_blocks");
+    const CanonicalLayout layout = canonical_layout();
+    const auto col_mapping = monoms_.dense_mapping();
+    std::vector<int> col_grades(monoms_.size());
+    Enumerator<size_t> grades;
+    monoms_.foreach_key([&](const KeyT& key, int i_col) {
+      const size_t grade_hash = compact_visit([&](const auto& monom) {
+        const auto grade = std::pair{key.index(), grading(monom)};
+        return absl::Hash<decltype(grade)>{}(grade);
+      }, key);
+      col_grades[layout.col_index[col_mapping(i_col)]] = grades.index(grade_hash);
+    });
+
+    std::vector<int> grade_parents(grades.size());
+    absl::c_iota(grade_parents, 0);
+    for (const int i_row : range(layout.num_rows())) {
+      const auto row = layout.row(i_row);
+      for (const auto& [i_col, coeff] : row) {
+        unite_sets(grade_parents, col_grades[row.front().first], col_grades[i_col]);
       }
-      ++i_col;
     }
-    return matrix;
+
+    std::vector<int> unique_col_sources;
+    const Matrix matrix = make_matrix_impl(layout, &unique_col_sources);
+    Enumerator<int> block_indices;
+    std::vector<Matrix> blocks;
+    for (const auto& t : matrix.as_triplets()) {
+      const int grade = col_grades[unique_col_sources[t.col]];
+      const int i_block = block_indices.index(find_set_root(grade_parents, grade));
+      if (i_block >= blocks.size()) {
+        blocks.resize(i_block + 1);
+      }
+      blocks[i_block].insert(t.row, t.col) = t.value;
+    }
+    return mapped(blocks, [](const Matrix& block) { return compress_matrix(block); });
   }
 
 private:
-  using SparseElement = std::pair<int, int>;  // (row/col, value)
-  using KeyT = CompactVariant<typename ExprTs::ObjectT...>;
+  using SparseElement = UniqueSparseVectors::Element;  // (row/col, value)
+  using KeyT = internal::MatrixKeyT<ExprTs...>;
 
-  void add_expr_impl(const ExprTs&... expressions) {
-    std::vector<SparseElement> row;
-    add_columns<0>(row, expressions...);
-    // TODO: Is sorting required? (col, value) pairs should be sorted in order for row
-    //   deduplication to work. However chances are they are already oredered the same
-    //   way: absl::hash_map iteration is likely deterministic within one launch.
-    absl::c_sort(row);
-    sparse_rows_.insert(row);
-  }
+  // Rows in canonical order with elements in canonical column indices. Columns are ordered by
+  // key and rows are ordered lexicographically, so the layout depends only on the set of added
+  // expressions, not on the order in which threads added them.
+  struct CanonicalLayout {
+    std::vector<int> col_index;  // dense monom index -> canonical column
+    std::vector<SparseElement> row_arena;
+    std::vector<size_t> row_starts;
+    std::vector<int> row_order;
 
-  template<std::size_t Idx, typename Head, typename... Tail>
-  void add_columns(std::vector<SparseElement>& row, const Head& head, const Tail&... tail) {
-    for (const auto& [term, coeff] : head) {
-      row.push_back({monoms_.index(KeyT{std::in_place_index<Idx>, term}), coeff});
+    int num_rows() const { return row_order.size(); }
+    absl::Span<const SparseElement> row(int i_row) const {
+      const int src = row_order[i_row];
+      return absl::MakeConstSpan(row_arena.data() + row_starts[src], row_starts[src + 1] - row_starts[src]);
     }
-    add_columns<Idx + 1>(row, tail...);
+  };
+
+  static int find_set_root(std::vector<int>& parents, int x) {
+    while (parents[x] != x) {
+      parents[x] = parents[parents[x]];
+      x = parents[x];
+    }
+    return x;
+  }
+  static void unite_sets(std::vector<int>& parents, int a, int b) {
+    parents[find_set_root(parents, a)] = find_set_root(parents, b);
   }
-  template<std::size_t Idx>
-  void add_columns(std::vector<SparseElement>&) {}
 
-  absl::flat_hash_set<std::vector<SparseElement>> unique_sparse_columns() const {
+  CanonicalLayout canonical_layout() const {
+    CanonicalLayout layout;
     const int num_cols = monoms_.size();
-    std::vector<std::vector<SparseElement>> sparse_columns(num_cols);
-    int i_row = 0;
-    for (const auto& row : sparse_rows_) {
-      for (const auto& [i_col, coeff] : row) {
-        sparse_columns[i_col].push_back({i_row, coeff});
+    const auto col_mapping = monoms_.dense_mapping();
+    std::vector<std::pair<const KeyT*, int>> keys;
+    keys.reserve(num_cols);
+    monoms_.foreach_key([&](const KeyT& key, int i_col) {
+      keys.push_back({&key, col_mapping(i_col)});
+    });
+    absl::c_sort(keys, [](const auto& a, const auto& b) { return *a.first < *b.first; });
+    layout.col_index.resize(num_cols);
+    for (const int i : range(num_cols)) {
+      layout.col_index[keys[i].second] = i;
+    }
+
+    layout.row_starts.push_back(0);
+    for (const auto& shard : sparse_rows_) {
+      for (const int i_row : range(shard.rows.size())) {
+        const size_t start = layout.row_arena.size();
+        for (const auto& [i_col, coeff] : shard.rows[i_row]) {
+          layout.row_arena.push_back({layout.col_index[col_mapping(i_col)], coeff});
+        }
+        const auto row = absl::MakeSpan(layout.row_arena.data() + start, layout.row_arena.size() - start);
+        absl::c_sort(row);
+        if (dedupe_ == MatrixDedupe::up_to_scale) {
+          // The sign was fixed by the first provisional column; fix it by the first canonical one.
+          normalize_scale(row);
+        }
+        layout.row_starts.push_back(layout.row_arena.size());
+      }
+    }
+    layout.row_order.resize(layout.row_starts.size() - 1);
+    absl::c_iota(layout.row_order, 0);
+    const auto row_span = [&](int src) {
+      return absl::MakeConstSpan(
+        layout.row_arena.data() + layout.row_starts[src],
+        layout.row_starts[src + 1] - layout.row_starts[src]
+      );
+    };
+    absl::c_sort(layout.row_order, [&](int a, int b) {
+      const auto row_a = row_span(a);
+      const auto row_b = row_span(b);
+      return std::lexicographical_compare(row_a.begin(), row_a.end(), row_b.begin(), row_b.end());
+    });
+    return layout;
+  }
+
+  // If `unique_col_sources` is not null, stores the canonical monom index for each matrix column.
+  Matrix make_matrix_impl(const CanonicalLayout& layout, std::vector<int>* unique_col_sources) const {
+    // Transpose rows into a single compressed column arena.
+    const int num_cols = layout.col_index.size();
+    const int num_rows = layout.num_rows();
+    std::vector<size_t> col_starts(num_cols + 1, 0);
+    for (const auto& [i_col, coeff] : layout.row_arena) {
+      ++col_starts[i_col + 1];
+    }
+    std::partial_sum(col_starts.begin(), col_starts.end(), col_starts.begin());
+    std::vector<SparseElement> col_arena(col_starts.back());
+    std::vector<size_t> col_ends(col_starts.begin(), col_starts.end() - 1);
+    for (const int i_row : range(num_rows)) {
+      for (const auto& [i_col, coeff] : layout.row(i_row)) {
+        col_arena[col_ends[i_col]++] = {i_row, coeff};
       }
-      ++i_row;
     }
     // Note: Elements are sorted within each column since we iterate rows sequentially.
     //   Hence decuplication works.
-    return to_set(sparse_columns);
+    const auto column = [&](int i_col) {
+      return absl::MakeSpan(col_arena.data() + col_starts[i_col], col_starts[i_col + 1] - col_starts[i_col]);
+    };
+    if (dedupe_ == MatrixDedupe::up_to_scale) {
+      for (const int i_col : range(num_cols)) {
+        normalize_scale(column(i_col));
+      }
+    }
+    const auto col_fingerprints = mapped(range(num_cols), [&](int i_col) {
+      return fingerprint(column(i_col));
+    });
+    const auto col_hash = [&](int a) -> size_t { return col_fingerprints[a].lo; };
+    const auto col_eq = [&](int a, int b) {
+      return col_fingerprints[a] == col_fingerprints[b]
+        && absl::Span<const SparseElement>(column(a)) == absl::Span<const SparseElement>(column(b));
+    };
+    absl::flat_hash_set<int, decltype(col_hash), decltype(col_eq)> unique_cols(num_cols, col_hash, col_eq);
+
+    Matrix matrix;
+    int i_unique_col = 0;
+    for (const int i_col : range(num_cols)) {
+      check_cancellation_periodically();
+      if (unique_cols.insert(i_col).second) {
+        for (const auto& [i_row, value] : column(i_col)) {
+          matrix.insert(i_row, i_unique_col) = value;
+        }
+        if (unique_col_sources) {
+          unique_col_sources->push_back(i_col);
+        }
+        ++i_unique_col;
+      }
+    }
+    return matrix;
+  }
+
+  // Divides by GCD and makes the first element positive.
+  static void normalize_scale(absl::Span<SparseElement> elements) {
+    if (elements.empty()) {
+      return;
+    }
+    int divisor = 0;
+    for (const auto& [idx, value] : elements) {
+      divisor = std::gcd(divisor, value);
+    }
+    if (elements.front().second < 0) {
+      divisor = -divisor;
+    }
+    for (auto& [idx, value] : elements) {
+      value /= divisor;
+    }
+  }
+
+  void add_expr_impl(const ExprTs&... expressions) {
+    std::vector<SparseElement> row;
+    internal::add_sparse_columns<0>(monoms_, row, expressions...);
+    // TODO: Is sorting required? (col, value) pairs should be sorted in order for row
+    //   deduplication to work. However chances are they are already oredered the same
+    //   way: absl::hash_map iteration is likely deterministic within one launch.
+    absl::c_sort(row);
+    if (dedupe_ == MatrixDedupe::up_to_scale) {
+      normalize_scale(absl::MakeSpan(row));
+    }
+    const Fingerprint128 row_fingerprint = fingerprint(row);
+    RowShard& shard = sparse_rows_[row_fingerprint.hi >> (64 - kRowShardBits)];
+    std::lock_guard lock(shard.mutex);
+    shard.rows.insert(row, row_fingerprint);
   }
 
-  Enumerator<KeyT> monoms_;
+  struct RowShard {
+    std::mutex mutex;
+    // For each row: for each non-zero value: (column, value)
+    UniqueSparseVectors rows;
+  };
+  static constexpr int kRowShardBits = 6;
 
-  // For each row: for each non-zero value: (column, value)
-  absl::flat_hash_set<std::vector<SparseElement>> sparse_rows_;
+  MatrixDedupe dedupe_ = MatrixDedupe::exact;
+  // Column indices in `sparse_rows_` are provisional: they are converted to dense indices
+  // in `make_matrix`.
+  ConcurrentEnumerator<KeyT> monoms_;
+  std::array<RowShard, 1 << kRowShardBits> sparse_rows_;
 };
 
 
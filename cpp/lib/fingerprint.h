@@ -0,0 +1,78 @@
+// 128-bit fingerprints for hashing large objects once and comparing them cheaply afterwards.
+// Two fingerprints being equal strongly suggests the objects are equal, but doesn't guarantee it:
+// callers that need exact results must verify.
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "absl/hash/hash.h"
+#include "absl/types/span.h"
+
+
+struct Fingerprint128 {
+  uint64_t lo = 0;
+  uint64_t hi = 0;
+
+  bool operator==(const Fingerprint128& other) const { return lo == other.lo && hi == other.hi; }
+  bool operator!=(const Fingerprint128& other) const { return !(*this == other); }
+
+  template <typename H>
+  friend H AbslHashValue(H h, const Fingerprint128& fingerprint) {
+    return H::combine(std::move(h), fingerprint.lo, fingerprint.hi);
+  }
+};
+
+// SplitMix64 finalizer.
+inline uint64_t fingerprint_mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// Order-dependent fingerprint of a sequence of 64-bit values. The two halves are computed
+// independently, so that a collision in one of them does not imply a collision in the other.
+class FingerprintBuilder {
+public:
+  FingerprintBuilder& add(uint64_t value) {
+    lo_ = fingerprint_mix(lo_ ^ value);
+    hi_ = fingerprint_mix(hi_ + value * 0x9e3779b97f4a7c15ULL);
+    ++size_;
+    return *this;
+  }
+  Fingerprint128 result() const {
+    return {fingerprint_mix(lo_ ^ size_), fingerprint_mix(hi_ + size_)};
+  }
+
+private:
+  uint64_t lo_ = 0x243f6a8885a308d3ULL;
+  uint64_t hi_ = 0x13198a2e03707344ULL;
+  uint64_t size_ = 0;
+};
+
+inline Fingerprint128 fingerprint(absl::Span<const std::pair<int, int>> elements) {
+  FingerprintBuilder builder;
+  for (const auto& [a, b] : elements) {
+    builder.add((static_cast<uint64_t>(static_cast<uint32_t>(a)) << 32) | static_cast<uint32_t>(b));
+  }
+  return builder.result();
+}
+
+// Stable across runs and platforms, so can be used for naming files.
+inline Fingerprint128 fingerprint(std::string_view str) {
+  FingerprintBuilder builder;
+  for (size_t pos = 0; pos < str.size(); pos += sizeof(uint64_t)) {
+    uint64_t chunk = 0;
+    for (size_t i = pos; i < std::min(pos + sizeof(uint64_t), str.size()); ++i) {
+      chunk = (chunk << 8) | static_cast<unsigned char>(str[i]);
+    }
+    builder.add(chunk);
+  }
+  return builder.result();
+}
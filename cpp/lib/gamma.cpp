@@ -1,5 +1,8 @@
 #include "gamma.h"
 
+#include <array>
+#include <optional>
+
 #include "set_util.h"
 
 
@@ -7,97 +10,138 @@ std::string to_string(const Gamma& g) {
   return fmt::parens(str_join(g.index_vector(), ","));
 }
 
-GammaExpr substitute_variables(const GammaExpr& expr, const std::vector<int>& new_points) {
-  // Optimization potential: do things on bitset level.
-  return expr.mapped_expanding([&](const GammaExpr::ObjectT& term_old) -> GammaExpr {
-    std::vector<Gamma> term_new;
-    for (const Gamma& g_old : term_old) {
-      Gamma g_new(mapped(g_old.index_vector(), [&](const int idx) {
-        return new_points.at(idx - 1);
-      }));
-      if (g_new.is_nil()) {
-        return {};
+static_assert(kMaxGammaVariables <= 16);  // for `GammaBitsetMap`
+
+// Maps each bit of a Gamma bitset to a set of bits. Applied via per-byte lookup tables, so that
+// mapping a Gamma takes two lookups regardless of its size.
+class GammaBitsetMap {
+public:
+  // Bit `i` is mapped to `bit_images[i]`. Bits not in `bit_images` must not be used.
+  explicit GammaBitsetMap(const std::vector<uint32_t>& bit_images) {
+    CHECK_LE(bit_images.size(), kMaxGammaVariables);
+    domain_ = (uint32_t(1) << bit_images.size()) - 1;
+    for (const int byte_idx : range(kNumBytes)) {
+      for (const int byte : range(256)) {
+        uint32_t image = 0;
+        for (const int bit : range(8)) {
+          const int src = byte_idx * 8 + bit;
+          if ((byte & (1 << bit)) && src < bit_images.size()) {
+            image |= bit_images[src];
+          }
+        }
+        tables_[byte_idx][byte] = image;
       }
-      term_new.push_back(g_new);
     }
-    return GammaExpr::single(term_new);
+  }
+
+  uint32_t domain() const { return domain_; }
+
+  uint32_t operator()(uint32_t bits) const {
+    return tables_[0][bits & 0xff] | tables_[1][(bits >> 8) & 0xff];
+  }
+
+private:
+  static constexpr int kNumBytes = 2;
+  uint32_t domain_ = 0;
+  std::array<std::array<uint32_t, 256>, kNumBytes> tables_;
+};
+
+static uint32_t gamma_bits(const Gamma& g) {
+  return g.index_bitset().to_ulong();
+}
+
+// Replaces each Gamma in each term by `func(gamma_bits(g))`, or drops the term if `func` returns
+// nullopt for any of them. Works directly on keys.
+template<typename F>
+static GammaExpr transform_gammas(const GammaExpr& expr, const F& func) {
+  GammaExpr::BasicLinearMain ret;
+  expr.foreach_key([&](const GammaExpr::StorageT& key, int coeff) {
+    GammaExpr::StorageT new_key = key;
+    for (Gamma& g : new_key) {
+      const std::optional<uint32_t> new_bits = func(gamma_bits(g));
+      if (!new_bits.has_value()) {
+        return;
+      }
+      g = Gamma(Gamma::BitsetT(*new_bits));
+    }
+    ret.add_to_key(new_key, coeff);
+  });
+  return GammaExpr(std::move(ret), expr.annotations());
+}
+
+GammaExpr substitute_variables(const GammaExpr& expr, const std::vector<int>& new_points) {
+  const GammaBitsetMap map(mapped(new_points, [](const int point) {
+    CHECK_LE(Gamma::kBitsetOffset, point);
+    CHECK_LT(point - Gamma::kBitsetOffset, kMaxGammaVariables);
+    return uint32_t(1) << (point - Gamma::kBitsetOffset);
+  }));
+  return transform_gammas(expr, [&](uint32_t bits) -> std::optional<uint32_t> {
+    CHECK((bits & ~map.domain()) == 0) << "Not enough points for substitution: " << new_points.size();
+    const uint32_t new_bits = map(bits);
+    // If points collide, the Gamma is nil.
+    if (new_bits == 0 || Gamma::BitsetT(new_bits).count() != Gamma::BitsetT(bits).count()) {
+      return std::nullopt;
+    }
+    return new_bits;
   }).without_annotations();
 }
 
 GammaExpr project_on(int axis, const GammaExpr& expr) {
-  return expr.mapped_expanding([&](const GammaExpr::ObjectT& term_old) -> GammaExpr {
-    std::vector<Gamma> term_new;
-    for (const Gamma& g : term_old) {
-      auto bitset = g.index_bitset();
-      if (!bitset.test(axis - Gamma::kBitsetOffset)) {
-        return {};
-      }
-      bitset.reset(axis - Gamma::kBitsetOffset);
-      term_new.push_back(Gamma(bitset));
+  const uint32_t axis_bit = uint32_t(1) << (axis - Gamma::kBitsetOffset);
+  return transform_gammas(expr, [&](uint32_t bits) -> std::optional<uint32_t> {
+    if (!(bits & axis_bit)) {
+      return std::nullopt;
     }
-    return GammaExpr::single(term_new);
+    return bits & ~axis_bit;
   });
 }
 
-// Checks that points in `g1` and `g2` are weakly separated, i.e. that there are no such
-// points {xa, ya} in (A = g1 \ g2) and points {xb, yb} in (B = g2 \ g1) that segment x1--y1
-// intersects segment x2--y2 if all drawn as vertices of a polygon.
-//
-// Algoritm. Go around the polygon. Ignore vertices that don't belong to either A or B.
-// Count the number of times that we "change color", e.g. see a point from A after we've
-// seen a point from B or vice versa. If A and B are non-intersecting, we'll see at most
-// 3 color changes, if not - at least 4.
-//
-// Optimization potential: O(1) algorithm via bit arithmetic: std::countl_zero, std::countr_zero, etc.
-bool are_weakly_separated(const Gamma& g1, const Gamma& g2) {
-  const auto a = bitset_difference(g1.index_bitset(), g2.index_bitset());
-  const auto b = bitset_difference(g2.index_bitset(), g1.index_bitset());
-  if (a.none() || b.none()) {
-    return true;
+template<typename TermT>
+static bool gammas_weakly_separated(const TermT& term) {
+  PVector<uint32_t, 16> masks;
+  for (const Gamma& g : term) {
+    masks.push_back(gamma_bits(g));
   }
-  int last_color = 0;  // a: 1,  b: 2
-  int num_color_changes = 0;
-  static_assert(a.size() == b.size());
-  for (const int p : range(a.size())) {
-    const int color = a[p] ? 1 : (b[p] ? 2 : 0);
-    if (color != 0) {
-      if (last_color != color) {
-        ++num_color_changes;
-        last_color = color;
-      }
+  return all_bitmasks_weakly_separated(masks);
+}
+
+template<typename CoTermT>
+static bool co_gammas_weakly_separated(const CoTermT& term) {
+  PVector<uint32_t, 16> masks;
+  for (const auto& part : term) {
+    for (const Gamma& g : part) {
+      masks.push_back(gamma_bits(g));
     }
   }
-  CHECK_LE(2, num_color_changes);
-  return num_color_changes <= 3;
+  return all_bitmasks_weakly_separated(masks);
+}
+
+// Checks that points in `g1` and `g2` are weakly separated, i.e. that there are no such
+// points {xa, ya} in (A = g1 \ g2) and points {xb, yb} in (B = g2 \ g1) that segment x1--y1
+// intersects segment x2--y2 if all drawn as vertices of a polygon. See `bitmasks_weakly_separated`.
+bool are_weakly_separated(const Gamma& g1, const Gamma& g2) {
+  return bitmasks_weakly_separated(gamma_bits(g1), gamma_bits(g2));
 }
 
-// Optimization potential: consider whether this can be done in O(N) time;
 bool is_weakly_separated(const GammaExpr::ObjectT& term) {
-  for (int i : range(term.size())) {
-    for (int j : range(i)) {
-      if (!are_weakly_separated(term[i], term[j])) {
-        return false;
-      }
-    }
-  }
-  return true;
+  return gammas_weakly_separated(term);
 }
 bool is_weakly_separated(const GammaNCoExpr::ObjectT& term) {
-  return is_weakly_separated(flatten(term));
+  return co_gammas_weakly_separated(term);
 }
 
 bool is_totally_weakly_separated(const GammaExpr& expr) {
-  return !expr.contains([](const auto& term) { return !is_weakly_separated(term); });
+  return !expr.contains_key([](const auto& term) { return !gammas_weakly_separated(term); });
 }
 bool is_totally_weakly_separated(const GammaNCoExpr& expr) {
-  return !expr.contains([](const auto& term) { return !is_weakly_separated(term); });
+  return !expr.contains_key([](const auto& term) { return !co_gammas_weakly_separated(term); });
 }
 
 GammaExpr keep_non_weakly_separated(const GammaExpr& expr) {
-  return expr.filtered([](const auto& term) { return !is_weakly_separated(term); });
+  return expr.filtered_key([](const auto& term) { return !gammas_weakly_separated(term); });
 }
 GammaNCoExpr keep_non_weakly_separated(const GammaNCoExpr& expr) {
-  return expr.filtered([](const auto& term) { return !is_weakly_separated(term); });
+  return expr.filtered_key([](const auto& term) { return !co_gammas_weakly_separated(term); });
 }
 
 bool passes_normalize_remove_consecutive(const GammaExpr::ObjectT& term, int dimension, int num_points) {
@@ -165,16 +209,12 @@ GammaExpr pullback(const GammaExpr& expr, const std::vector<int>& bonus_points)
   if (!bonus_bitset_or.has_value()) {
     return GammaExpr{};
   }
-  const auto& bonus_bitset = bonus_bitset_or.value();
-  return expr.mapped_expanding([&](const auto& term) {
-    bool is_zero = false;
-    const auto new_term = mapped(term, [&](const Gamma& g) {
-      if ((g.index_bitset() & bonus_bitset).any()) {
-        is_zero = true;
-      }
-      return Gamma(g.index_bitset() | bonus_bitset);
-    });
-    return is_zero ? GammaExpr{} : GammaExpr::single(new_term);
+  const uint32_t bonus_bits = bonus_bitset_or.value().to_ulong();
+  return transform_gammas(expr, [&](uint32_t bits) -> std::optional<uint32_t> {
+    if (bits & bonus_bits) {
+      return std::nullopt;
+    }
+    return bits | bonus_bits;
   }).annotations_map([&](const std::string& annotation) {
     // TODO: Find a proper pullback notation
     return fmt::function(
@@ -194,12 +234,10 @@ GammaExpr plucker_dual(const GammaExpr& expr, const std::vector<int>& point_univ
   if (!universe_bitset_or.has_value()) {
     return GammaExpr{};
   }
-  const auto& universe_bitset = universe_bitset_or.value();
-  return expr.mapped([&](const auto& term) {
-    return mapped(term, [&](const Gamma& g) {
-      CHECK(bitset_contains(universe_bitset, g.index_bitset()));
-      return Gamma(bitset_difference(universe_bitset, g.index_bitset()));
-    });
+  const uint32_t universe_bits = universe_bitset_or.value().to_ulong();
+  return transform_gammas(expr, [&](uint32_t bits) -> std::optional<uint32_t> {
+    CHECK((bits & ~universe_bits) == 0);
+    return universe_bits & ~bits;
   }).annotations_map([](const std::string& annotation) {
     return fmt::set_complement() + annotation;
   });
@@ -1,6 +1,5 @@
 // TODO: Install LinBox through bazel
 // TODO: Add tests, in particular: matrix_rank == matrix_rank_raw_linbox
-// TODO: Add benchmarks, in particular: matrix_rank vs matrix_rank_raw_linbox
 
 #include "linalg.h"
 
@@ -12,10 +11,13 @@
 #include <linbox/matrix/sparse-matrix.h>
 #include <linbox/solutions/rank.h>
 
+#include "cancellation.h"
 #include "check.h"
 #include "compare.h"
 #include "enumerator.h"
 #include "format.h"
+#include "profiler.h"
+#include "progress.h"
 #include "sorting.h"
 #include "string.h"
 #include "table_printer.h"
@@ -93,30 +95,44 @@ std::vector<Matrix> get_matrix_diagonal_blocks(const Matrix& matrix) {
 
 int matrix_rank_raw_linbox(const Matrix& matrix) {
   const auto& triplets = matrix.as_triplets();
-  if (triplets.empty()) {
-    // Extend rank definition to empty matrices.
-    return 0;
-  } else if (triplets.size() == 1) {
+  if (triplets.size() == 1) {
     // Speed up block rank computation.
     return triplets.front().value == 0 ? 0 : 1;
   }
   // Optimization potential: Faster implementation for other small matrices (to speed up block rank).
 
-  // LinBox::commentator().setMaxDetailLevel(-1);
-  // LinBox::commentator().setMaxDepth(-1);
-  // LinBox::commentator().setReportStream(std::cerr);
-  Givaro::QField<Givaro::Rational> QQ;
-  LinBox::SparseMatrix<Givaro::QField<Givaro::Rational>, LinBox::SparseMatrixFormat::SparseSeq> linbox_matrix(
-    QQ, matrix.rows(), matrix.cols()
-  );
   // Sort triplets first. The order of calls to `setEntry` plays a huge role: `LinBox::rank`
   // can be five times slower in case of random order compared to sorted.
   const auto sorted_triplets = sorted(
     triplets,
     cmp::projected([](const auto& t) { return std::pair{t.row, t.col}; })
   );
-  for (const auto& t : sorted_triplets) {
-    linbox_matrix.setEntry(t.row, t.col, t.value);
+  return matrix_rank_raw_linbox(matrix.rows(), matrix.cols(), [&](const auto& set_entry) {
+    for (const auto& t : sorted_triplets) {
+      set_entry(t.row, t.col, t.value);
+    }
+  });
+}
+
+int matrix_rank_raw_linbox(int rows, int cols, const MatrixEntriesSource& entries) {
+  if (rows == 0 || cols == 0) {
+    // Extend rank definition to empty matrices.
+    return 0;
+  }
+  // LinBox::commentator().setMaxDetailLevel(-1);
+  // LinBox::commentator().setMaxDepth(-1);
+  // LinBox::commentator().setReportStream(std::cerr);
+  Givaro::QField<Givaro::Rational> QQ;
+  LinBox::SparseMatrix<Givaro::QField<Givaro::Rational>, LinBox::SparseMatrixFormat::SparseSeq> linbox_matrix(
+    QQ, rows, cols
+  );
+  int num_entries = 0;
+  entries([&](int row, int col, int value) {
+    linbox_matrix.setEntry(row, col, value);
+    ++num_entries;
+  });
+  if (num_entries == 0) {
+    return 0;
   }
 
   size_t rank;
@@ -267,15 +283,23 @@ Matrix diagonalize_matrix(const Matrix& src) {
   return *mat;
 }
 
+// Progress is reported in columns of the blocks processed so far.
 static int matrix_rank_fancy(const Matrix& matrix) {
+  ProgressTracker progress("matrix_rank", matrix.cols());
   return sum(mapped(
     get_matrix_diagonal_blocks(matrix),
-    [](const auto& b) { return matrix_rank_raw_linbox(diagonalize_matrix(b)); }
+    [&](const auto& b) {
+      check_cancellation();
+      const int rank = matrix_rank_raw_linbox(diagonalize_matrix(b));
+      progress.advance(b.cols());
+      return rank;
+    }
   ));
 }
 
 #if 1
 int matrix_rank(const Matrix& matrix) {
+  PROFILE_SCOPE("matrix_rank");
   return matrix_rank_fancy(matrix);
 }
 #else
@@ -290,6 +314,14 @@ int matrix_rank(const Matrix& matrix) {
 }
 #endif
 
+int matrix_blocks_rank(const std::vector<Matrix>& blocks) {
+  PROFILE_SCOPE("matrix_rank");
+  return sum(mapped(blocks, [](const Matrix& block) {
+    check_cancellation();
+    return matrix_rank_raw_linbox(block);
+  }));
+}
+
 void save_triplets(const std::string& filename, const Matrix& matrix) {
   std::ofstream fs(filename);
   CHECK(fs.good());
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -81,6 +82,14 @@ Matrix compress_matrix(const Matrix& matrix);
 // Computes matrix rank without preconditioning.
 int matrix_rank_raw_linbox(const Matrix& matrix);
 
+// Calls `set_entry(row, col, value)` for each matrix element. Elements should come sorted by
+// (row, col): LinBox is much slower on elements in random order.
+using MatrixEntriesSource = std::function<void(const std::function<void(int, int, int)>& set_entry)>;
+
+// Like above, but reads elements from `entries`. Allows to compute the rank of a matrix that is
+// not stored as `Matrix`, e.g. a memory-mapped matrix file.
+int matrix_rank_raw_linbox(int rows, int cols, const MatrixEntriesSource& entries);
+
 // Computes matrix rank.
 //
 // May use preconditioning, e.g.: split the matrix into diagonal blocks, reorder rows and
@@ -90,5 +99,11 @@ int matrix_rank_raw_linbox(const Matrix& matrix);
 //
 int matrix_rank(const Matrix& matrix);
 
+// Computes the rank of a block diagonal matrix given as a list of blocks, e.g. from
+// `ExprMatrixBuilder::make_matrix_blocks`. Each block is passed to `matrix_rank_raw_linbox`
+// directly: it is already a block, so splitting it again would be wasted work. Blocks are ranked
+// one by one, since LinBox is not known to be thread-safe.
+int matrix_blocks_rank(const std::vector<Matrix>& blocks);
+
 void save_triplets(const std::string& filename, const Matrix& matrix);
 Matrix load_triplets(const std::string& filename);
@@ -87,6 +87,8 @@
 
 #include "compare.h"
 #include "format.h"
+#include "linear_stats.h"
+#include "serialization.h"
 #include "util.h"
 
 
@@ -199,7 +201,7 @@ public:
   class const_iterator {
   public:
     explicit const_iterator(const_key_iterator it) : it_(std::move(it)) {}
-    std::pair<ObjectT, int> operator*() const { return {ParamT::key_to_object(it_->first), it_->second}; }
+    std::pair<ObjectT, int> operator*() const { return {key_to_object(it_->first), it_->second}; }
     const_iterator& operator++() { ++it_; return *this; };
     bool operator==(const const_iterator& other) const { return it_ == other.it_; }
     bool operator!=(const const_iterator& other) const { return !(*this == other); }
@@ -213,7 +215,7 @@ public:
       auto next = it;
       ++next;
       if (it->second == 0) {
-        data_.erase(it);
+        erase_key(it);
       }
       it = next;
     }
@@ -221,11 +223,11 @@ public:
   ~BasicLinear() {}
 
   static BasicLinear single(const ObjectT& obj) {
-    return single_key(ParamT::object_to_key(obj));
+    return single_key(object_to_key(obj));
   }
   static BasicLinear single_key(const StorageT& key) {
     BasicLinear ret;
-    ret.data_[key] = 1;
+    ret.find_or_insert_key(key) = 1;
     return ret;
   }
 
@@ -252,7 +254,7 @@ public:
   const_iterator end() const { return const_iterator(end_key()); }
 
   int operator[](const ObjectT& obj) const {
-    return coeff_for_key(ParamT::object_to_key(obj));
+    return coeff_for_key(object_to_key(obj));
   }
   int coeff_for_key(const StorageT& key) const {
     const auto it = data_.find(key);
@@ -265,37 +267,37 @@ public:
   const ContainerT& data() const { return data_; }
 
   void add_to(const ObjectT& obj, int x) {
-    add_to_key(ParamT::object_to_key(obj), x);
+    add_to_key(object_to_key(obj), x);
   }
   void add_to_key(const StorageT& key, int x) {
     // Equivalent to `set_coeff_for_key(key, coeff_for_key(key) + x);` but faster.
-    int& value = data_[key];
+    int& value = find_or_insert_key(key);
     value += x;
     if (value == 0) {
-      data_.erase(key);
+      erase_key(key);
     }
   }
   std::pair<ObjectT, int> element() const {
     auto key_coeff = element_key();
-    return {ParamT::key_to_object(key_coeff.first), key_coeff.second};
+    return {key_to_object(key_coeff.first), key_coeff.second};
   }
   std::pair<StorageT, int> element_key() const {
     return *data_.begin();
   }
   std::pair<ObjectT, int> pop() {
     auto key_coeff = pop_key();
-    return {ParamT::key_to_object(key_coeff.first), key_coeff.second};
+    return {key_to_object(key_coeff.first), key_coeff.second};
   }
   std::pair<StorageT, int> pop_key() {
     auto ret = std::move(*data_.begin());
-    data_.erase(data_.begin());
+    erase_key(data_.begin());
     return ret;
   }
 
   template<typename F>
   void foreach(F func) const {
     foreach_key([&func](const auto& key, int coeff) {
-      func(ParamT::key_to_object(key), coeff);
+      func(key_to_object(key), coeff);
     });
   }
   template<typename F>
@@ -318,7 +320,7 @@ public:
   template<typename F>
   bool contains_key(F func) const {
     for (auto it = begin_key(); it != end_key(); ++it) {
-      if (func(it->second)) {
+      if (func(it->first)) {
         return true;
       }
     }
@@ -361,7 +363,7 @@ public:
   BasicLinear filtered(F func) const {
     BasicLinear ret;
     foreach_key([&](const auto& key, int coeff) {
-      if (func(ParamT::key_to_object(key))) {
+      if (func(key_to_object(key))) {
         ret.add_to_key(key, coeff);
       }
     });
@@ -448,10 +450,59 @@ public:
 private:
   void set_coeff_for_key(const StorageT& key, int coeff) {
     if (coeff != 0) {
-      data_[key] = coeff;
+      find_or_insert_key(key) = coeff;
     } else {
-      data_.erase(key);
+      erase_key(key);
+    }
+  }
+
+  // Wrappers around container and param functions that count operations if LINEAR_STATS is enabled.
+  int& find_or_insert_key(const StorageT& key) {
+#if LINEAR_STATS
+    auto& stats = internal::thread_linear_stats<ParamT>();
+    const size_t old_size = data_.size();
+    const size_t old_capacity = container_capacity();
+    int& value = data_[key];
+    if (data_.size() != old_size) {
+      internal::increment_linear_stat(stats.num_inserts);
+    }
+    if (container_capacity() != old_capacity) {
+      internal::increment_linear_stat(stats.num_rehashes);
     }
+    return value;
+#else
+    return data_[key];
+#endif
+  }
+  template<typename KeyOrIteratorT>
+  void erase_key(const KeyOrIteratorT& key_or_iterator) {
+#if LINEAR_STATS
+    internal::increment_linear_stat(internal::thread_linear_stats<ParamT>().num_erases);
+#endif
+    data_.erase(key_or_iterator);
+  }
+#if LINEAR_STATS
+  size_t container_capacity() const {
+#  if DISABLE_PACKING
+    return data_.bucket_count();
+#  else
+    return data_.capacity();
+#  endif
+  }
+#endif
+  template<typename KeyT>
+  static decltype(auto) key_to_object(KeyT&& key) {
+#if LINEAR_STATS
+    internal::increment_linear_stat(internal::thread_linear_stats<ParamT>().num_key_to_object);
+#endif
+    return ParamT::key_to_object(std::forward<KeyT>(key));
+  }
+  template<typename ObjectArgT>
+  static decltype(auto) object_to_key(ObjectArgT&& obj) {
+#if LINEAR_STATS
+    internal::increment_linear_stat(internal::thread_linear_stats<ParamT>().num_object_to_key);
+#endif
+    return ParamT::object_to_key(std::forward<ObjectArgT>(obj));
   }
 
   ContainerT data_;
@@ -800,6 +851,50 @@ LinearKeyView<ParamT> key_view(const Linear<ParamT>& linear) {
 template<typename ParamT>
 LinearKeyView<ParamT> key_view(const Linear<ParamT>&& linear) = delete;
 
+
+// Binary serialization, see serialization.h. Terms are stored in key form. See also linear_file.h.
+template<typename ParamT>
+void serialize(BinaryWriter& writer, const BasicLinear<ParamT>& linear) {
+  writer.write_size(linear.num_terms());
+  linear.foreach_key([&](const auto& key, int coeff) {
+    serialize(writer, key);
+    writer.write_signed_varint(coeff);
+  });
+}
+template<typename ParamT>
+void deserialize(BinaryReader& reader, BasicLinear<ParamT>& linear) {
+  linear = {};
+  const size_t num_terms = reader.read_size();
+  for (EACH : range(num_terms)) {
+    typename ParamT::StorageT key;
+    deserialize(reader, key);
+    linear.add_to_key(key, reader.read_signed_varint());
+  }
+}
+
+inline void serialize(BinaryWriter& writer, const LinearAnnotation& annotations) {
+  serialize(writer, annotations.expression);
+  serialize(writer, annotations.errors);
+}
+inline void deserialize(BinaryReader& reader, LinearAnnotation& annotations) {
+  deserialize(reader, annotations.expression);
+  deserialize(reader, annotations.errors);
+}
+
+template<typename ParamT>
+void serialize(BinaryWriter& writer, const Linear<ParamT>& linear) {
+  serialize(writer, linear.main());
+  serialize(writer, linear.annotations());
+}
+template<typename ParamT>
+void deserialize(BinaryReader& reader, Linear<ParamT>& linear) {
+  typename Linear<ParamT>::BasicLinearMain main;
+  LinearAnnotation annotations;
+  deserialize(reader, main);
+  deserialize(reader, annotations);
+  linear = Linear<ParamT>(std::move(main), std::move(annotations));
+}
+
 template<typename ParamT, typename CompareF, typename ContextT>
 std::ostream& to_ostream(
     std::ostream& os,
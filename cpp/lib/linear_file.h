@@ -0,0 +1,287 @@
+// Binary format for linear expressions designed to be memory-mapped.
+//
+// Terms are stored in key form (see `StorageT` in linear.h) sorted by encoded key, so a file can be
+// used as a read-only expression without loading it: `FrozenLinear` decodes terms on access and
+// looks up coefficients via binary search. Use `to_linear` to get a regular mutable expression.
+//
+// Layout:
+//   LinearFileHeader
+//   type tag: identifies the expression type, see `linear_file_type_tag`
+//   terms: for each term, varint key size, key (see serialization.h), zigzag varint coefficient
+//   term starts: `num_terms + 1` uint64 offsets relative to `terms_offset`
+//   annotations (optional): `LinearAnnotation` (see serialization.h)
+//
+// Numbers are stored in native byte order, so files are not portable between architectures.
+// Loading a file as a different expression type is a fatal error.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <typeinfo>
+#include <vector>
+
+#include "absl/algorithm/container.h"
+#include "absl/strings/str_cat.h"
+
+#include "check.h"
+#include "linear.h"
+#include "mapped_file.h"
+#include "serialization.h"
+
+
+struct LinearFileHeader {
+  static constexpr char kMagic[8] = {'P', 'K', 'L', 'I', 'N', 'E', 'A', 'R'};
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8] = {};
+  uint32_t version = 0;
+  uint32_t type_tag_size = 0;
+  int64_t num_terms = 0;
+  uint64_t terms_offset = 0;
+  uint64_t term_starts_offset = 0;
+  uint64_t annotations_offset = 0;
+  uint64_t annotations_size = 0;  // zero if there are no annotations
+};
+
+// The tag includes both the param type and the key type. Alphabet mappings (e.g. for `Delta`) are
+// fixed at compile time, so the key type determines how the keys are decoded.
+// Note: uses mangled type names, which are stable across GCC and Clang but not MSVC.
+template<typename ParamT>
+std::string linear_file_type_tag() {
+  return absl::StrCat(typeid(ParamT).name(), "/", typeid(typename ParamT::StorageT).name());
+}
+
+// Returns the file contents. Can also be used to pass expressions between processes.
+template<typename ParamT>
+std::string linear_to_bytes(const Linear<ParamT>& expr) {
+  std::vector<std::pair<std::string, int>> terms;
+  terms.reserve(expr.num_terms());
+  expr.main().foreach_key([&](const auto& key, int coeff) {
+    std::string key_bytes;
+    BinaryWriter key_writer(key_bytes);
+    serialize(key_writer, key);
+    terms.emplace_back(std::move(key_bytes), coeff);
+  });
+  absl::c_sort(terms);
+
+  const std::string type_tag = linear_file_type_tag<ParamT>();
+  std::string terms_bytes;
+  std::vector<uint64_t> term_starts;
+  term_starts.reserve(terms.size() + 1);
+  BinaryWriter terms_writer(terms_bytes);
+  for (const auto& [key_bytes, coeff] : terms) {
+    term_starts.push_back(terms_bytes.size());
+    terms_writer.write_size(key_bytes.size());
+    terms_writer.write_bytes(key_bytes.data(), key_bytes.size());
+    terms_writer.write_signed_varint(coeff);
+  }
+  term_starts.push_back(terms_bytes.size());
+  std::string annotations_bytes;
+  if (!expr.annotations().expression.is_zero() || !expr.annotations().errors.empty()) {
+    BinaryWriter annotations_writer(annotations_bytes);
+    serialize(annotations_writer, expr.annotations());
+  }
+
+  LinearFileHeader header;
+  std::memcpy(header.magic, LinearFileHeader::kMagic, sizeof(header.magic));
+  header.version = LinearFileHeader::kVersion;
+  header.type_tag_size = type_tag.size();
+  header.num_terms = terms.size();
+  header.terms_offset = sizeof(header) + type_tag.size();
+  header.term_starts_offset = header.terms_offset + terms_bytes.size();
+  header.annotations_offset = header.term_starts_offset + term_starts.size() * sizeof(uint64_t);
+  header.annotations_size = annotations_bytes.size();
+
+  std::string ret;
+  ret.reserve(header.annotations_offset + header.annotations_size);
+  BinaryWriter writer(ret);
+  writer.write_pod(header);
+  writer.write_bytes(type_tag.data(), type_tag.size());
+  writer.write_bytes(terms_bytes.data(), terms_bytes.size());
+  writer.write_bytes(term_starts.data(), term_starts.size() * sizeof(uint64_t));
+  writer.write_bytes(annotations_bytes.data(), annotations_bytes.size());
+  return ret;
+}
+
+template<typename ParamT>
+void save_linear_file(const std::string& filename, const Linear<ParamT>& expr) {
+  const std::string bytes = linear_to_bytes(expr);
+  std::ofstream fs(filename, std::ios::binary | std::ios::trunc);
+  CHECK(fs.good()) << "Cannot open " << filename;
+  fs.write(bytes.data(), bytes.size());
+  fs.close();
+  CHECK(!fs.fail()) << "Cannot write " << filename;
+}
+
+
+// Read-only view of an expression in the binary format. Doesn't own the data.
+template<typename ParamT>
+class FrozenLinear {
+public:
+  using Param = ParamT;
+  using ObjectT = typename ParamT::ObjectT;
+  using StorageT = typename ParamT::StorageT;
+
+  FrozenLinear(const char* data, size_t size) : data_(data) {
+    CHECK_GE(size, sizeof(LinearFileHeader)) << "Not a linear expression file";
+    std::memcpy(&header_, data_, sizeof(header_));
+    CHECK(std::memcmp(header_.magic, LinearFileHeader::kMagic, sizeof(header_.magic)) == 0)
+      << "Not a linear expression file";
+    CHECK_EQ(header_.version, LinearFileHeader::kVersion) << "Unsupported linear expression file version";
+    CHECK_LE(header_.type_tag_size, size - sizeof(header_)) << "Corrupted linear expression file";
+    CHECK_EQ(
+      std::string(data_ + sizeof(header_), header_.type_tag_size),
+      linear_file_type_tag<ParamT>()
+    ) << "Linear expression file type mismatch";
+    // Offsets are validated here once, so that accessors can trust them.
+    CHECK_EQ(header_.terms_offset, sizeof(header_) + header_.type_tag_size) << "Corrupted linear expression file";
+    CHECK_LE(header_.terms_offset, header_.term_starts_offset) << "Corrupted linear expression file";
+    CHECK_LE(header_.term_starts_offset, size) << "Corrupted linear expression file";
+    CHECK(
+      0 <= header_.num_terms &&
+      static_cast<uint64_t>(header_.num_terms) < (size - header_.term_starts_offset) / sizeof(uint64_t)
+    ) << "Corrupted linear expression file";
+    CHECK_EQ(header_.annotations_offset, header_.term_starts_offset + (header_.num_terms + 1) * sizeof(uint64_t))
+      << "Corrupted linear expression file";
+    CHECK_EQ(header_.annotations_size, size - header_.annotations_offset) << "Corrupted linear expression file";
+    check_terms();
+  }
+
+  int num_terms() const { return header_.num_terms; }
+  bool is_zero() const { return num_terms() == 0; }
+
+  StorageT key(int idx) const {
+    BinaryReader reader = key_reader(idx);
+    StorageT ret;
+    deserialize(reader, ret);
+    CHECK(reader.at_end()) << "Corrupted linear expression file";
+    return ret;
+  }
+  ObjectT element(int idx) const { return ParamT::key_to_object(key(idx)); }
+  int coeff(int idx) const {
+    const std::string_view bytes = term_bytes(idx);
+    BinaryReader reader(bytes.data(), bytes.size());
+    reader.skip(reader.read_size());
+    return reader.read_signed_varint();
+  }
+
+  // Returns the coefficient of `key`, or zero if there is no such term. O(log(num_terms)).
+  int coeff_for_key(const StorageT& key) const {
+    std::string key_bytes;
+    BinaryWriter writer(key_bytes);
+    serialize(writer, key);
+    int lo = 0;
+    int hi = num_terms();
+    while (lo < hi) {
+      const int mid = lo + (hi - lo) / 2;
+      const int cmp = key_bytes_view(mid).compare(key_bytes);
+      if (cmp == 0) {
+        return coeff(mid);
+      } else if (cmp < 0) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return 0;
+  }
+  int operator[](const ObjectT& obj) const { return coeff_for_key(ParamT::object_to_key(obj)); }
+
+  template<typename F>
+  void foreach_key(F func) const {
+    for (const int idx : range(num_terms())) {
+      func(key(idx), coeff(idx));
+    }
+  }
+  template<typename F>
+  void foreach(F func) const {
+    for (const int idx : range(num_terms())) {
+      func(element(idx), coeff(idx));
+    }
+  }
+
+  LinearAnnotation annotations() const {
+    LinearAnnotation ret;
+    if (header_.annotations_size > 0) {
+      BinaryReader reader(data_ + header_.annotations_offset, header_.annotations_size);
+      deserialize(reader, ret);
+    }
+    return ret;
+  }
+
+  Linear<ParamT> to_linear() const {
+    typename Linear<ParamT>::BasicLinearMain main;
+    foreach_key([&](const StorageT& key, int coeff) {
+      main.add_to_key(key, coeff);
+    });
+    return Linear<ParamT>(std::move(main), annotations());
+  }
+
+private:
+  // Term starts must be non-decreasing and cover the terms section exactly, and each key must fit
+  // into its term. O(num_terms).
+  void check_terms() const {
+    CHECK_EQ(term_start(0), 0) << "Corrupted linear expression file";
+    CHECK_EQ(term_start(num_terms()), header_.term_starts_offset - header_.terms_offset)
+      << "Corrupted linear expression file";
+    for (const int idx : range(num_terms())) {
+      CHECK_LE(term_start(idx), term_start(idx + 1)) << "Corrupted linear expression file";
+      const std::string_view bytes = term_bytes(idx);
+      BinaryReader reader(bytes.data(), bytes.size());
+      reader.skip(reader.read_size());
+    }
+  }
+
+  uint64_t term_start(int idx) const {
+    uint64_t ret;
+    std::memcpy(&ret, data_ + header_.term_starts_offset + idx * sizeof(uint64_t), sizeof(ret));
+    return ret;
+  }
+  std::string_view term_bytes(int idx) const {
+    CHECK_LE(0, idx);
+    CHECK_LT(idx, num_terms());
+    const uint64_t begin = term_start(idx);
+    return std::string_view(data_ + header_.terms_offset + begin, term_start(idx + 1) - begin);
+  }
+  std::string_view key_bytes_view(int idx) const {
+    const std::string_view bytes = term_bytes(idx);
+    BinaryReader reader(bytes.data(), bytes.size());
+    const size_t key_size = reader.read_size();
+    return std::string_view(reader.position(), key_size);
+  }
+  BinaryReader key_reader(int idx) const {
+    const std::string_view key_bytes = key_bytes_view(idx);
+    return BinaryReader(key_bytes.data(), key_bytes.size());
+  }
+
+  const char* data_ = nullptr;
+  LinearFileHeader header_;
+};
+
+// Memory-mapped expression file, see `MappedFile`.
+template<typename ParamT>
+class MappedLinearFile {
+public:
+  explicit MappedLinearFile(const std::string& filename)
+    : file_(filename), expr_(file_.data(), file_.size()) {}
+
+  const FrozenLinear<ParamT>& expr() const { return expr_; }
+
+private:
+  MappedFile file_;
+  FrozenLinear<ParamT> expr_;
+};
+
+template<typename LinearT>
+LinearT linear_from_bytes(std::string_view bytes) {
+  return FrozenLinear<typename LinearT::Param>(bytes.data(), bytes.size()).to_linear();
+}
+
+template<typename LinearT>
+LinearT load_linear_file(const std::string& filename) {
+  return MappedLinearFile<typename LinearT::Param>(filename).expr().to_linear();
+}
@@ -0,0 +1,120 @@
+#include "linear_stats.h"
+
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#ifdef __GNUG__
+#  include <cxxabi.h>
+#endif
+
+#include "profiler.h"
+#include "string.h"
+#include "util.h"
+
+
+static std::mutex registry_mutex;
+using LinearStatsRegistry = std::vector<std::pair<std::type_index, std::unique_ptr<internal::ThreadLinearStats>>>;
+
+static LinearStatsRegistry& registry() {
+  // Never destroyed: thread-local pointers may outlive static destruction.
+  static auto* registry = new LinearStatsRegistry;
+  return *registry;
+}
+
+internal::ThreadLinearStats* internal::register_thread_linear_stats(std::type_index type) {
+  std::lock_guard lock(registry_mutex);
+  registry().push_back({type, std::make_unique<ThreadLinearStats>()});
+  return registry().back().second.get();
+}
+
+LinearStats linear_stats() {
+  std::lock_guard lock(registry_mutex);
+  LinearStats ret;
+  for (const auto& [type, thread_stats] : registry()) {
+    auto& value = ret.data[type];
+    value.num_inserts += thread_stats->num_inserts.load(std::memory_order_relaxed);
+    value.num_erases += thread_stats->num_erases.load(std::memory_order_relaxed);
+    value.num_rehashes += thread_stats->num_rehashes.load(std::memory_order_relaxed);
+    value.num_key_to_object += thread_stats->num_key_to_object.load(std::memory_order_relaxed);
+    value.num_object_to_key += thread_stats->num_object_to_key.load(std::memory_order_relaxed);
+  }
+  return ret;
+}
+
+void reset_linear_stats() {
+  std::lock_guard lock(registry_mutex);
+  for (const auto& [type, thread_stats] : registry()) {
+    thread_stats->num_inserts = 0;
+    thread_stats->num_erases = 0;
+    thread_stats->num_rehashes = 0;
+    thread_stats->num_key_to_object = 0;
+    thread_stats->num_object_to_key = 0;
+  }
+}
+
+static std::string type_name(std::type_index type) {
+#ifdef __GNUG__
+  int status = 0;
+  char* demangled = abi::__cxa_demangle(type.name(), nullptr, nullptr, &status);
+  if (status == 0 && demangled != nullptr) {
+    std::string ret = demangled;
+    std::free(demangled);
+    return ret;
+  }
+#endif
+  return type.name();
+}
+
+static std::vector<std::pair<std::string, LinearStats::Value>> sorted_entries(const LinearStats& stats) {
+  return sorted(mapped(stats.data, [](const auto& entry) {
+    return std::pair{type_name(entry.first), entry.second};
+  }), [](const auto& a, const auto& b) {
+    return a.first < b.first;
+  });
+}
+
+std::ostream& operator<<(std::ostream& os, const LinearStats& stats) {
+  constexpr int kWidth = 16;
+  os << "=== Linear statistics ===\n";
+  os << pad_left("inserts", kWidth) << pad_left("erases", kWidth) << pad_left("rehashes", kWidth)
+    << pad_left("key->object", kWidth) << pad_left("object->key", kWidth) << "\n";
+  for (const auto& [name, value] : sorted_entries(stats)) {
+    os
+      << pad_left(to_string_with_thousand_sep(value.num_inserts), kWidth)
+      << pad_left(to_string_with_thousand_sep(value.num_erases), kWidth)
+      << pad_left(to_string_with_thousand_sep(value.num_rehashes), kWidth)
+      << pad_left(to_string_with_thousand_sep(value.num_key_to_object), kWidth)
+      << pad_left(to_string_with_thousand_sep(value.num_object_to_key), kWidth)
+      << "  @  " << name << "\n"
+    ;
+  }
+  return os;
+}
+
+std::string to_json(const LinearStats& stats) {
+  std::stringstream ss;
+  ss << "[";
+  bool first = true;
+  for (const auto& [name, value] : sorted_entries(stats)) {
+    ss << (first ? "\n" : ",\n")
+      << "  {\"type\": \"" << name << "\""
+      << ", \"inserts\": " << value.num_inserts
+      << ", \"erases\": " << value.num_erases
+      << ", \"rehashes\": " << value.num_rehashes
+      << ", \"key_to_object\": " << value.num_key_to_object
+      << ", \"object_to_key\": " << value.num_object_to_key
+      << "}";
+    first = false;
+  }
+  ss << (first ? "]" : "\n]");
+  return ss.str();
+}
+
+#if LINEAR_STATS
+static const bool linear_stats_report_registered = (
+  add_profiler_report("linear_stats", []() { return to_json(linear_stats()); }),
+  true
+);
+#endif
@@ -0,0 +1,61 @@
+// Hot-path counters for linear expressions. Enabled by LINEAR_STATS compilation macro, see
+// compilation-macros.md. Counters are thread-local and aggregated on request, so collecting them
+// doesn't introduce contention between threads.
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <typeindex>
+
+#include "absl/container/flat_hash_map.h"
+
+
+#ifndef LINEAR_STATS
+#  define LINEAR_STATS 0
+#endif
+
+struct LinearStats {
+  struct Value {
+    int64_t num_inserts = 0;
+    int64_t num_erases = 0;
+    int64_t num_rehashes = 0;
+    int64_t num_key_to_object = 0;
+    int64_t num_object_to_key = 0;
+  };
+  absl::flat_hash_map<std::type_index, Value> data;  // linear param type -> counters
+};
+
+// Returns counters aggregated over all threads.
+LinearStats linear_stats();
+// Must not be called concurrently with linear expression operations.
+void reset_linear_stats();
+
+std::ostream& operator<<(std::ostream& os, const LinearStats& stats);
+std::string to_json(const LinearStats& stats);
+
+namespace internal {
+// Counters of one thread for one linear param type. Written only by the owning thread, hence
+// relaxed loads and stores are sufficient.
+struct ThreadLinearStats {
+  std::atomic<int64_t> num_inserts = 0;
+  std::atomic<int64_t> num_erases = 0;
+  std::atomic<int64_t> num_rehashes = 0;
+  std::atomic<int64_t> num_key_to_object = 0;
+  std::atomic<int64_t> num_object_to_key = 0;
+};
+
+ThreadLinearStats* register_thread_linear_stats(std::type_index type);
+
+template<typename ParamT>
+ThreadLinearStats& thread_linear_stats() {
+  static thread_local ThreadLinearStats* stats = register_thread_linear_stats(typeid(ParamT));
+  return *stats;
+}
+
+inline void increment_linear_stat(std::atomic<int64_t>& counter) {
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+}  // namespace internal
@@ -1,7 +1,9 @@
 #pragma once
 
+#include "cancellation.h"
 #include "compare.h"
 #include "linear.h"
+#include "progress.h"
 #include "shuffle.h"
 #include "util.h"
 
@@ -98,7 +100,13 @@ LinearT to_lyndon_basis(const LinearT& expression) {
   };
   VectorLinearT terms_converted;
 
+  // Total is an estimate: the queue grows as words are replaced with their shuffle expansions.
+  ProgressTracker progress("to_lyndon_basis");
+  int64_t num_processed = 0;
   while (!terms_to_convert.empty()) {
+    check_cancellation_periodically();
+    progress.update(num_processed, num_processed + terms_to_convert.size());
+    ++num_processed;
     const auto [word, coeff] = *terms_to_convert.begin();
     terms_to_convert.erase(terms_to_convert.begin());
     if (coeff == 0) {
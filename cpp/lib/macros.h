@@ -3,3 +3,6 @@
 
 #define INTERNAL_STRINGIFY(s) #s
 #define STRINGIFY(s) INTERNAL_STRINGIFY(s)
+
+#define INTERNAL_CONCAT(a, b) a##b
+#define CONCAT(a, b) INTERNAL_CONCAT(a, b)
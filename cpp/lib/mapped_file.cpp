@@ -0,0 +1,47 @@
+#include "mapped_file.h"
+
+#if defined(_WIN32)
+#  include <fstream>
+#  include <iterator>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "check.h"
+
+
+MappedFile::MappedFile(const std::string& filename) {
+#if defined(_WIN32)
+  std::ifstream fs(filename, std::ios::binary);
+  CHECK(fs.good()) << "Cannot open " << filename;
+  buffer_.assign(std::istreambuf_iterator<char>(fs), std::istreambuf_iterator<char>());
+  data_ = buffer_.data();
+  size_ = buffer_.size();
+#else
+  const int fd = open(filename.c_str(), O_RDONLY);
+  CHECK(fd >= 0) << "Cannot open " << filename;
+  struct stat st;
+  CHECK(fstat(fd, &st) == 0);
+  size_ = st.st_size;
+  if (size_ == 0) {
+    // mmap doesn't support empty mappings.
+    close(fd);
+    return;
+  }
+  void* mapping = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  CHECK(mapping != MAP_FAILED) << "Cannot mmap " << filename;
+  data_ = static_cast<const char*>(mapping);
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if !defined(_WIN32)
+  if (data_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+#endif
+}
@@ -0,0 +1,23 @@
+// Read-only memory-mapped file. Uses mmap where available, otherwise reads the file into memory.
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+
+class MappedFile {
+public:
+  explicit MappedFile(const std::string& filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<char> buffer_;  // used when mmap is not available
+};
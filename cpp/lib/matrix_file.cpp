@@ -0,0 +1,135 @@
+#include "matrix_file.h"
+
+#include <cstring>
+
+#include "check.h"
+#include "compare.h"
+#include "util.h"
+
+
+static void write_header(std::ofstream& fs, const MatrixFileHeader& header) {
+  fs.seekp(0);
+  fs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+}
+
+MatrixFileWriter::MatrixFileWriter(const std::string& filename, MatrixFileLayout layout)
+    : filename_(filename), fs_(filename, std::ios::binary | std::ios::trunc) {
+  CHECK(fs_.good()) << "Cannot open " << filename;
+  std::memcpy(header_.magic, MatrixFileHeader::kMagic, sizeof(header_.magic));
+  header_.version = MatrixFileHeader::kVersion;
+  header_.layout = layout;
+  header_.elements_offset = sizeof(MatrixFileHeader);
+  // Write a placeholder: the header is finalized in `finish`.
+  write_header(fs_, header_);
+  line_starts_.push_back(0);
+}
+
+void MatrixFileWriter::add_line(absl::Span<const MatrixFileElement> elements) {
+  CHECK(!finished_);
+  for (const auto& element : elements) {
+    max_index_ = std::max(max_index_, element.index);
+  }
+  fs_.write(reinterpret_cast<const char*>(elements.data()), elements.size() * sizeof(MatrixFileElement));
+  line_starts_.push_back(line_starts_.back() + elements.size());
+}
+
+std::vector<MatrixFileElement> MatrixFileWriter::read_line(int idx) {
+  CHECK(!finished_);
+  CHECK_LE(0, idx);
+  CHECK_LT(idx, line_starts_.size() - 1);
+  fs_.flush();
+  if (!reader_.is_open()) {
+    reader_.open(filename_, std::ios::binary);
+    CHECK(reader_.good()) << "Cannot open " << filename_;
+  }
+  std::vector<MatrixFileElement> elements(line_starts_[idx + 1] - line_starts_[idx]);
+  reader_.clear();
+  reader_.seekg(header_.elements_offset + line_starts_[idx] * sizeof(MatrixFileElement));
+  reader_.read(reinterpret_cast<char*>(elements.data()), elements.size() * sizeof(MatrixFileElement));
+  CHECK(reader_.good()) << "Cannot read " << filename_;
+  return elements;
+}
+
+void MatrixFileWriter::finish(std::optional<int> other_dimension) {
+  CHECK(!finished_);
+  finished_ = true;
+  const int64_t num_lines = line_starts_.size() - 1;
+  const int64_t other_dim = other_dimension.value_or(max_index_ + 1);
+  CHECK_LT(max_index_, other_dim);
+  const bool is_csr = header_.layout == MatrixFileLayout::csr;
+  header_.rows = is_csr ? num_lines : other_dim;
+  header_.cols = is_csr ? other_dim : num_lines;
+  header_.num_elements = line_starts_.back();
+  header_.line_starts_offset = header_.elements_offset + header_.num_elements * sizeof(MatrixFileElement);
+  fs_.write(reinterpret_cast<const char*>(line_starts_.data()), line_starts_.size() * sizeof(uint64_t));
+  write_header(fs_, header_);
+  reader_.close();
+  fs_.close();
+  CHECK(!fs_.fail());
+}
+
+
+MappedMatrixFile::MappedMatrixFile(const std::string& filename) : file_(filename) {
+  const char* data = file_.data();
+  const size_t size = file_.size();
+  CHECK_GE(size, sizeof(MatrixFileHeader)) << "Not a matrix file: " << filename;
+  std::memcpy(&header_, data, sizeof(header_));
+  CHECK(std::memcmp(header_.magic, MatrixFileHeader::kMagic, sizeof(header_.magic)) == 0)
+    << "Not a matrix file: " << filename;
+  CHECK_EQ(header_.version, MatrixFileHeader::kVersion) << "Unsupported matrix file version: " << filename;
+  CHECK_EQ(header_.line_starts_offset + (num_lines() + 1) * sizeof(uint64_t), size)
+    << "Corrupted matrix file: " << filename;
+  elements_ = reinterpret_cast<const MatrixFileElement*>(data + header_.elements_offset);
+  line_starts_ = reinterpret_cast<const uint64_t*>(data + header_.line_starts_offset);
+}
+
+absl::Span<const MatrixFileElement> MappedMatrixFile::line(int idx) const {
+  CHECK_LE(0, idx);
+  CHECK_LT(idx, num_lines());
+  return absl::MakeConstSpan(elements_ + line_starts_[idx], line_starts_[idx + 1] - line_starts_[idx]);
+}
+
+Matrix MappedMatrixFile::to_matrix() const {
+  const bool is_csr = layout() == MatrixFileLayout::csr;
+  Matrix matrix;
+  for (const int i_line : range(num_lines())) {
+    for (const auto& element : line(i_line)) {
+      matrix.insert(
+        is_csr ? std::pair{i_line, element.index} : std::pair{element.index, i_line}
+      ) = element.value;
+    }
+  }
+  return matrix;
+}
+
+
+void save_matrix_file(const std::string& filename, const Matrix& matrix, MatrixFileLayout layout) {
+  const bool is_csr = layout == MatrixFileLayout::csr;
+  std::vector<std::vector<MatrixFileElement>> lines(is_csr ? matrix.rows() : matrix.cols());
+  for (const auto& t : matrix.as_triplets()) {
+    if (is_csr) {
+      lines[t.row].push_back({t.col, t.value});
+    } else {
+      lines[t.col].push_back({t.row, t.value});
+    }
+  }
+  MatrixFileWriter writer(filename, layout);
+  for (auto& line : lines) {
+    absl::c_sort(line, cmp::projected([](const auto& element) { return element.index; }));
+    writer.add_line(line);
+  }
+  writer.finish(is_csr ? matrix.cols() : matrix.rows());
+}
+
+int matrix_rank(const MappedMatrixFile& matrix) {
+  // Rank is invariant under transposition, so each line can be fed as a row. Elements within
+  // a line are sorted, hence entries arrive in (row, col) order.
+  const int line_length = matrix.layout() == MatrixFileLayout::csr ? matrix.cols() : matrix.rows();
+  return matrix_rank_raw_linbox(matrix.num_lines(), line_length, [&](const auto& set_entry) {
+    for (const int i_line : range(matrix.num_lines())) {
+      for (const auto& element : matrix.line(i_line)) {
+        set_entry(i_line, element.index, element.value);
+      }
+    }
+  });
+}
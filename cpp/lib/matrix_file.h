@@ -0,0 +1,99 @@
+// Binary sparse matrix format designed to be memory-mapped.
+//
+// A matrix is stored as a sequence of lines (columns for CSC, rows for CSR). Each line is a sorted
+// list of (index, value) elements. All lines are stored contiguously, followed by line start offsets.
+// Numbers are stored in native byte order, so files are not portable between architectures.
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/types/span.h"
+
+#include "linalg.h"
+#include "mapped_file.h"
+
+
+enum class MatrixFileLayout : uint32_t {
+  csr = 0,  // a line for each row: (col, value)
+  csc = 1,  // a line for each column: (row, value)
+};
+
+struct MatrixFileElement {
+  int32_t index = 0;
+  int32_t value = 0;
+
+  bool operator==(const MatrixFileElement& other) const {
+    return index == other.index && value == other.value;
+  }
+  bool operator!=(const MatrixFileElement& other) const { return !(*this == other); }
+};
+
+struct MatrixFileHeader {
+  static constexpr char kMagic[8] = {'P', 'K', 'M', 'A', 'T', 'R', 'I', 'X'};
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8] = {};
+  uint32_t version = 0;
+  MatrixFileLayout layout = MatrixFileLayout::csr;
+  int64_t rows = 0;
+  int64_t cols = 0;
+  int64_t num_elements = 0;
+  uint64_t elements_offset = 0;
+  uint64_t line_starts_offset = 0;  // `num_lines + 1` uint64 element indices
+};
+
+// Writes a matrix file line by line. Memory usage is O(number of lines).
+class MatrixFileWriter {
+public:
+  MatrixFileWriter(const std::string& filename, MatrixFileLayout layout);
+
+  void add_line(absl::Span<const MatrixFileElement> elements);
+  // Reads back a line that has already been added. Goes through the file system, so this is
+  // meant for occasional lookups, e.g. to confirm that two lines with equal fingerprints match.
+  std::vector<MatrixFileElement> read_line(int idx);
+  // `other_dimension` is the number of columns for CSR, or the number of rows for CSC.
+  // If not specified, it is deduced from element indices.
+  void finish(std::optional<int> other_dimension = std::nullopt);
+
+private:
+  std::string filename_;
+  std::ofstream fs_;
+  std::ifstream reader_;
+  MatrixFileHeader header_;
+  std::vector<uint64_t> line_starts_;
+  int max_index_ = -1;
+  bool finished_ = false;
+};
+
+// Read-only view of a matrix file, see `MappedFile`.
+class MappedMatrixFile {
+public:
+  explicit MappedMatrixFile(const std::string& filename);
+
+  MatrixFileLayout layout() const { return header_.layout; }
+  int rows() const { return header_.rows; }
+  int cols() const { return header_.cols; }
+  int64_t num_elements() const { return header_.num_elements; }
+  int num_lines() const { return layout() == MatrixFileLayout::csr ? rows() : cols(); }
+
+  absl::Span<const MatrixFileElement> line(int idx) const;
+
+  Matrix to_matrix() const;
+
+private:
+  MappedFile file_;
+  MatrixFileHeader header_;
+  const MatrixFileElement* elements_ = nullptr;
+  const uint64_t* line_starts_ = nullptr;
+};
+
+void save_matrix_file(const std::string& filename, const Matrix& matrix, MatrixFileLayout layout);
+
+// Feeds the rank engine directly from the mapping, so the matrix is never loaded into `Matrix`.
+// Unlike `matrix_rank(const Matrix&)`, does not split the matrix into diagonal blocks.
+int matrix_rank(const MappedMatrixFile& matrix);
@@ -1,15 +1,137 @@
 #pragma once
 
+#include <chrono>
 #include <execution>
 #include <future>
 
+#include "progress.h"
+#include "thread_pool.h"
 #include "util.h"
 
 
 #ifndef PARALLELISM_IMPLEMENTATION
-#  define PARALLELISM_IMPLEMENTATION 1
+#  define PARALLELISM_IMPLEMENTATION 3
 #endif
 
+
+namespace internal {
+// Splits [0, size) into chunks and calls `func(begin, end)` for each chunk. Chunk size defaults to
+// a value that gives each thread several chunks, so that uneven tasks are balanced.
+template<typename F>
+void parallel_chunks(int size, int chunk_size, const F& func) {
+#if PARALLELISM_IMPLEMENTATION == 0
+  if (size > 0) {
+    func(0, size);
+  }
+#else
+  ThreadPool& pool = global_thread_pool();
+  if (chunk_size <= 0) {
+    chunk_size = std::max(1, size / (pool.num_threads() * 4));
+  }
+  pool.parallel_for_chunks(size, chunk_size, func);
+#endif
+}
+}  // namespace internal
+
+// Calls `func(i)` for each i in [0, size). `func` may use parallel primitives itself.
+template<typename F>
+void parallel_for(int size, const F& func, int chunk_size = 0) {
+  internal::parallel_chunks(size, chunk_size, [&](int begin, int end) {
+    for (const int i : range(begin, end)) {
+      func(i);
+    }
+  });
+}
+
+// Like `mapped`, but in parallel. `Src` must support random access.
+template<typename Src, typename F>
+auto parallel_map(const Src& src, const F& func, int chunk_size = 0) {
+  std::vector<std::invoke_result_t<F, typename Src::value_type>> dst(src.size());
+  ProgressTracker progress("parallel_map", src.size());
+  parallel_for(src.size(), [&](int i) {
+    dst[i] = func(src[i]);
+    progress.advance();
+  }, chunk_size);
+  return dst;
+}
+
+// Returns `reduce(...reduce(reduce(identity, map(0)), map(1))..., map(size-1))`, computed in
+// parallel. `reduce` must be associative. The result is deterministic (does not depend on
+// scheduling) as long as the chunk size is fixed.
+template<typename T, typename MapF, typename ReduceF>
+T parallel_reduce(int size, T identity, const MapF& map, const ReduceF& reduce, int chunk_size = 0) {
+  if (chunk_size <= 0) {
+    chunk_size = std::max(1, size / (parallelism_num_threads() * 4));
+  }
+  std::vector<T> partials(div_round_up(std::max(size, 0), chunk_size), identity);
+  internal::parallel_chunks(size, chunk_size, [&](int begin, int end) {
+    T& partial = partials[begin / chunk_size];
+    for (const int i : range(begin, end)) {
+      partial = reduce(std::move(partial), map(i));
+    }
+  });
+  T result = std::move(identity);
+  for (auto& partial : partials) {
+    result = reduce(std::move(result), std::move(partial));
+  }
+  return result;
+}
+
+
+// Execution time of a task scheduled via `for_each_parallel_by_cost`/`mapped_parallel_by_cost`.
+// Can be used to tune cost estimators.
+struct ParallelTaskTiming {
+  int index = 0;  // index in the source container
+  double cost = 0;  // estimated cost
+  double seconds = 0;  // actual wall time
+};
+
+// Like `for_each_parallel`, but for tasks of uneven size. `cost(x)` must return an estimate of
+// the relative time required for `func(x)`. Tasks are started in the order of decreasing cost and
+// distributed one by one, so that a few heavy tasks don't end up at the tail of the schedule.
+// `Src` must support random access. If `timings` is provided, it receives the timing of each task
+// in the order of `src`.
+template<typename Src, typename F, typename CostF>
+void for_each_parallel_by_cost(
+  const Src& src, const F& func, const CostF& cost, std::vector<ParallelTaskTiming>* timings = nullptr
+) {
+  const int size = src.size();
+  std::vector<ParallelTaskTiming> new_timings(size);
+  for (const int i : range(size)) {
+    new_timings[i].index = i;
+    new_timings[i].cost = cost(src[i]);
+  }
+  std::vector<int> order = to_vector(range(size));
+  absl::c_stable_sort(order, [&](int a, int b) {
+    return new_timings[a].cost > new_timings[b].cost;
+  });
+  parallel_for(size, [&](int k) {
+    const int i = order[k];
+    const auto start = std::chrono::steady_clock::now();
+    func(src[i]);
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    new_timings[i].seconds = duration.count();
+  }, 1);
+  if (timings) {
+    *timings = std::move(new_timings);
+  }
+}
+
+template<typename Src, typename F, typename CostF>
+auto mapped_parallel_by_cost(
+  const Src& src, const F& func, const CostF& cost, std::vector<ParallelTaskTiming>* timings = nullptr
+) {
+  std::vector<std::invoke_result_t<F, typename Src::value_type>> dst(src.size());
+  for_each_parallel_by_cost(
+    to_vector(range(src.size())),
+    [&](int i) { dst[i] = func(src[i]); },
+    [&](int i) { return cost(src[i]); },
+    timings
+  );
+  return dst;
+}
+
+
 #if PARALLELISM_IMPLEMENTATION == 0
 
 template<typename Src, typename F>
@@ -17,6 +139,13 @@ auto mapped_parallel(const Src& src, F&& func) {
   return mapped(src, std::forward<F>(func));
 }
 
+template<typename Src, typename F>
+void for_each_parallel(const Src& src, F&& func) {
+  for (const auto& x : src) {
+    func(x);
+  }
+}
+
 #elif PARALLELISM_IMPLEMENTATION == 1
 // This requires Threading Building Blocks ("-ltbb") with libstdc++, i.e. with gcc/clang builds.
 // TODO: Link TBB via Bazel.
@@ -27,6 +156,12 @@ auto mapped_parallel(const Src& src, F&& func) {
   return dst;
 }
 
+// Note: `par` rather than `par_unseq`, because `func` is allowed to acquire locks.
+template<typename Src, typename F>
+void for_each_parallel(const Src& src, F&& func) {
+  std::for_each(std::execution::par, src.begin(), src.end(), std::forward<F>(func));
+}
+
 #elif PARALLELISM_IMPLEMENTATION == 2
 // This crashed with std::bad_alloc on large input.
 template<typename Src, typename F>
@@ -39,6 +174,41 @@ auto mapped_parallel(const Src& src, const F& func) {
   });
 }
 
+template<typename Src, typename F>
+void for_each_parallel(const Src& src, const F& func) {
+  auto futures = mapped(src, [func](const auto& x) {
+    return std::async([func, x](){ func(x); });
+  });
+  for (auto& fut : futures) {
+    fut.get();
+  }
+}
+
+#elif PARALLELISM_IMPLEMENTATION == 3
+// Parallelism via the in-tree work-stealing thread pool, see thread_pool.h.
+template<typename Src, typename F>
+auto mapped_parallel(const Src& src, const F& func) {
+  if constexpr (std::is_same_v<
+      typename std::iterator_traits<decltype(std::begin(src))>::iterator_category,
+      std::random_access_iterator_tag>) {
+    return parallel_map(src, func);
+  } else {
+    return parallel_map(to_vector(src), func);
+  }
+}
+
+template<typename Src, typename F>
+void for_each_parallel(const Src& src, const F& func) {
+  if constexpr (std::is_same_v<
+      typename std::iterator_traits<decltype(std::begin(src))>::iterator_category,
+      std::random_access_iterator_tag>) {
+    parallel_for(src.size(), [&](int i) { func(src[i]); });
+  } else {
+    const auto elements = to_vector(src);
+    parallel_for(elements.size(), [&](int i) { func(elements[i]); });
+  }
+}
+
 #else
 #  error Unsupported PARALLELISM_IMPLEMENTATION
 #endif
@@ -20,6 +20,8 @@
 
 #include "polylog_space.h"
 
+#include <atomic>
+
 #include "expr_matrix_builder.h"
 #include "iterated_integral.h"
 #include "polylog_cgrli.h"
@@ -40,6 +42,80 @@ static Container one_minus_cross_ratio(Container p) {
 }
 
 
+static std::atomic<SpaceGenerationMode> current_space_generation_mode = SpaceGenerationMode::direct;
+
+SpaceGenerationMode space_generation_mode() {
+  return current_space_generation_mode;
+}
+
+ScopedSpaceGenerationMode::ScopedSpaceGenerationMode(SpaceGenerationMode mode)
+    : previous_mode_(current_space_generation_mode.exchange(mode)) {}
+
+ScopedSpaceGenerationMode::~ScopedSpaceGenerationMode() {
+  current_space_generation_mode = previous_mode_;
+}
+
+static bool is_plain_var(X x) { return x.is(XForm::var); }
+static bool is_plain_var(int x) { return x > 0; }
+
+// Returns `mapped(point_sets, make)`. In `SpaceGenerationMode::orbits` calls `make` only once for
+// each point set size and obtains other elements via relabeling. Requires `make` to commute with
+// relabeling, i.e. `make(p) == substitute_variables(make({1, ..., n}), p)`.
+template<typename PointT, typename MakeF>
+static auto generate_over_point_sets(const std::vector<std::vector<PointT>>& point_sets, const MakeF& make) {
+  using ExprT = std::invoke_result_t<MakeF, std::vector<PointT>>;
+  const SpaceGenerationMode mode = space_generation_mode();
+  const bool use_orbits = mode == SpaceGenerationMode::orbits && absl::c_all_of(
+    point_sets, [](const auto& points) {
+      return absl::c_all_of(points, [](const auto& p) { return is_plain_var(p); })
+        && num_distinct_elements_unsorted(points) == points.size();
+    }
+  );
+  if (!use_orbits) {
+    return mode == SpaceGenerationMode::direct_parallel
+      ? mapped_parallel(point_sets, make)
+      : mapped(point_sets, make);
+  }
+  absl::flat_hash_map<int, ExprT> prototypes;
+  for (const auto& points : point_sets) {
+    const int n = points.size();
+    if (!prototypes.contains(n)) {
+      prototypes[n] = make(mapped(range_incl(1, n), [](int i) { return PointT(i); }));
+    }
+  }
+  return mapped_parallel(point_sets, [&](const auto& points) {
+    return substitute_variables(prototypes.at(points.size()), points);
+  });
+}
+
+std::vector<std::pair<std::vector<int>, int>> point_group_elements(PointGroup group, const std::vector<int>& points) {
+  std::vector<std::pair<std::vector<int>, int>> ret;
+  const auto add_with_sign = [&](std::vector<int> permuted) {
+    std::vector<int> indices = mapped(permuted, [&](int p) {
+      return static_cast<int>(absl::c_find(points, p) - points.begin());
+    });
+    const int sign = sort_with_sign(indices);
+    ret.push_back({std::move(permuted), sign});
+  };
+  switch (group) {
+    case PointGroup::symmetric:
+      CHECK_LE(points.size(), kMaxSymmetricGroupPoints);
+      for (const auto& permuted : permutations(sorted(points))) {
+        add_with_sign(permuted);
+      }
+      return ret;
+    case PointGroup::dihedral: {
+      const int n = points.size();
+      for (const int shift : range(n)) {
+        add_with_sign(mapped(range(n), [&](int i) { return points[(i + shift) % n]; }));
+        add_with_sign(mapped(range(n), [&](int i) { return points[(shift - i + n) % n]; }));
+      }
+      return ret;
+    }
+  }
+  FATAL_BAD_ENUM(group);
+}
+
 template<typename SpaceT>
 std::string space_to_string(const SpaceT& space) {
   return absl::StrCat("<", str_join(space, ", ", [](const auto& expr) {
@@ -55,7 +131,7 @@ std::string dump_to_string_impl(const GrPolylogACoSpace& space) { return space_t
 
 
 PolylogSpace CB_naive_via_QLi_fours(int weight, const XArgs& xargs) {
-  return mapped(combinations(xargs.as_x(), 4), [&](const auto& p) { return QLiVec(weight, p); });
+  return generate_over_point_sets(combinations(xargs.as_x(), 4), [&](const auto& p) { return QLiVec(weight, p); });
 }
 
 PolylogSpace CB(int weight, const XArgs& xargs) {
@@ -79,7 +155,10 @@ PolylogSpace CB(int weight, const XArgs& xargs) {
     case 2: {
       const auto head = slice(args, 0, 1);
       const auto tail = slice(args, 1);
-      return mapped(combinations(tail, 3), [&](const auto& p) { return QLi2(concat(head, p)); });
+      return generate_over_point_sets(
+        mapped(combinations(tail, 3), [&](const auto& p) { return concat(head, p); }),
+        [](const auto& p) { return QLi2(p); }
+      );
     }
     default: {
       return CB_naive_via_QLi_fours(weight, xargs);
@@ -95,7 +174,7 @@ PolylogSpace CL(int weight, const XArgs& xargs) {
   PolylogSpace space;
   const int max_args = std::min<int>(args.size(), (weight / 2 + 1) * 2);
   for (int num_args = 4; num_args <= max_args; num_args += 2) {
-    append_vector(space, mapped(combinations(args, num_args), [&](const auto& p) {
+    append_vector(space, generate_over_point_sets(combinations(args, num_args), [&](const auto& p) {
       return QLiVec(weight, p);
     }));
   }
@@ -280,17 +359,27 @@ GrPolylogSpace GrL_core(
   GrPolylogSpace ret;
   for (const auto& [bonus_p, qli_points] : index_splits(main_args, dimension - 2)) {
     const auto& bonus_points = bonus_p;  // workaround: lambdas cannot capture structured bindings
-    append_vector(
-      ret,
-      mapped_expanding(combinations(qli_points, 4 - num_fixed_points), [&](auto p) {
-        const auto qli_args = concat(p, fixed_points);
-        std::vector ret = {GrQLiVec(weight, bonus_points, qli_args)};
-        if (include_one_minus_cross_ratio) {
-          ret.push_back(GrQLiVec(weight, bonus_points, one_minus_cross_ratio(qli_args)));
-        }
-        return ret;
-      })
-    );
+    const int num_bonus_points = bonus_points.size();
+    const auto point_sets = mapped(combinations(qli_points, 4 - num_fixed_points), [&](const auto& p) {
+      return concat(bonus_points, p, fixed_points);
+    });
+    const auto make = [&](const std::vector<int>& points) {
+      return GrQLiVec(weight, slice(points, 0, num_bonus_points), slice(points, num_bonus_points));
+    };
+    const auto make_one_minus = [&](const std::vector<int>& points) {
+      return GrQLiVec(weight, slice(points, 0, num_bonus_points), one_minus_cross_ratio(slice(points, num_bonus_points)));
+    };
+    const auto exprs = generate_over_point_sets(point_sets, make);
+    if (include_one_minus_cross_ratio) {
+      // Keep the original element order: each element is followed by its "1 - x" counterpart.
+      const auto exprs_one_minus = generate_over_point_sets(point_sets, make_one_minus);
+      for (const int i : range(exprs.size())) {
+        ret.push_back(exprs[i]);
+        ret.push_back(exprs_one_minus[i]);
+      }
+    } else {
+      append_vector(ret, exprs);
+    }
   }
   return ret;
 }
@@ -494,3 +583,10 @@ std::string to_string(const SpaceVennRanks& ranks) {
 std::string to_string(const SpaceMappingRanks& ranks) {
   return absl::StrCat(ranks.space(), " - ", ranks.image(), " = ", ranks.kernel());
 }
+
+std::string to_string(const SpaceDedupeStats& stats) {
+  return absl::StrCat(
+    stats.removed(), " of ", stats.total, " removed: ",
+    stats.zero, " zero, ", stats.duplicate, " duplicate, ", stats.negated, " negated"
+  );
+}
@@ -2,14 +2,22 @@
 
 #pragma once
 
+#include "absl/container/flat_hash_map.h"
+
+#include "cancellation.h"
+#include "checkpoint.h"
 #include "delta.h"
 #include "expr_matrix_builder.h"
+#include "fingerprint.h"
 #include "gamma.h"
 #include "integer_math.h"
 #include "itertools.h"
 #include "linalg.h"
 #include "parallel_util.h"
 #include "profiler.h"
+#include "progress.h"
+#include "space_cache.h"
+#include "streaming_matrix_builder.h"
 #include "x.h"
 
 
@@ -25,6 +33,28 @@ std::string dump_to_string_impl(const GrPolylogSpace& space);
 std::string dump_to_string_impl(const GrPolylogNCoSpace& space);
 std::string dump_to_string_impl(const GrPolylogACoSpace& space);
 
+enum class SpaceGenerationMode {
+  // Compute each space element from scratch.
+  direct,
+  // Same as `direct`, but compute elements in parallel.
+  direct_parallel,
+  // For generators that apply the same function to many point sets (CB, CL, GrL_core): compute
+  // the function once per orbit under point relabeling and obtain the other elements via
+  // `substitute_variables`. Applies only to point sets consisting of distinct plain variables.
+  // Elements obtained this way have no annotations.
+  orbits,
+};
+
+SpaceGenerationMode space_generation_mode();
+
+class ScopedSpaceGenerationMode {
+public:
+  explicit ScopedSpaceGenerationMode(SpaceGenerationMode mode);
+  ~ScopedSpaceGenerationMode();
+private:
+  SpaceGenerationMode previous_mode_;
+};
+
 PolylogSpace CB_naive_via_QLi_fours(int weight, const XArgs& xargs);
 PolylogSpace CB(int weight, const XArgs& xargs);
 inline PolylogSpace CB1(const XArgs& xargs) { return CB(1, xargs); }
@@ -121,6 +151,52 @@ GrPolylogNCoSpace simple_co_CGrL_test_space(int weight, int dimension, int num_p
 PolylogNCoSpace co_CL(int weight, int num_coparts, const XArgs& xargs);
 
 
+enum class PointGroup {
+  symmetric,  // all permutations of points
+  dihedral,   // symmetries of a polygon with vertices at points, in the given order
+};
+
+enum class IsotypicComponent {
+  trivial,  // sum over group elements
+  sign,     // sum over group elements with the sign of the permutation
+};
+
+// The symmetric group has n! elements: each of them is materialized, so the number of points is capped.
+constexpr int kMaxSymmetricGroupPoints = 9;
+
+// Returns (permutation of `points`, permutation sign) for each group element.
+std::vector<std::pair<std::vector<int>, int>> point_group_elements(PointGroup group, const std::vector<int>& points);
+
+// Projects each space element onto an isotypic component of the group acting on `points` by
+// relabeling. If the space is invariant under the group, the rank of the projected space equals
+// the dimension of the corresponding component, which is often enough and is much cheaper to
+// compute when the group is large. `points` must include the largest variable used in the space.
+// The result is not normalized, i.e. elements are multiplied by the size of the stabilizer.
+//
+// Makes |G| substitutions per element, i.e. n! for `PointGroup::symmetric` on n points (capped at
+// `kMaxSymmetricGroupPoints`) and 2n for `PointGroup::dihedral`.
+template<typename SpaceT>
+SpaceT isotypic_projection(
+  const SpaceT& space, PointGroup group, IsotypicComponent component, const std::vector<int>& points
+) {
+  const auto group_elements = point_group_elements(group, points);
+  const auto substitutions = mapped(group_elements, [&](const auto& element) {
+    std::vector<int> new_points = to_vector(range_incl(1, max_value(points)));
+    for (const int i : range(points.size())) {
+      new_points.at(points[i] - 1) = element.first[i];
+    }
+    return std::pair{new_points, component == IsotypicComponent::sign ? element.second : 1};
+  });
+  return mapped_parallel(space, [&](const auto& expr) {
+    typename SpaceT::value_type ret;
+    for (const auto& [new_points, sign] : substitutions) {
+      ret += sign * substitute_variables(expr, new_points);
+    }
+    return ret;
+  });
+}
+
+
 template<typename SpaceT, typename F>
 void check_space_is_homogeneous(const SpaceT& space, const F& func) {
   std::optional<std::invoke_result_t<F, typename SpaceT::value_type>> exemplar;
@@ -202,8 +278,79 @@ private:
   int image_ = 0;
 };
 
+struct SpaceDedupeStats {
+  int total = 0;
+  int zero = 0;
+  int duplicate = 0;
+  int negated = 0;
+
+  int removed() const { return zero + duplicate + negated; }
+};
+
 std::string to_string(const SpaceVennRanks& ranks);
 std::string to_string(const SpaceMappingRanks& ranks);
+std::string to_string(const SpaceDedupeStats& stats);
+
+namespace internal {
+// Order-independent fingerprint of a linear expression. It is linear itself, in particular
+// `linear_fingerprint(-expr) == -linear_fingerprint(expr)` (modulo 2^64).
+template<typename LinearT>
+uint64_t linear_fingerprint(const LinearT& expr) {
+  uint64_t ret = 0;
+  expr.foreach_key([&](const auto& key, int coeff) {
+    const uint64_t key_hash = absl::Hash<std::decay_t<decltype(key)>>{}(key);
+    ret += static_cast<uint64_t>(coeff) * fingerprint_mix(key_hash);
+  });
+  return ret;
+}
+}  // namespace internal
+
+// Returns pointers to space elements excluding zeros, duplicates and negations of other elements.
+// Candidates are found by fingerprint and then verified, so the result is exact.
+template<typename SpaceT>
+std::vector<const typename SpaceT::value_type*> unique_space_elements(
+  const SpaceT& space, SpaceDedupeStats* stats = nullptr
+) {
+  const auto fingerprints = mapped_parallel(space, [](const auto& expr) {
+    return internal::linear_fingerprint(expr);
+  });
+  SpaceDedupeStats new_stats;
+  new_stats.total = space.size();
+  std::vector<const typename SpaceT::value_type*> ret;
+  // canonical fingerprint -> indices of unique elements
+  absl::flat_hash_map<uint64_t, absl::InlinedVector<int, 1>> buckets;
+  for (const int i : range(space.size())) {
+    const auto& expr = space[i];
+    if (expr.is_zero()) {
+      ++new_stats.zero;
+      continue;
+    }
+    const uint64_t fingerprint = fingerprints[i];
+    auto& bucket = buckets[std::min(fingerprint, 0 - fingerprint)];
+    bool is_new = true;
+    for (const int j : bucket) {
+      const auto& other = space[j];
+      if (fingerprints[j] == fingerprint && expr == other) {
+        ++new_stats.duplicate;
+        is_new = false;
+        break;
+      }
+      if (fingerprints[j] == 0 - fingerprint && (expr + other).is_zero()) {
+        ++new_stats.negated;
+        is_new = false;
+        break;
+      }
+    }
+    if (is_new) {
+      bucket.push_back(i);
+      ret.push_back(&expr);
+    }
+  }
+  if (stats) {
+    *stats = new_stats;
+  }
+  return ret;
+}
 
 
 template<typename SpaceT>
@@ -213,15 +360,106 @@ SpaceT normalize_space_remove_consecutive(const SpaceT& space, int dimension, in
   });
 }
 
-template<typename SpaceT, typename PrepareF, typename MatrixBuilderT>
-void add_space_to_matrix_builder(const SpaceT& space, const PrepareF& prepare, MatrixBuilderT& matrix_builder) {
+// Default cost estimate for processing a space element: preparation time grows with the number
+// of terms. Optimization potential: take weight and number of points into account.
+template<typename LinearT>
+double space_element_cost(const LinearT& expr) {
+  return expr.num_terms();
+}
+
+// Calls `func` for each space element in parallel, skipping zero, duplicate and negated elements.
+// This is the common pipeline for building space matrices: when several matrices are required,
+// `func` can prepare an element once and feed the result to several matrix builders.
+// Skipping elements doesn't affect matrix ranks as long as preparation is linear.
+// Elements are scheduled by decreasing `cost`, see `for_each_parallel_by_cost`. Timings are
+// indexed by position in `space`; skipped elements are not included.
+template<typename SpaceT, typename F, typename CostF>
+void process_space_by_cost(
+  const SpaceT& space, const F& func, const CostF& cost,
+  SpaceDedupeStats* stats = nullptr, std::vector<ParallelTaskTiming>* timings = nullptr
+) {
+  PROFILE_SCOPE("process_space");
   check_space(space);
-  const auto space_prepared = mapped_parallel(space, [prepare](const auto& s) {
-    return prepare(s);
+  const auto elements = unique_space_elements(space, stats);
+  ProgressTracker progress("process_space", elements.size());
+  for_each_parallel_by_cost(
+    elements,
+    [&](const auto* s) {
+      check_cancellation();
+      func(*s);
+      progress.advance();
+    },
+    [&](const auto* s) { return cost(*s); },
+    timings
+  );
+  if (timings) {
+    for (auto& timing : *timings) {
+      timing.index = elements[timing.index] - space.data();
+    }
+  }
+}
+
+template<typename SpaceT, typename F>
+void process_space(
+  const SpaceT& space, const F& func,
+  SpaceDedupeStats* stats = nullptr, std::vector<ParallelTaskTiming>* timings = nullptr
+) {
+  process_space_by_cost(space, func, DISAMBIGUATE(space_element_cost), stats, timings);
+}
+
+// Prepares space elements and adds them to the matrix builder.
+template<typename SpaceT, typename PrepareF, typename MatrixBuilderT>
+void add_space_to_matrix_builder(
+  const SpaceT& space, const PrepareF& prepare, MatrixBuilderT& matrix_builder,
+  SpaceDedupeStats* stats = nullptr
+) {
+  process_space(space, [&](const auto& s) {
+    matrix_builder.add_expr(prepare(s));
+  }, stats);
+}
+
+// Like `add_space_to_matrix_builder`, but records prepared elements in `checkpoint`. If the
+// computation is restarted, elements from the journal are added to the builder directly instead
+// of being prepared again. The journal stores prepared expressions rather than the builder state:
+// it's smaller and doesn't depend on the builder internals.
+// The caller should remove the checkpoint once the final result (e.g. matrix rank) is obtained.
+template<typename SpaceT, typename PrepareF, typename MatrixBuilderT>
+void add_space_to_matrix_builder(
+  const SpaceT& space, const PrepareF& prepare, MatrixBuilderT& matrix_builder,
+  JournalCheckpoint& checkpoint, SpaceDedupeStats* stats = nullptr
+) {
+  using PreparedT = std::decay_t<decltype(prepare(space.front()))>;
+  std::vector<bool> prepared(space.size(), false);
+  checkpoint.replay([&](BinaryReader& reader) {
+    const int index = reader.read_pod<int32_t>();
+    CHECK(0 <= index && index < space.size()) << "Checkpoint " << checkpoint.path() << " is stale";
+    PreparedT expr;
+    deserialize(reader, expr);
+    prepared[index] = true;
+    matrix_builder.add_expr(expr);
   });
-  for (const auto& expr : space_prepared) {
+  process_space(space, [&](const auto& s) {
+    const int32_t index = &s - space.data();
+    if (prepared[index]) {
+      return;
+    }
+    const auto expr = prepare(s);
+    checkpoint.append([&](BinaryWriter& writer) {
+      writer.write_pod(index);
+      serialize(writer, expr);
+    });
     matrix_builder.add_expr(expr);
-  }
+  }, stats);
+  checkpoint.flush();
+}
+
+// Computes ranks of several matrices. Matrices are ranked one by one: see `matrix_blocks_rank`.
+template<typename... MatrixTs>
+auto matrix_ranks(const MatrixTs&... matrices) {
+  const auto ranks = mapped(std::vector<const Matrix*>{&matrices...}, [](const Matrix* matrix) {
+    return matrix_rank(*matrix);
+  });
+  return to_array<sizeof...(MatrixTs)>(ranks);
 }
 
 template<typename SpaceT, typename PrepareF>
@@ -232,11 +470,55 @@ Matrix space_matrix(const SpaceT& space, const PrepareF& prepare) {
   return matrix_builder.make_matrix();
 }
 
+// Out-of-core version of `space_matrix`. Writes the matrix to `filename`, which can be
+// loaded via `MappedMatrixFile`. Uses "<filename>.rows" as a temporary file.
+template<typename SpaceT, typename PrepareF>
+void space_matrix_file(
+  const SpaceT& space, const PrepareF& prepare, const std::string& filename,
+  size_t memory_budget_bytes = size_t(1) << 30
+) {
+  using ExprT = std::invoke_result_t<PrepareF, typename SpaceT::value_type>;
+  GetStreamingExprMatrixBuilder_t<ExprT> matrix_builder(filename + ".rows", memory_budget_bytes);
+  add_space_to_matrix_builder(space, prepare, matrix_builder);
+  matrix_builder.make_matrix_file(filename);
+}
+
 template<typename SpaceT, typename PrepareF>
 int space_rank(const SpaceT& space, const PrepareF& prepare) {
   return matrix_rank(space_matrix(space, prepare));
 }
 
+// Same as `space_rank`, but stores the matrix in the on-disk cache if it's enabled (see space_cache.h).
+// `make_space` is called only on cache miss. `key` must uniquely identify the space and `prepare`.
+template<typename MakeSpaceF, typename PrepareF>
+int cached_space_rank(const SpaceCacheKey& key, const MakeSpaceF& make_space, const PrepareF& prepare) {
+  if (!space_cache_dir().has_value()) {
+    return space_rank(make_space(), prepare);
+  }
+  const std::string matrix_path = cached_matrix_file(key, [&](const std::string& path) {
+    space_matrix_file(make_space(), prepare, path);
+  });
+  return matrix_rank(MappedMatrixFile(matrix_path));
+}
+
+// Grades monoms by letter content, i.e. the multiset of all letters. Suitable for `space_rank_graded`.
+struct LetterContentGrading {
+  template<typename T>
+  std::vector<T> operator()(const std::vector<T>& monom) const { return sorted(monom); }
+  template<typename T>
+  std::vector<T> operator()(const std::vector<std::vector<T>>& monom) const { return sorted(flatten(monom)); }
+};
+
+// Same as `space_rank`, but splits the matrix into blocks by `grading` (see
+// `ExprMatrixBuilder::make_matrix_blocks`) and ranks each block separately.
+template<typename SpaceT, typename PrepareF, typename GradingF = LetterContentGrading>
+int space_rank_graded(const SpaceT& space, const PrepareF& prepare, const GradingF& grading = {}) {
+  using ExprT = std::invoke_result_t<PrepareF, typename SpaceT::value_type>;
+  GetExprMatrixBuilder_t<ExprT> matrix_builder;
+  add_space_to_matrix_builder(space, prepare, matrix_builder);
+  return matrix_blocks_rank(matrix_builder.make_matrix_blocks(grading));
+}
+
 template<typename SpaceT, typename PrepareF>
 bool space_contains(const SpaceT& haystack, const SpaceT& needle, const PrepareF& prepare) {
   using ExprT = std::invoke_result_t<PrepareF, typename SpaceT::value_type>;
@@ -252,23 +534,21 @@ bool space_contains(const SpaceT& haystack, const SpaceT& needle, const PrepareF
 template<typename SpaceT, typename PrepareF>
 SpaceVennRanks space_venn_ranks(const SpaceT& a, const SpaceT& b, const PrepareF& prepare) {
   using ExprT = std::invoke_result_t<PrepareF, typename SpaceT::value_type>;
-  Profiler profiler(false);
-
-  GetExprMatrixBuilder_t<ExprT> matrix_builder_a;
-  add_space_to_matrix_builder(a, prepare, matrix_builder_a);
-  profiler.finish("A space");
-  const int a_rank = matrix_rank(matrix_builder_a.make_matrix());
-  profiler.finish("A rank");
-  add_space_to_matrix_builder(b, prepare, matrix_builder_a);
-  profiler.finish("united space");
-  const int united_rank = matrix_rank(matrix_builder_a.make_matrix());
-  profiler.finish("united rank");
+  PROFILE_SCOPE("space_venn_ranks");
 
+  // The builder for A grows into the builder for A+B, so only two builders are alive at a time.
+  // Each element of B is prepared once and added to both.
+  GetExprMatrixBuilder_t<ExprT> matrix_builder_united;
+  add_space_to_matrix_builder(a, prepare, matrix_builder_united);
+  const int a_rank = matrix_rank(matrix_builder_united.make_matrix());
   GetExprMatrixBuilder_t<ExprT> matrix_builder_b;
-  add_space_to_matrix_builder(b, prepare, matrix_builder_b);
-  profiler.finish("B space");
+  process_space(b, [&](const auto& expr) {
+    const auto prepared = prepare(expr);
+    matrix_builder_b.add_expr(prepared);
+    matrix_builder_united.add_expr(prepared);
+  });
   const int b_rank = matrix_rank(matrix_builder_b.make_matrix());
-  profiler.finish("B rank");
+  const int united_rank = matrix_rank(matrix_builder_united.make_matrix());
 
   CHECK_LE(a_rank, united_rank);
   CHECK_LE(b_rank, united_rank);
@@ -282,19 +562,124 @@ bool space_equal(const SpaceT& a, const SpaceT& b, const PrepareF& prepare) {
 
 template<typename SpaceT, typename PrepareF, typename MapF>
 SpaceMappingRanks space_mapping_ranks(const SpaceT& raw_space, const PrepareF& prepare, const MapF& map) {
-  Profiler profiler(false);
-  const auto space = space_matrix(raw_space, prepare);
-  profiler.finish("space");
-  const int space_rank = matrix_rank(space);
-  profiler.finish("space rank");
-  const auto image = space_matrix(raw_space, map);
-  profiler.finish("image");
-  const int image_rank = matrix_rank(image);
-  profiler.finish("image rank");
+  using SpaceExprT = std::invoke_result_t<PrepareF, typename SpaceT::value_type>;
+  using ImageExprT = std::invoke_result_t<MapF, typename SpaceT::value_type>;
+  PROFILE_SCOPE("space_mapping_ranks");
+  GetExprMatrixBuilder_t<SpaceExprT> space_matrix_builder;
+  GetExprMatrixBuilder_t<ImageExprT> image_matrix_builder;
+  process_space(raw_space, [&](const auto& expr) {
+    space_matrix_builder.add_expr(prepare(expr));
+    image_matrix_builder.add_expr(map(expr));
+  });
+  const auto [space_rank, image_rank] = matrix_ranks(
+    space_matrix_builder.make_matrix(), image_matrix_builder.make_matrix()
+  );
   return SpaceMappingRanks{space_rank, image_rank};
 }
 
+namespace internal {
+// Comultiplies each space element. Space elements usually share most of their monomials, so each
+// distinct monomial is comultiplied only once, and then the image of each element is assembled as
+// a linear combination of monomial images.
+// `comultiply_monom(key, cache, image)` must add the image of a monomial to `image`; monomials are
+// processed in parallel chunks, each with its own `CacheT`. `finalize` is applied to the image of
+// each element.
+template<typename CoExprT, typename CacheT, typename SpaceT, typename ComultiplyMonomF, typename FinalizeF>
+std::vector<CoExprT> space_comultiply(
+  const SpaceT& space, const ComultiplyMonomF& comultiply_monom, const FinalizeF& finalize
+) {
+  using KeyT = typename SpaceT::value_type::StorageT;
+  PROFILE_SCOPE("space_comultiply");
+  absl::flat_hash_map<KeyT, int> monom_indices;
+  std::vector<KeyT> monoms;
+  for (const auto& expr : space) {
+    expr.foreach_key([&](const KeyT& key, int) {
+      if (monom_indices.try_emplace(key, monoms.size()).second) {
+        monoms.push_back(key);
+      }
+    });
+  }
+  std::vector<typename CoExprT::BasicLinearMain> monom_images(monoms.size());
+  parallel_chunks(monoms.size(), 0, [&](int begin, int end) {
+    CacheT cache;
+    for (const int i : range(begin, end)) {
+      check_cancellation_periodically();
+      comultiply_monom(monoms[i], cache, monom_images[i]);
+    }
+  });
+  return mapped_parallel(space, [&](const auto& expr) {
+    if (expr.is_zero()) {
+      return CoExprT{};
+    }
+    typename CoExprT::BasicLinearMain image;
+    expr.foreach_key([&](const KeyT& key, int coeff) {
+      monom_images[monom_indices.at(key)].foreach_key([&](const auto& co_key, int co_coeff) {
+        image.add_to_key(co_key, coeff * co_coeff);
+      });
+    });
+    CoExprT ret = finalize(CoExprT(std::move(image), {}));
+    return ret.copy_annotations_mapped(
+      expr, [](const std::string& annotation) {
+        return fmt::comult() + annotation;
+      }
+    );
+  });
+}
+}  // namespace internal
+
+// Returns `ncomultiply(expr, form)` for each space element. Much faster than comultiplying elements
+// one by one, because the work is proportional to the number of distinct monomials in the space.
+template<typename SpaceT>
+auto space_ncomultiply(const SpaceT& space, std::vector<int> form = {}) {
+  using ExprT = typename SpaceT::value_type;
+  using CoExprT = decltype(internal::maybe_to_ncoexpr(std::declval<ExprT>()));
+  using PartExprT = Linear<typename CoExprT::Param::PartExprParam>;
+  static_assert(internal::coexpr_supports_key_space<typename CoExprT::Param>);
+  absl::c_sort(form);
+  return internal::space_comultiply<CoExprT, internal::LyndonExpansionCache<PartExprT>>(
+    space,
+    [&](const auto& key, auto& cache, auto& image) {
+      internal::maybe_to_ncoexpr(ExprT::single_key(key)).foreach_key([&](const auto& parts, int coeff) {
+        if (!form.empty()) {
+          const int weight = sum(mapped(parts, [](const auto& part) -> int { return part.size(); }));
+          internal::ncomultiply_check_form(weight, parts.size(), form);
+        }
+        internal::ncomultiply_add_term_keys(parts, coeff, form, cache, image);
+      });
+    },
+    DISAMBIGUATE(identity_function)
+  );
+}
+
+// Returns `icomultiply(expr, form)` for each space element, see `space_ncomultiply`.
+template<typename SpaceT>
+auto space_icomultiply(const SpaceT& space, std::vector<int> form) {
+  using ExprT = typename SpaceT::value_type;
+  using CoExprT = ICoExprForExpr_t<ExprT>;
+  static_assert(CoExprT::Param::coproduct_is_lie_algebra);
+  static_assert(internal::coexpr_supports_key_space<typename CoExprT::Param>);
+  absl::c_sort(form);
+  return internal::space_comultiply<CoExprT, internal::LyndonExpansionCache<ExprT>>(
+    space,
+    [&](const auto& key, auto& cache, auto& image) {
+      internal::icomultiply_check_form(key.size(), form);
+      internal::icomultiply_add_term_keys(key, 1, form, cache, image);
+    },
+    DISAMBIGUATE(to_lyndon_basis)
+  );
+}
+
 template<typename SpaceT>
 SpaceMappingRanks space_ncomultiply_mapping_ranks(const SpaceT& space) {
-  return space_mapping_ranks(space, DISAMBIGUATE(identity_function), DISAMBIGUATE(ncomultiply));
+  PROFILE_SCOPE("space_ncomultiply_mapping_ranks");
+  const auto image = space_ncomultiply(space);
+  using ImageExprT = typename decltype(image)::value_type;
+  GetExprMatrixBuilder_t<typename SpaceT::value_type> space_matrix_builder;
+  GetExprMatrixBuilder_t<ImageExprT> image_matrix_builder;
+  add_space_to_matrix_builder(space, DISAMBIGUATE(identity_function), space_matrix_builder);
+  add_space_to_matrix_builder(image, DISAMBIGUATE(identity_function), image_matrix_builder);
+  const auto [space_rank, image_rank] = matrix_ranks(
+    space_matrix_builder.make_matrix(), image_matrix_builder.make_matrix()
+  );
+  return SpaceMappingRanks{space_rank, image_rank};
 }
@@ -0,0 +1,271 @@
+#include "profiler.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#ifndef _WIN32
+#  include <sys/resource.h>
+#endif
+
+#include "absl/container/flat_hash_map.h"
+
+#include "allocation_tracker.h"
+#include "check.h"
+
+
+#ifdef _WIN32
+ResourceUsage process_resource_usage() { return {}; }
+ResourceUsage thread_resource_usage() { return {}; }
+#else
+static double timeval_to_sec(const timeval& t) {
+  return t.tv_sec + t.tv_usec / 1e6;
+}
+
+static ResourceUsage get_resource_usage(int who) {
+  rusage usage;
+  CHECK_EQ(getrusage(who, &usage), 0);
+  ResourceUsage ret;
+  ret.user_sec = timeval_to_sec(usage.ru_utime);
+  ret.sys_sec = timeval_to_sec(usage.ru_stime);
+  if (who == RUSAGE_SELF) {
+    ret.max_rss_kb = usage.ru_maxrss;
+  } else {
+    rusage process_usage;
+    CHECK_EQ(getrusage(RUSAGE_SELF, &process_usage), 0);
+    ret.max_rss_kb = process_usage.ru_maxrss;
+  }
+#  ifdef __APPLE__
+  ret.max_rss_kb /= 1024;  // macOS reports bytes
+#  endif
+  return ret;
+}
+
+ResourceUsage process_resource_usage() {
+  return get_resource_usage(RUSAGE_SELF);
+}
+
+ResourceUsage thread_resource_usage() {
+#  ifdef RUSAGE_THREAD
+  return get_resource_usage(RUSAGE_THREAD);
+#  else
+  return get_resource_usage(RUSAGE_SELF);
+#  endif
+}
+#endif
+
+
+class ProfileNode {
+public:
+  ProfileNode(std::string name, ProfileNode* parent)
+    : name_(std::move(name)),
+      parent_(parent),
+      path_(parent == nullptr || parent->parent_ == nullptr ? name_ : parent->path_ + ";" + name_),
+      allocation_stage_(
+        TRACK_ALLOCATIONS && parent != nullptr
+          ? register_allocation_stage(path_)
+          : internal::kNoAllocationStage
+      ) {}
+
+  int allocation_stage() const { return allocation_stage_; }
+
+  ProfileNode* child(const char* name) {
+    std::lock_guard lock(mutex_);
+    auto& ret = children_[name];
+    if (!ret) {
+      ret = std::make_unique<ProfileNode>(name, this);
+      children_order_.push_back(ret.get());
+    }
+    return ret.get();
+  }
+
+  void add(double wall_sec, const ResourceUsage& start, const ResourceUsage& finish) {
+    std::lock_guard lock(mutex_);
+    ++calls_;
+    wall_sec_ += wall_sec;
+    user_sec_ += finish.user_sec - start.user_sec;
+    sys_sec_ += finish.sys_sec - start.sys_sec;
+    rss_growth_kb_ += finish.max_rss_kb - start.max_rss_kb;
+  }
+
+  void reset() {
+    std::lock_guard lock(mutex_);
+    calls_ = 0;
+    wall_sec_ = user_sec_ = sys_sec_ = 0;
+    rss_growth_kb_ = 0;
+    for (ProfileNode* child : children_order_) {
+      child->reset();
+    }
+  }
+
+  void to_json(std::ostream& os, int indent) const {
+    std::lock_guard lock(mutex_);
+    const std::string pad(indent, ' ');
+    os << pad << "{\"name\": \"" << json_escape(name_) << "\""
+      << ", \"calls\": " << calls_
+      << ", \"wall_sec\": " << wall_sec_
+      << ", \"user_sec\": " << user_sec_
+      << ", \"sys_sec\": " << sys_sec_
+      << ", \"rss_growth_kb\": " << rss_growth_kb_
+      << ", \"children\": [";
+    bool first = true;
+    for (const ProfileNode* child : children_order_) {
+      os << (first ? "\n" : ",\n");
+      child->to_json(os, indent + 2);
+      first = false;
+    }
+    if (!first) {
+      os << "\n" << pad;
+    }
+    os << "]}";
+  }
+
+  // Returns total wall time of the node. Root node doesn't have its own stack entry.
+  double to_folded_stacks(std::ostream& os) const {
+    std::lock_guard lock(mutex_);
+    double children_wall_sec = 0;
+    for (const ProfileNode* child : children_order_) {
+      children_wall_sec += child->to_folded_stacks(os);
+    }
+    if (parent_ != nullptr && calls_ > 0) {
+      const double self_sec = std::max(0., wall_sec_ - children_wall_sec);
+      os << path_ << " " << static_cast<long long>(self_sec * 1e6) << "\n";
+    }
+    return wall_sec_;
+  }
+
+private:
+  static std::string json_escape(const std::string& s) {
+    std::string ret;
+    for (const char c : s) {
+      if (c == '"' || c == '\\') {
+        ret += '\\';
+      }
+      ret += c;
+    }
+    return ret;
+  }
+
+  const std::string name_;
+  ProfileNode* const parent_;
+  const std::string path_;
+  const int allocation_stage_;
+  mutable std::mutex mutex_;
+  absl::flat_hash_map<std::string, std::unique_ptr<ProfileNode>> children_;
+  std::vector<ProfileNode*> children_order_;
+  long long calls_ = 0;
+  double wall_sec_ = 0;
+  double user_sec_ = 0;
+  double sys_sec_ = 0;
+  long long rss_growth_kb_ = 0;
+};
+
+
+std::atomic<bool> internal::hierarchical_profiler_enabled = false;
+
+static ProfileNode& profile_root() {
+  // Never destroyed: worker threads may still refer to profile nodes at exit.
+  static ProfileNode* root = new ProfileNode("total", nullptr);
+  return *root;
+}
+
+static thread_local ProfileNode* current_node = nullptr;
+
+ProfileNode* current_profile_node() {
+  return current_node ? current_node : &profile_root();
+}
+
+void set_hierarchical_profiler_enabled(bool enabled) {
+  internal::hierarchical_profiler_enabled = enabled;
+}
+
+void reset_hierarchical_profiler() {
+  profile_root().reset();
+}
+
+static std::mutex profiler_reports_mutex;
+static std::vector<std::pair<std::string, std::function<std::string()>>>& profiler_reports() {
+  // Function-local to allow registering reports during static initialization.
+  static auto* reports = new std::vector<std::pair<std::string, std::function<std::string()>>>;
+  return *reports;
+}
+
+void add_profiler_report(std::string name, std::function<std::string()> make_json) {
+  std::lock_guard lock(profiler_reports_mutex);
+  profiler_reports().push_back({std::move(name), std::move(make_json)});
+}
+
+std::string hierarchical_profiler_to_json() {
+  std::stringstream ss;
+  ss << "{\"scopes\":\n";
+  profile_root().to_json(ss, 0);
+  std::lock_guard lock(profiler_reports_mutex);
+  for (const auto& [name, make_json] : profiler_reports()) {
+    ss << ",\n\"" << name << "\":\n" << make_json();
+  }
+  ss << "\n}\n";
+  return ss.str();
+}
+
+std::string hierarchical_profiler_to_folded_stacks() {
+  std::stringstream ss;
+  profile_root().to_folded_stacks(ss);
+  return ss.str();
+}
+
+static void set_current_node(ProfileNode* node) {
+  current_node = node;
+#if TRACK_ALLOCATIONS
+  internal::current_allocation_stage = node ? node->allocation_stage() : internal::kNoAllocationStage;
+#endif
+}
+
+ScopedProfileParent::ScopedProfileParent(ProfileNode* node) : previous_(current_node) {
+  set_current_node(node);
+}
+
+ScopedProfileParent::~ScopedProfileParent() {
+  set_current_node(previous_);
+}
+
+void ProfileScope::start(const char* name) {
+  parent_ = current_profile_node();
+  node_ = parent_->child(name);
+  set_current_node(node_);
+  start_usage_ = thread_resource_usage();
+  start_ = std::chrono::steady_clock::now();
+}
+
+void ProfileScope::finish() {
+  const auto finish = std::chrono::steady_clock::now();
+  const std::chrono::duration<double> wall = finish - start_;
+  node_->add(wall.count(), start_usage_, thread_resource_usage());
+  set_current_node(parent_);
+}
+
+
+class ProfilerAtExitDumper {
+public:
+  ProfilerAtExitDumper() {
+    const char* env_value = std::getenv("POLYKIT_PROFILE");
+    if (env_value != nullptr && *env_value != '\0') {
+      output_prefix_ = env_value;
+      set_hierarchical_profiler_enabled(true);
+    }
+  }
+  ~ProfilerAtExitDumper() {
+    if (output_prefix_.empty()) {
+      return;
+    }
+    std::ofstream(output_prefix_ + ".json") << hierarchical_profiler_to_json();
+    std::ofstream(output_prefix_ + ".folded") << hierarchical_profiler_to_folded_stacks();
+  }
+
+private:
+  std::string output_prefix_;
+};
+
+static ProfilerAtExitDumper profiler_at_exit_dumper;
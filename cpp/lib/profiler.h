@@ -1,32 +1,72 @@
+// Two kinds of profiling are supported:
+//
+//   * `Profiler` and `ScopedProfiler` measure a single operation and print the result to stderr.
+//
+//   * `PROFILE_SCOPE` adds a scope to the process-wide hierarchical profiler. Scopes are aggregated
+//     by their path (e.g. "space_rank/matrix_rank"): for each path we track the number of calls,
+//     wall time, user and system CPU time and peak RSS growth. Scopes opened by parallel tasks are
+//     attributed to the scope that started the parallel computation. Times are summed over calls,
+//     so wall time of a scope executed concurrently by several threads can exceed real time.
+//     Hierarchical profiler is disabled by default, in which case a scope costs one atomic load.
+//     Set POLYKIT_PROFILE environment variable to a path prefix to enable the profiler and dump the
+//     results at exit to "<prefix>.json" and "<prefix>.folded". The latter can be fed directly to
+//     flamegraph.pl.
+//     An enabled scope queries resource usage on entry and exit, so scopes belong on functions and
+//     phases that run for a while (building a matrix, computing a rank), not on per-term or
+//     per-element code such as `to_lyndon_basis`.
+//
+// Other modules can add their statistics to the JSON dump via `add_profiler_report`.
+
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <iostream>
 #include <string>
 
+#include "macros.h"
+
+
+struct ResourceUsage {
+  double user_sec = 0;
+  double sys_sec = 0;
+  long max_rss_kb = 0;  // peak resident set size of the process
+};
+
+// Returns CPU time used by the whole process.
+ResourceUsage process_resource_usage();
+// Returns CPU time used by the current thread (where supported, otherwise by the whole process).
+ResourceUsage thread_resource_usage();
+
 
-// TODO: Add user time and system time.
 class Profiler {
 public:
   Profiler(bool enable = true) {
     enable_ = enable;
     if (enable_) {
       start_ = std::chrono::steady_clock::now();
+      start_usage_ = process_resource_usage();
     }
   }
 
   void finish(const std::string& operation) {
     if (enable_) {
       const auto finish = std::chrono::steady_clock::now();
+      const auto finish_usage = process_resource_usage();
       const double time_sec = (finish - start_) / std::chrono::milliseconds(1) / 1000.;
-      std::cerr << "Profiler: " << operation << " took " << time_sec << " seconds\n";
+      std::cerr << "Profiler: " << operation << " took " << time_sec << " seconds"
+        << " (user " << finish_usage.user_sec - start_usage_.user_sec
+        << ", sys " << finish_usage.sys_sec - start_usage_.sys_sec << ")\n";
       start_ = finish;
+      start_usage_ = finish_usage;
     }
   }
 
 private:
   bool enable_ = false;
   std::chrono::time_point<std::chrono::steady_clock> start_;
+  ResourceUsage start_usage_;
 };
 
 
@@ -41,3 +81,67 @@ private:
   Profiler profiler_;
   std::string operation_;
 };
+
+
+class ProfileNode;
+
+namespace internal {
+extern std::atomic<bool> hierarchical_profiler_enabled;
+}  // namespace internal
+
+inline bool hierarchical_profiler_enabled() {
+  return internal::hierarchical_profiler_enabled.load(std::memory_order_relaxed);
+}
+void set_hierarchical_profiler_enabled(bool enabled);
+
+// Resets all statistics. Must not be called concurrently with profiled code.
+void reset_hierarchical_profiler();
+// Returns {"scopes": <scope tree>, <report name>: <report>, ...}.
+std::string hierarchical_profiler_to_json();
+// One line per scope path: "a;b;c <self wall time in microseconds>".
+std::string hierarchical_profiler_to_folded_stacks();
+
+// Adds a section to the JSON dump. `make_json` must return a valid JSON value.
+void add_profiler_report(std::string name, std::function<std::string()> make_json);
+
+// Profile scope that the scopes opened on this thread will be attached to.
+ProfileNode* current_profile_node();
+
+// Makes `node` the current scope on this thread. Used to attribute work done by parallel tasks to
+// the scope that created them.
+class ScopedProfileParent {
+public:
+  explicit ScopedProfileParent(ProfileNode* node);
+  ~ScopedProfileParent();
+
+private:
+  ProfileNode* previous_ = nullptr;
+};
+
+class ProfileScope {
+public:
+  // `name` must be a string literal or otherwise outlive the profiler.
+  explicit ProfileScope(const char* name) {
+    if (hierarchical_profiler_enabled()) {
+      start(name);
+    }
+  }
+  ~ProfileScope() {
+    if (node_) {
+      finish();
+    }
+  }
+  ProfileScope(const ProfileScope&) = delete;
+  ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+  void start(const char* name);
+  void finish();
+
+  ProfileNode* node_ = nullptr;
+  ProfileNode* parent_ = nullptr;
+  std::chrono::time_point<std::chrono::steady_clock> start_;
+  ResourceUsage start_usage_;
+};
+
+#define PROFILE_SCOPE(name)  ProfileScope CONCAT(profile_scope_, __LINE__)(name)
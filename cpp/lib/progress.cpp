@@ -0,0 +1,157 @@
+#include "progress.h"
+
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <mutex>
+
+#include "check.h"
+#include "string.h"
+
+
+std::atomic<bool> internal::progress_enabled = false;
+
+static std::atomic<double> progress_interval_sec = 2.0;
+static std::atomic<int> progress_max_depth_value = 0;
+
+static std::mutex progress_callback_mutex;
+static std::shared_ptr<const ProgressCallback> progress_callback;
+
+static thread_local ProgressTracker* current_tracker = nullptr;
+
+
+std::ostream& operator<<(std::ostream& os, const ProgressEvent& event) {
+  os << std::string(2 * event.depth, ' ') << event.task << ": "
+    << to_string_with_thousand_sep(event.done);
+  if (event.total > 0) {
+    os << " / " << to_string_with_thousand_sep(event.total)
+      << " (" << static_cast<int>(100.0 * event.done / event.total) << "%)";
+  }
+  os << ", " << event.elapsed_sec << "s elapsed";
+  if (event.finished) {
+    os << ", done";
+  } else if (event.eta_sec >= 0) {
+    os << ", ETA " << event.eta_sec << "s";
+  }
+  return os;
+}
+
+void set_progress_enabled(bool enabled) {
+  internal::progress_enabled = enabled;
+}
+
+double progress_interval() {
+  return progress_interval_sec;
+}
+
+void set_progress_interval(double seconds) {
+  CHECK_GE(seconds, 0);
+  progress_interval_sec = seconds;
+}
+
+int progress_max_depth() {
+  return progress_max_depth_value;
+}
+
+void set_progress_max_depth(int depth) {
+  progress_max_depth_value = depth;
+}
+
+void set_progress_callback(ProgressCallback callback) {
+  std::lock_guard lock(progress_callback_mutex);
+  if (callback) {
+    progress_callback = std::make_shared<const ProgressCallback>(std::move(callback));
+  } else {
+    progress_callback = nullptr;
+  }
+}
+
+static void send_progress_event(const ProgressEvent& event) {
+  std::shared_ptr<const ProgressCallback> callback;
+  {
+    std::lock_guard lock(progress_callback_mutex);
+    callback = progress_callback;
+  }
+  if (callback) {
+    (*callback)(event);
+  } else {
+    std::cerr << "Progress: " << event << "\n";
+  }
+}
+
+static std::chrono::steady_clock::duration to_duration(double seconds) {
+  return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+    std::chrono::duration<double>(seconds)
+  );
+}
+
+
+void ProgressTracker::start(const char* task, int64_t total) {
+  active_ = true;
+  task_ = task;
+  total_ = total;
+  parent_ = current_tracker;
+  depth_ = parent_ ? parent_->depth_ + 1 : 0;
+  reporting_ = depth_ <= progress_max_depth();
+  owner_ = std::this_thread::get_id();
+  start_ = std::chrono::steady_clock::now();
+  next_report_ = start_ + to_duration(progress_interval());
+  current_tracker = this;
+}
+
+void ProgressTracker::finish() {
+  // Trackers are destroyed in reverse order of creation on the owner thread.
+  current_tracker = parent_;
+  // Don't report operations aborted by an exception: the callback might throw too.
+  if (has_reported_ && std::uncaught_exceptions() == 0) {
+    report(std::chrono::steady_clock::now(), true);
+  }
+}
+
+void ProgressTracker::report(std::chrono::steady_clock::time_point now, bool finished) {
+  ProgressEvent event;
+  event.task = task_;
+  event.depth = depth_;
+  event.done = done_.load(std::memory_order_relaxed);
+  event.total = total_.load(std::memory_order_relaxed);
+  event.elapsed_sec = std::chrono::duration<double>(now - start_).count();
+  if (finished) {
+    event.eta_sec = 0;
+  } else if (event.total > 0 && event.done > 0) {
+    event.eta_sec = event.elapsed_sec * std::max<int64_t>(event.total - event.done, 0) / event.done;
+  }
+  event.finished = finished;
+  has_reported_ = true;
+  next_report_ = now + to_duration(progress_interval());
+  send_progress_event(event);
+}
+
+
+ProgressTracker* current_progress_tracker() {
+  return current_tracker;
+}
+
+ScopedProgressParent::ScopedProgressParent(ProgressTracker* tracker) : previous_(current_tracker) {
+  current_tracker = tracker;
+}
+
+ScopedProgressParent::~ScopedProgressParent() {
+  current_tracker = previous_;
+}
+
+
+class ProgressEnvInitializer {
+public:
+  ProgressEnvInitializer() {
+    // Construct the locale used by `to_string_with_thousand_sep` now, so that it outlives
+    // trackers reporting during static destruction.
+    to_string_with_thousand_sep(0);
+    const char* env_value = std::getenv("POLYKIT_PROGRESS");
+    if (env_value != nullptr && *env_value != '\0') {
+      set_progress_interval(std::stod(env_value));
+      set_progress_enabled(true);
+    }
+  }
+};
+
+static ProgressEnvInitializer progress_env_initializer;
@@ -0,0 +1,139 @@
+// Progress reporting for long-running computations.
+//
+// Long operations (space processing, parallel maps, Lyndon basis conversion, matrix rank) create
+// a `ProgressTracker` and advance it as they go. Progress reporting is disabled by default, in
+// which case a tracker costs one atomic load. When enabled, a tracker reports its state at most
+// once per `progress_interval`, and only if the operation has been running for at least that
+// long, so short operations stay silent.
+//
+// Reports go to stderr by default; `set_progress_callback` redirects them. Callbacks are always
+// invoked on the thread that created the tracker (i.e. the thread that called the operation),
+// never on thread pool workers. Trackers created while another tracker is active (on the same
+// thread or by a parallel task started from it) are nested. Only top-level trackers are reported
+// by default, see `set_progress_max_depth`.
+//
+// Set POLYKIT_PROGRESS environment variable to the report interval in seconds (e.g. "5") to
+// enable reporting to stderr.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+
+
+struct ProgressEvent {
+  const char* task = nullptr;
+  int depth = 0;  // 0 for top-level trackers
+  int64_t done = 0;
+  int64_t total = 0;  // 0 if unknown
+  double elapsed_sec = 0;
+  double eta_sec = -1;  // negative if unknown
+  bool finished = false;
+};
+
+std::ostream& operator<<(std::ostream& os, const ProgressEvent& event);
+
+using ProgressCallback = std::function<void(const ProgressEvent&)>;
+
+
+namespace internal {
+extern std::atomic<bool> progress_enabled;
+}  // namespace internal
+
+inline bool progress_enabled() {
+  return internal::progress_enabled.load(std::memory_order_relaxed);
+}
+void set_progress_enabled(bool enabled);
+
+// Minimum time between two reports from a tracker, and also the minimum operation duration
+// required to report anything.
+double progress_interval();
+void set_progress_interval(double seconds);
+
+// Trackers nested deeper than this are not reported.
+int progress_max_depth();
+void set_progress_max_depth(int depth);
+
+// Replaces the default stderr output. Pass an empty function to restore the default.
+void set_progress_callback(ProgressCallback callback);
+
+
+class ProgressTracker {
+public:
+  // `task` must be a string literal or otherwise outlive the tracker.
+  explicit ProgressTracker(const char* task, int64_t total = 0) {
+    if (progress_enabled()) {
+      start(task, total);
+    }
+  }
+  ~ProgressTracker() {
+    if (active_) {
+      finish();
+    }
+  }
+  ProgressTracker(const ProgressTracker&) = delete;
+  ProgressTracker& operator=(const ProgressTracker&) = delete;
+
+  // Can be called from any thread.
+  void advance(int64_t delta = 1) {
+    if (active_) {
+      done_.fetch_add(delta, std::memory_order_relaxed);
+      maybe_report();
+    }
+  }
+
+  // Sets absolute progress. For operations where the amount of remaining work changes on the go.
+  void update(int64_t done, int64_t total) {
+    if (active_) {
+      done_.store(done, std::memory_order_relaxed);
+      total_.store(total, std::memory_order_relaxed);
+      maybe_report();
+    }
+  }
+
+  int depth() const { return depth_; }
+
+private:
+  void start(const char* task, int64_t total);
+  void finish();
+  void maybe_report() {
+    if (reporting_ && std::this_thread::get_id() == owner_) {
+      const auto now = std::chrono::steady_clock::now();
+      if (now >= next_report_) {
+        report(now, false);
+      }
+    }
+  }
+  void report(std::chrono::steady_clock::time_point now, bool finished);
+
+  bool active_ = false;
+  bool reporting_ = false;
+  bool has_reported_ = false;
+  int depth_ = 0;
+  const char* task_ = nullptr;
+  ProgressTracker* parent_ = nullptr;
+  std::thread::id owner_;
+  std::atomic<int64_t> done_ = 0;
+  std::atomic<int64_t> total_ = 0;
+  std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point next_report_;
+};
+
+// Tracker that the trackers created on this thread will be nested in.
+ProgressTracker* current_progress_tracker();
+
+// Makes `tracker` the current tracker on this thread. Used to nest trackers created by parallel
+// tasks into the tracker of the operation that started them.
+class ScopedProgressParent {
+public:
+  explicit ScopedProgressParent(ProgressTracker* tracker);
+  ~ScopedProgressParent();
+
+private:
+  ProgressTracker* previous_ = nullptr;
+};
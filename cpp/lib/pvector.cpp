@@ -1,26 +1,103 @@
 #include "pvector.h"
 
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
 #include "compare.h"
+#include "profiler.h"
 #include "string.h"
 #include "util.h"
 
 
-PVectorStats pvector_stats;
+struct PVectorStatsRegistryEntry {
+  PVectorStats::Key key;
+  bool can_inline = false;
+  std::unique_ptr<internal::ThreadPVectorStats> stats;
+};
 
-std::ostream& operator<<(std::ostream& os, const PVectorStats& stats) {
-  constexpr int kWidth = 14;
+static std::mutex pvector_stats_registry_mutex;
+static std::vector<PVectorStatsRegistryEntry>& pvector_stats_registry() {
+  // Never destroyed: thread-local pointers may outlive static destruction.
+  static auto* registry = new std::vector<PVectorStatsRegistryEntry>;
+  return *registry;
+}
+
+internal::ThreadPVectorStats* internal::register_thread_pvector_stats(
+  std::type_index type, int inline_size, bool can_inline
+) {
+  std::lock_guard lock(pvector_stats_registry_mutex);
+  auto& registry = pvector_stats_registry();
+  registry.push_back({{type, inline_size}, can_inline, std::make_unique<ThreadPVectorStats>()});
+  return registry.back().stats.get();
+}
+
+PVectorStats pvector_stats() {
+  std::lock_guard lock(pvector_stats_registry_mutex);
+  PVectorStats ret;
+  for (const auto& entry : pvector_stats_registry()) {
+    auto& value = ret.data[entry.key];
+    value.num_inlined += entry.stats->num_inlined.load(std::memory_order_relaxed);
+    value.num_heap += entry.stats->num_heap.load(std::memory_order_relaxed);
+    if (!entry.can_inline) {
+      value.num_inlined = -1;
+    }
+  }
+  return ret;
+}
+
+static auto sorted_entries(const PVectorStats& stats) {
   auto entries = to_vector(stats.data);
   absl::c_sort(entries, cmp::projected([](const auto& e) { return e.first; }));
-  std::cout << "=== PVector statistics ===\n";
-  std::cout << pad_left("heap", kWidth) << " :" << pad_left("inlined", kWidth) << "\n";
-  for (const auto& [key, value] : entries) {
+  return entries;
+}
+
+std::ostream& operator<<(std::ostream& os, const PVectorStats& stats) {
+  constexpr int kWidth = 14;
+  os << "=== PVector statistics ===\n";
+  os << pad_left("heap", kWidth) << " :" << pad_left("inlined", kWidth) << "\n";
+  for (const auto& [key, value] : sorted_entries(stats)) {
     const std::string num_heap_str = to_string_with_thousand_sep(value.num_heap);
     const std::string num_inlined_str = value.num_inlined >= 0 ? to_string_with_thousand_sep(value.num_inlined) : "-";
     // TODO: Unmangle type name.
-    std::cout
+    os
       << pad_left(num_heap_str, kWidth) << " :" << pad_left(num_inlined_str, kWidth)
       << "  @  PVector<" <<  key.first.name() << ", " << key.second << ">\n"
     ;
   }
   return os;
 }
+
+std::string to_json(const PVectorStats& stats) {
+  std::stringstream ss;
+  ss << "[";
+  bool first = true;
+  for (const auto& [key, value] : sorted_entries(stats)) {
+    ss << (first ? "\n" : ",\n")
+      << "  {\"type\": \"" << key.first.name() << "\""
+      << ", \"inlined_size\": " << key.second
+      << ", \"heap\": " << value.num_heap
+      << ", \"inlined\": " << value.num_inlined
+      << "}";
+    first = false;
+  }
+  ss << (first ? "]" : "\n]");
+  return ss.str();
+}
+
+#if PVECTOR_STATS
+class PVectorStatsAtExitPrinter {
+public:
+  PVectorStatsAtExitPrinter() {
+    // Construct the static locale used for printing now, so that it outlives this object.
+    to_string_with_thousand_sep(0);
+    add_profiler_report("pvector_stats", []() { return to_json(pvector_stats()); });
+  }
+  ~PVectorStatsAtExitPrinter() {
+    std::cerr << pvector_stats();
+  }
+};
+
+static PVectorStatsAtExitPrinter pvector_stats_at_exit_printer;
+#endif
@@ -12,6 +12,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <bitset>
 #include <climits>
 #include <typeindex>
@@ -79,18 +80,38 @@ using pvector_base_type = std::conditional_t<
 }  // namespace internal
 
 
+// Collected if PVECTOR_STATS is enabled. Printed to stderr at exit and included into the
+// profiler JSON dump.
 struct PVectorStats {
   using Key = std::pair<std::type_index, int>;  // (type, inlined size)
   struct Value {
-    int64_t num_inlined = 0;
+    int64_t num_inlined = 0;  // -1 if the type is never inlined
     int64_t num_heap = 0;
   };
   absl::flat_hash_map<Key, Value> data;
 };
 
-extern PVectorStats pvector_stats;
+// Returns statistics aggregated over all threads.
+PVectorStats pvector_stats();
 
 std::ostream& operator<<(std::ostream& os, const PVectorStats& stats);
+std::string to_json(const PVectorStats& stats);
+
+namespace internal {
+// Counters of one thread for one PVector type. Written only by the owning thread.
+struct ThreadPVectorStats {
+  std::atomic<int64_t> num_inlined = 0;
+  std::atomic<int64_t> num_heap = 0;
+};
+
+ThreadPVectorStats* register_thread_pvector_stats(std::type_index type, int inline_size, bool can_inline);
+
+template<typename T, int InlineSize, bool CanInline>
+ThreadPVectorStats& thread_pvector_stats() {
+  static thread_local ThreadPVectorStats* stats = register_thread_pvector_stats(typeid(T), InlineSize, CanInline);
+  return *stats;
+}
+}  // namespace internal
 
 // TODO: Private inheritance + re-export methods manually to make sure interfaces are the same.
 template<typename T, int N>
@@ -117,15 +138,9 @@ public:
   ~PVector() {
 #if PVECTOR_STATS
     // Idea: add PVector tags to distinguish between different expression types.
-    auto& value = pvector_stats.data[{typeid(T), kInlineSize}];
-    if constexpr (!kCanInline) {
-      value.num_inlined = -1;
-    }
-    if (is_inlined()) {
-      ++value.num_inlined;
-    } else {
-      ++value.num_heap;
-    }
+    auto& stats = internal::thread_pvector_stats<T, kInlineSize, kCanInline>();
+    auto& counter = is_inlined() ? stats.num_inlined : stats.num_heap;
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 #endif
   }
 };
@@ -0,0 +1,289 @@
+// Binary serialization for persisting intermediate results (see checkpoint.h).
+//
+// `serialize(writer, value)` and `deserialize(reader, value)` are defined for trivially copyable
+// types, strings and standard containers built from serializable types. Other types (e.g. `CompressedBlob`) can be made
+// serializable by adding a pair of overloads in the namespace of the type (they are found via
+// ADL), as done for linear expressions in linear.h.
+//
+// Sizes are written as varints, other numbers are written in native byte order, so the data is not
+// portable between architectures.
+// Data written by one version of the library is not guaranteed to be readable by another: users
+// that store data for a long time must add a version of their own.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "check.h"
+#include "pvector.h"
+
+
+// Writes to a stream or appends to a string.
+class BinaryWriter {
+public:
+  explicit BinaryWriter(std::ostream& os) : os_(&os) {}
+  explicit BinaryWriter(std::string& buffer) : buffer_(&buffer) {}
+
+  void write_bytes(const void* data, size_t size) {
+    if (os_) {
+      os_->write(static_cast<const char*>(data), size);
+    } else {
+      buffer_->append(static_cast<const char*>(data), size);
+    }
+  }
+  template<typename T>
+  void write_pod(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write_bytes(&value, sizeof(value));
+  }
+  // LEB128: 7 bits per byte, small values take one byte.
+  void write_varint(uint64_t value) {
+    char bytes[10];
+    int size = 0;
+    while (value >= 0x80) {
+      bytes[size++] = static_cast<char>(value | 0x80);
+      value >>= 7;
+    }
+    bytes[size++] = static_cast<char>(value);
+    write_bytes(bytes, size);
+  }
+  // Zigzag encoding, so that small negative values are small as well.
+  void write_signed_varint(int64_t value) {
+    write_varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+  }
+  void write_size(size_t size) { write_varint(size); }
+
+  bool ok() const { return !os_ || os_->good(); }
+
+private:
+  std::ostream* os_ = nullptr;
+  std::string* buffer_ = nullptr;
+};
+
+// Reads from a stream or from a memory buffer. The buffer is not copied and must outlive the reader.
+// Reading past the end of data or reading malformed data is a fatal error.
+class BinaryReader {
+public:
+  explicit BinaryReader(std::istream& is) : is_(&is) {}
+  BinaryReader(const char* data, size_t size) : pos_(data), end_(data + size) {}
+
+  void read_bytes(void* data, size_t size) {
+    if (is_) {
+      is_->read(static_cast<char*>(data), size);
+      CHECK(is_->good()) << "Unexpected end of binary data";
+    } else {
+      CHECK_LE(size, static_cast<size_t>(end_ - pos_)) << "Unexpected end of binary data";
+      std::memcpy(data, pos_, size);
+      pos_ += size;
+    }
+  }
+  template<typename T>
+  T read_pod() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    read_bytes(&value, sizeof(value));
+    return value;
+  }
+  uint64_t read_varint() {
+    uint64_t value = 0;
+    for (int shift = 0; ; shift += 7) {
+      CHECK_LT(shift, 64) << "Corrupted binary data: bad varint";
+      const auto byte = read_pod<uint8_t>();
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return value;
+      }
+    }
+  }
+  int64_t read_signed_varint() {
+    const uint64_t value = read_varint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+  }
+  // Reads a container size, with a sanity check against corrupted data.
+  size_t read_size() {
+    const uint64_t size = read_varint();
+    CHECK_LT(size, uint64_t(1) << 48) << "Corrupted binary data";
+    return size;
+  }
+
+  // The following functions are only for memory buffers.
+  const char* position() const {
+    CHECK(!is_);
+    return pos_;
+  }
+  void skip(size_t size) {
+    CHECK(!is_);
+    CHECK_LE(size, static_cast<size_t>(end_ - pos_)) << "Unexpected end of binary data";
+    pos_ += size;
+  }
+  bool at_end() const {
+    CHECK(!is_);
+    return pos_ == end_;
+  }
+
+private:
+  std::istream* is_ = nullptr;
+  const char* pos_ = nullptr;
+  const char* end_ = nullptr;
+};
+
+
+// Declarations, so that the overloads for nested containers can find each other.
+template<typename T> void serialize(BinaryWriter& writer, const std::vector<T>& value);
+template<typename T> void deserialize(BinaryReader& reader, std::vector<T>& value);
+template<typename T, int N> void serialize(BinaryWriter& writer, const PVector<T, N>& value);
+template<typename T, int N> void deserialize(BinaryReader& reader, PVector<T, N>& value);
+template<typename T, size_t N, std::enable_if_t<!std::is_trivially_copyable_v<T>, int> = 0>
+void serialize(BinaryWriter& writer, const std::array<T, N>& value);
+template<typename T, size_t N, std::enable_if_t<!std::is_trivially_copyable_v<T>, int> = 0>
+void deserialize(BinaryReader& reader, std::array<T, N>& value);
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::tuple<Ts...>>, int> = 0>
+void serialize(BinaryWriter& writer, const std::tuple<Ts...>& value);
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::tuple<Ts...>>, int> = 0>
+void deserialize(BinaryReader& reader, std::tuple<Ts...>& value);
+template<typename A, typename B, std::enable_if_t<!std::is_trivially_copyable_v<std::pair<A, B>>, int> = 0>
+void serialize(BinaryWriter& writer, const std::pair<A, B>& value);
+template<typename A, typename B, std::enable_if_t<!std::is_trivially_copyable_v<std::pair<A, B>>, int> = 0>
+void deserialize(BinaryReader& reader, std::pair<A, B>& value);
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::variant<Ts...>>, int> = 0>
+void serialize(BinaryWriter& writer, const std::variant<Ts...>& value);
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::variant<Ts...>>, int> = 0>
+void deserialize(BinaryReader& reader, std::variant<Ts...>& value);
+
+
+template<typename T, std::enable_if_t<std::is_trivially_copyable_v<T>, int> = 0>
+void serialize(BinaryWriter& writer, const T& value) {
+  writer.write_pod(value);
+}
+template<typename T, std::enable_if_t<std::is_trivially_copyable_v<T>, int> = 0>
+void deserialize(BinaryReader& reader, T& value) {
+  value = reader.read_pod<T>();
+}
+
+inline void serialize(BinaryWriter& writer, const std::string& value) {
+  writer.write_size(value.size());
+  writer.write_bytes(value.data(), value.size());
+}
+inline void deserialize(BinaryReader& reader, std::string& value) {
+  value.resize(reader.read_size());
+  reader.read_bytes(value.data(), value.size());
+}
+
+// Note: `std::vector<bool>` is not a container of `bool`s.
+inline void serialize(BinaryWriter& writer, const std::vector<bool>& value) {
+  serialize(writer, std::vector<char>(value.begin(), value.end()));
+}
+inline void deserialize(BinaryReader& reader, std::vector<bool>& value) {
+  std::vector<char> chars;
+  deserialize(reader, chars);
+  value.assign(chars.begin(), chars.end());
+}
+
+namespace internal {
+template<typename Container>
+void serialize_range(BinaryWriter& writer, const Container& container) {
+  writer.write_size(container.size());
+  if constexpr (std::is_trivially_copyable_v<typename Container::value_type>) {
+    writer.write_bytes(container.data(), container.size() * sizeof(typename Container::value_type));
+  } else {
+    for (const auto& element : container) {
+      serialize(writer, element);
+    }
+  }
+}
+template<typename Container>
+void deserialize_range(BinaryReader& reader, Container& container) {
+  container.resize(reader.read_size());
+  if constexpr (std::is_trivially_copyable_v<typename Container::value_type>) {
+    reader.read_bytes(container.data(), container.size() * sizeof(typename Container::value_type));
+  } else {
+    for (auto& element : container) {
+      deserialize(reader, element);
+    }
+  }
+}
+
+template<size_t Idx, typename Variant>
+void deserialize_variant_alternative(BinaryReader& reader, size_t index, Variant& value) {
+  if constexpr (Idx < std::variant_size_v<Variant>) {
+    if (index == Idx) {
+      deserialize(reader, value.template emplace<Idx>());
+    } else {
+      deserialize_variant_alternative<Idx + 1>(reader, index, value);
+    }
+  } else {
+    FATAL("Corrupted binary data: bad variant index");
+  }
+}
+}  // namespace internal
+
+template<typename T>
+void serialize(BinaryWriter& writer, const std::vector<T>& value) {
+  internal::serialize_range(writer, value);
+}
+template<typename T>
+void deserialize(BinaryReader& reader, std::vector<T>& value) {
+  internal::deserialize_range(reader, value);
+}
+
+template<typename T, int N>
+void serialize(BinaryWriter& writer, const PVector<T, N>& value) {
+  internal::serialize_range(writer, value);
+}
+template<typename T, int N>
+void deserialize(BinaryReader& reader, PVector<T, N>& value) {
+  internal::deserialize_range(reader, value);
+}
+
+template<typename T, size_t N, std::enable_if_t<!std::is_trivially_copyable_v<T>, int>>
+void serialize(BinaryWriter& writer, const std::array<T, N>& value) {
+  for (const auto& element : value) {
+    serialize(writer, element);
+  }
+}
+template<typename T, size_t N, std::enable_if_t<!std::is_trivially_copyable_v<T>, int>>
+void deserialize(BinaryReader& reader, std::array<T, N>& value) {
+  for (auto& element : value) {
+    deserialize(reader, element);
+  }
+}
+
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::tuple<Ts...>>, int>>
+void serialize(BinaryWriter& writer, const std::tuple<Ts...>& value) {
+  std::apply([&](const auto&... elements) { (serialize(writer, elements), ...); }, value);
+}
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::tuple<Ts...>>, int>>
+void deserialize(BinaryReader& reader, std::tuple<Ts...>& value) {
+  std::apply([&](auto&... elements) { (deserialize(reader, elements), ...); }, value);
+}
+
+template<typename A, typename B, std::enable_if_t<!std::is_trivially_copyable_v<std::pair<A, B>>, int>>
+void serialize(BinaryWriter& writer, const std::pair<A, B>& value) {
+  serialize(writer, value.first);
+  serialize(writer, value.second);
+}
+template<typename A, typename B, std::enable_if_t<!std::is_trivially_copyable_v<std::pair<A, B>>, int>>
+void deserialize(BinaryReader& reader, std::pair<A, B>& value) {
+  deserialize(reader, value.first);
+  deserialize(reader, value.second);
+}
+
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::variant<Ts...>>, int>>
+void serialize(BinaryWriter& writer, const std::variant<Ts...>& value) {
+  writer.write_varint(value.index());
+  std::visit([&](const auto& alternative) { serialize(writer, alternative); }, value);
+}
+template<typename... Ts, std::enable_if_t<!std::is_trivially_copyable_v<std::variant<Ts...>>, int>>
+void deserialize(BinaryReader& reader, std::variant<Ts...>& value) {
+  internal::deserialize_variant_alternative<0>(reader, reader.read_varint(), value);
+}
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "algebra.h"
+#include "cancellation.h"
 #include "util.h"
 #include "shuffle_unrolled.h"
 #include "shuffle_unrolled_multi.h"
@@ -38,6 +39,7 @@ Linear<SimpleLinearParam<MonomT>> shuffle_product(const MonomT& u, const MonomT&
     }
   }
 #endif
+  check_cancellation_periodically();
   const auto a = u.back();
   const auto b = v.back();
   MonomT u_trunc = u;
@@ -0,0 +1,100 @@
+#include "space_cache.h"
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <sstream>
+
+#include "absl/strings/str_cat.h"
+
+#include "check.h"
+#include "fingerprint.h"
+#include "serialization.h"
+#include "string_basic.h"
+#include "util.h"
+
+
+static std::mutex space_cache_dir_mutex;
+static std::optional<std::optional<std::string>> space_cache_dir_override;
+
+std::string to_string(const SpaceCacheKey& key) {
+  return absl::StrCat(
+    key.generator,
+    "(", str_join(key.params, ", "), ", [", str_join(key.points, ","), "])",
+    " prepared with ", key.prepare
+  );
+}
+
+std::string encode_space_cache_key(const SpaceCacheKey& key) {
+  std::string ret;
+  BinaryWriter writer(ret);
+  const auto points = mapped(key.points, [](const X& x) {
+    return std::pair{static_cast<int>(x.form()), x.idx()};
+  });
+  serialize(writer, std::tuple{
+    kSpaceCacheKeyFormat, kSpaceCacheVersion, key.generator, key.params, points, key.prepare
+  });
+  return ret;
+}
+
+std::optional<std::string> space_cache_dir() {
+  std::lock_guard lock(space_cache_dir_mutex);
+  if (space_cache_dir_override.has_value()) {
+    return *space_cache_dir_override;
+  }
+  const char* env_dir = std::getenv("POLYKIT_CACHE_DIR");
+  if (env_dir == nullptr || *env_dir == '\0') {
+    return std::nullopt;
+  }
+  return std::string(env_dir);
+}
+
+void set_space_cache_dir(std::optional<std::string> dir) {
+  std::lock_guard lock(space_cache_dir_mutex);
+  space_cache_dir_override = std::move(dir);
+}
+
+static std::string read_file(const std::string& filename) {
+  std::ifstream fs(filename, std::ios::binary);
+  std::stringstream ss;
+  ss << fs.rdbuf();
+  return ss.str();
+}
+
+std::string cached_matrix_file(
+  const SpaceCacheKey& key,
+  const std::function<void(const std::string&)>& write_matrix_file
+) {
+  namespace fs = std::filesystem;
+  const auto dir = space_cache_dir();
+  CHECK(dir.has_value()) << "Space cache is disabled";
+  const std::string key_str = encode_space_cache_key(key);
+  const Fingerprint128 key_fingerprint = fingerprint(key_str);
+  const fs::path base = fs::path(*dir) / absl::StrCat(
+    absl::Hex(key_fingerprint.hi, absl::kZeroPad16), absl::Hex(key_fingerprint.lo, absl::kZeroPad16)
+  );
+  const std::string matrix_path = base.string() + ".matrix";
+  const std::string key_path = base.string() + ".key";
+
+  if (fs::exists(key_path) && fs::exists(matrix_path)) {
+    CHECK(read_file(key_path) == key_str)
+      << "Space cache fingerprint collision for " << to_string(key) << ": " << key_path;
+    return matrix_path;
+  }
+
+  fs::create_directories(*dir);
+  // Write to temporary files and rename, so that an interrupted run doesn't leave a broken entry.
+  // The key file is renamed last, since it marks the entry as complete.
+  const std::string tmp_suffix = absl::StrCat(".tmp", std::random_device{}());
+  write_matrix_file(matrix_path + tmp_suffix);
+  {
+    std::ofstream key_fs(key_path + tmp_suffix, std::ios::binary | std::ios::trunc);
+    key_fs << key_str;
+    CHECK(key_fs.good()) << "Cannot write " << key_path;
+  }
+  fs::rename(matrix_path + tmp_suffix, matrix_path);
+  fs::rename(key_path + tmp_suffix, key_path);
+  return matrix_path;
+}
@@ -0,0 +1,49 @@
+// On-disk cache for space matrices, so that experiments that reuse the same spaces can skip
+// generating and preparing them.
+//
+// The cache is disabled by default. It is enabled by setting POLYKIT_CACHE_DIR environment
+// variable or by calling `set_space_cache_dir`. Cache entries are content-addressed: the file name
+// is a fingerprint of the encoded key, and the encoded key is stored alongside to guard against
+// collisions. Entries are never evicted; it's safe to delete the directory at any time.
+
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "x.h"
+
+
+// Bump when a change in space generators or prepare functions changes the results.
+constexpr int kSpaceCacheVersion = 1;
+// Bump when `SpaceCacheKey` fields or their encoding change.
+constexpr int kSpaceCacheKeyFormat = 2;
+
+// Fields are encoded separately and prefixed with their sizes, so different keys never share
+// an encoding.
+struct SpaceCacheKey {
+  std::string generator;    // e.g. "CL"
+  std::vector<int> params;  // e.g. {4} for weight 4
+  std::vector<X> points;    // e.g. {1,2,3,4,5,6,7}
+  std::string prepare;      // e.g. "to_lyndon_basis"
+};
+
+std::string to_string(const SpaceCacheKey& key);
+
+// Binary encoding of the key together with `kSpaceCacheKeyFormat` and `kSpaceCacheVersion`.
+// Stable within a platform, so it can be used for addressing files.
+std::string encode_space_cache_key(const SpaceCacheKey& key);
+
+// Returns the cache directory, if caching is enabled.
+std::optional<std::string> space_cache_dir();
+// Overrides POLYKIT_CACHE_DIR. Pass std::nullopt to disable caching.
+void set_space_cache_dir(std::optional<std::string> dir);
+
+// Returns a path to a matrix file (see matrix_file.h) for `key`. If the entry is not in the cache,
+// calls `write_matrix_file(path)` first. Requires caching to be enabled.
+std::string cached_matrix_file(
+  const SpaceCacheKey& key,
+  const std::function<void(const std::string&)>& write_matrix_file
+);
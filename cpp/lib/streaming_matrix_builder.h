@@ -0,0 +1,253 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+
+#include "absl/container/flat_hash_map.h"
+
+#include "expr_matrix_builder.h"
+#include "fingerprint.h"
+#include "matrix_file.h"
+#include "profiler.h"
+#include "util.h"
+
+
+// Out-of-core counterpart of `ExprMatrixBuilder`: rows are spilled to disk as they are added and
+// the matrix is written to a file (see matrix_file.h) rather than returned.
+//
+// Resident memory is: the monom dictionary, a 128-bit fingerprint and a spill location per unique
+// row, a fingerprint and a line index per unique column, row buffers of `chunk_bytes` per shard,
+// and `memory_budget_bytes` for the final transposition (the spill file is re-read once for each
+// slice of columns that fits the budget).
+//
+// Rows and columns are deduplicated by fingerprint. Since contents are not kept in memory, a
+// fingerprint match is confirmed by reading the earlier row (column) back from disk. In the
+// unlikely event of a genuine collision both vectors are kept, but only the first one is indexed,
+// so later copies of the second one may be kept as duplicates. This never changes the rank.
+//
+// `add_expr` is thread-safe. `make_matrix_file` must not be called concurrently with `add_expr`
+// and can be called only once.
+template<typename... ExprTs>
+class StreamingExprMatrixBuilder {
+public:
+  explicit StreamingExprMatrixBuilder(
+    std::string spill_filename,
+    size_t memory_budget_bytes = size_t(1) << 30,
+    size_t chunk_bytes = size_t(1) << 20
+  )
+    : spill_filename_(std::move(spill_filename)),
+      memory_budget_bytes_(memory_budget_bytes),
+      chunk_bytes_(chunk_bytes),
+      spill_fs_(spill_filename_, std::ios::binary | std::ios::trunc) {
+    CHECK(spill_fs_.good()) << "Cannot open " << spill_filename_;
+  }
+  ~StreamingExprMatrixBuilder() {
+    spill_reader_.close();
+    spill_fs_.close();
+    std::remove(spill_filename_.c_str());
+  }
+
+  void add_expr(const std::tuple<ExprTs...>& expressions) {
+    return std::apply(
+      [this](const auto&... args) { return add_expr_impl(args...); },
+      expressions
+    );
+  }
+  void add_expr(const ExprTs&... expressions) {
+    return add_expr_impl(expressions...);
+  }
+
+  // Writes the matrix in CSC layout.
+  void make_matrix_file(const std::string& filename) {
+    PROFILE_SCOPE("make_matrix_file");
+    for (auto& shard : shards_) {
+      flush(shard);
+    }
+    spill_reader_.close();
+    spill_fs_.close();
+    CHECK(!spill_fs_.fail());
+
+    const int num_cols = monoms_.size();
+    const auto col_mapping = monoms_.dense_mapping();
+    std::vector<int64_t> col_sizes(num_cols, 0);
+    int num_rows = 0;
+    for_each_spilled_row([&](const std::vector<MatrixFileElement>& row) {
+      for (const auto& element : row) {
+        ++col_sizes[col_mapping(element.index)];
+      }
+      ++num_rows;
+    });
+
+    MatrixFileWriter writer(filename, MatrixFileLayout::csc);
+    absl::flat_hash_map<Fingerprint128, int> unique_cols;  // fingerprint -> line index
+    int num_lines = 0;
+    const size_t budget_elements = std::max<size_t>(memory_budget_bytes_ / sizeof(MatrixFileElement), 1);
+    int slice_begin = 0;
+    while (slice_begin < num_cols) {
+      int slice_end = slice_begin;
+      size_t slice_elements = 0;
+      while (slice_end < num_cols) {
+        const size_t new_slice_elements = slice_elements + col_sizes[slice_end];
+        if (slice_end > slice_begin && new_slice_elements > budget_elements) {
+          break;
+        }
+        slice_elements = new_slice_elements;
+        ++slice_end;
+      }
+      std::vector<size_t> col_starts(slice_end - slice_begin + 1, 0);
+      for (const int i_col : range(slice_begin, slice_end)) {
+        col_starts[i_col - slice_begin + 1] = col_starts[i_col - slice_begin] + col_sizes[i_col];
+      }
+      std::vector<size_t> col_ends(col_starts.begin(), col_starts.end() - 1);
+      std::vector<MatrixFileElement> col_arena(slice_elements);
+      int i_row = 0;
+      for_each_spilled_row([&](const std::vector<MatrixFileElement>& row) {
+        for (const auto& element : row) {
+          const int i_col = col_mapping(element.index);
+          if (slice_begin <= i_col && i_col < slice_end) {
+            col_arena[col_ends[i_col - slice_begin]++] = {i_row, element.value};
+          }
+        }
+        ++i_row;
+      });
+      for (const int i_local_col : range(slice_end - slice_begin)) {
+        const auto column = absl::MakeConstSpan(
+          col_arena.data() + col_starts[i_local_col],
+          col_starts[i_local_col + 1] - col_starts[i_local_col]
+        );
+        const auto [it, inserted] = unique_cols.try_emplace(fingerprint(column), num_lines);
+        if (inserted || absl::MakeConstSpan(writer.read_line(it->second)) != column) {
+          writer.add_line(column);
+          ++num_lines;
+        }
+      }
+      slice_begin = slice_end;
+    }
+    writer.finish(num_rows);
+  }
+
+private:
+  using KeyT = internal::MatrixKeyT<ExprTs...>;
+
+  // Rows are spilled in chunks: a shard buffer is written out as a whole.
+  struct RowLocation {
+    int chunk = 0;  // index in `Shard::chunk_offsets`; the current buffer if equal to its size
+    size_t offset = 0;  // within the chunk
+  };
+  struct Shard {
+    std::mutex mutex;
+    absl::flat_hash_map<Fingerprint128, RowLocation> row_locations;
+    // Spill file offset of each chunk flushed from this shard.
+    std::vector<uint64_t> chunk_offsets;
+    // Spill format for each row: int32 size, followed by `size` elements.
+    std::vector<char> buffer;
+  };
+  static constexpr int kShardBits = 6;
+
+  static Fingerprint128 fingerprint(absl::Span<const MatrixFileElement> elements) {
+    FingerprintBuilder builder;
+    for (const auto& element : elements) {
+      builder.add(
+        (static_cast<uint64_t>(static_cast<uint32_t>(element.index)) << 32)
+        | static_cast<uint32_t>(element.value)
+      );
+    }
+    return builder.result();
+  }
+
+  void add_expr_impl(const ExprTs&... expressions) {
+    std::vector<MatrixFileElement> row;
+    internal::add_sparse_columns<0>(monoms_, row, expressions...);
+    absl::c_sort(row, [](const auto& a, const auto& b) { return a.index < b.index; });
+    const Fingerprint128 row_fingerprint = fingerprint(row);
+    Shard& shard = shards_[row_fingerprint.hi >> (64 - kShardBits)];
+    std::lock_guard lock(shard.mutex);
+    const RowLocation location{static_cast<int>(shard.chunk_offsets.size()), shard.buffer.size()};
+    const auto [it, inserted] = shard.row_locations.try_emplace(row_fingerprint, location);
+    if (!inserted && read_row(shard, it->second) == row) {
+      return;
+    }
+    const int32_t size = row.size();
+    append_bytes(shard.buffer, &size, sizeof(size));
+    append_bytes(shard.buffer, row.data(), row.size() * sizeof(MatrixFileElement));
+    if (shard.buffer.size() >= chunk_bytes_) {
+      flush(shard);
+    }
+  }
+
+  static void append_bytes(std::vector<char>& buffer, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    buffer.insert(buffer.end(), bytes, bytes + size);
+  }
+
+  // Requires `shard.mutex` to be locked (or no concurrent `add_expr` calls).
+  void flush(Shard& shard) {
+    std::lock_guard lock(spill_mutex_);
+    shard.chunk_offsets.push_back(spill_size_);
+    spill_fs_.write(shard.buffer.data(), shard.buffer.size());
+    CHECK(spill_fs_.good()) << "Cannot write to " << spill_filename_;
+    spill_size_ += shard.buffer.size();
+    shard.buffer.clear();
+  }
+
+  // Requires `shard.mutex` to be locked.
+  std::vector<MatrixFileElement> read_row(const Shard& shard, const RowLocation& location) {
+    int32_t size = 0;
+    std::vector<MatrixFileElement> row;
+    if (location.chunk == shard.chunk_offsets.size()) {
+      const char* data = shard.buffer.data() + location.offset;
+      std::memcpy(&size, data, sizeof(size));
+      row.resize(size);
+      std::memcpy(row.data(), data + sizeof(size), size * sizeof(MatrixFileElement));
+      return row;
+    }
+    std::lock_guard lock(spill_mutex_);
+    spill_fs_.flush();
+    if (!spill_reader_.is_open()) {
+      spill_reader_.open(spill_filename_, std::ios::binary);
+      CHECK(spill_reader_.good()) << "Cannot open " << spill_filename_;
+    }
+    spill_reader_.clear();
+    spill_reader_.seekg(shard.chunk_offsets[location.chunk] + location.offset);
+    spill_reader_.read(reinterpret_cast<char*>(&size), sizeof(size));
+    row.resize(size);
+    spill_reader_.read(reinterpret_cast<char*>(row.data()), size * sizeof(MatrixFileElement));
+    CHECK(spill_reader_.good()) << "Cannot read " << spill_filename_;
+    return row;
+  }
+
+  template<typename F>
+  void for_each_spilled_row(const F& func) const {
+    std::ifstream fs(spill_filename_, std::ios::binary);
+    CHECK(fs.good()) << "Cannot open " << spill_filename_;
+    std::vector<MatrixFileElement> row;
+    int32_t size = 0;
+    while (fs.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+      row.resize(size);
+      CHECK(!!fs.read(reinterpret_cast<char*>(row.data()), size * sizeof(MatrixFileElement)))
+        << "Corrupted spill file: " << spill_filename_;
+      func(row);
+    }
+  }
+
+  std::string spill_filename_;
+  size_t memory_budget_bytes_ = 0;
+  size_t chunk_bytes_ = 0;
+  std::mutex spill_mutex_;
+  std::ofstream spill_fs_;
+  std::ifstream spill_reader_;
+  uint64_t spill_size_ = 0;
+  ConcurrentEnumerator<KeyT> monoms_;
+  std::array<Shard, 1 << kShardBits> shards_;
+};
+
+
+template<typename... Ts>
+struct GetStreamingExprMatrixBuilder { using type = StreamingExprMatrixBuilder<Ts...>; };
+template<typename... Ts>
+struct GetStreamingExprMatrixBuilder<std::tuple<Ts...>> { using type = StreamingExprMatrixBuilder<Ts...>; };
+template<typename... Ts>
+using GetStreamingExprMatrixBuilder_t = typename GetStreamingExprMatrixBuilder<Ts...>::type;
@@ -0,0 +1,205 @@
+#include "thread_pool.h"
+
+#include <cstdlib>
+#include <exception>
+#include <string>
+
+#include "cancellation.h"
+#include "check.h"
+#include "profiler.h"
+#include "progress.h"
+#include "util.h"
+
+
+// Index of the worker running on this thread in the pool it belongs to, or -1.
+static thread_local const ThreadPool* current_pool = nullptr;
+static thread_local int current_worker_index = -1;
+
+std::atomic<void (*)()> internal::thread_pool_chunk_claimed_hook = nullptr;
+
+ThreadPool::ThreadPool(int num_threads) {
+  CHECK_GE(num_threads, 1);
+  for (EACH : range(num_threads - 1)) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (const int i : range(num_threads - 1)) {
+    threads_.emplace_back([this, i]() { worker_loop(i); });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lock(sleep_mutex_);
+    stop_ = true;
+  }
+  wake_up_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void ThreadPool::push(Task task) {
+  const int index = current_pool == this
+    ? current_worker_index
+    : next_external_worker_++ % static_cast<int>(workers_.size());
+  {
+    Worker& worker = *workers_[index];
+    std::lock_guard lock(worker.mutex);
+    worker.tasks.push_back(std::move(task));
+  }
+  {
+    std::lock_guard lock(sleep_mutex_);
+    ++num_queued_;
+  }
+  wake_up_.notify_one();
+}
+
+bool ThreadPool::try_run_one() {
+  const int num_workers = workers_.size();
+  const int self = current_pool == this ? current_worker_index : -1;
+  Task task;
+  for (const int k : range(num_workers)) {
+    const int victim = (std::max(self, 0) + k) % num_workers;
+    Worker& worker = *workers_[victim];
+    std::lock_guard lock(worker.mutex);
+    if (worker.tasks.empty()) {
+      continue;
+    }
+    // Own tasks are taken LIFO for locality, stolen tasks are taken FIFO.
+    if (victim == self) {
+      task = std::move(worker.tasks.back());
+      worker.tasks.pop_back();
+    } else {
+      task = std::move(worker.tasks.front());
+      worker.tasks.pop_front();
+    }
+    break;
+  }
+  if (!task) {
+    return false;
+  }
+  --num_queued_;
+  task();
+  return true;
+}
+
+void ThreadPool::worker_loop(int index) {
+  current_pool = this;
+  current_worker_index = index;
+  while (true) {
+    if (try_run_one()) {
+      continue;
+    }
+    std::unique_lock lock(sleep_mutex_);
+    wake_up_.wait(lock, [this]() { return stop_ || num_queued_ > 0; });
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+void ThreadPool::parallel_for_chunks(int size, int chunk_size, const std::function<void(int, int)>& func) {
+  CHECK_GE(chunk_size, 1);
+  if (size <= 0) {
+    return;
+  }
+  const int num_chunks = div_round_up(size, chunk_size);
+  if (workers_.empty() || num_chunks == 1) {
+    for (int begin = 0; begin < size; begin += chunk_size) {
+      func(begin, std::min(begin + chunk_size, size));
+    }
+    return;
+  }
+
+  // A chunk is counted as done only after it has been claimed, so runners that find no chunks
+  // left never affect the wait condition. After an exception the remaining chunks are still
+  // claimed and counted, but `func` is not called for them.
+  struct State {
+    std::atomic<int> next = 0;
+    std::atomic<int> num_done = 0;
+    std::atomic<bool> failed = false;
+    std::mutex mutex;
+    std::condition_variable all_done;
+    std::exception_ptr error;
+  };
+  const auto state = std::make_shared<State>();
+  ProfileNode* const profile_parent = current_profile_node();
+  ProgressTracker* const progress_parent = current_progress_tracker();
+  const CancellationToken* const cancellation_token = current_cancellation_token();
+  // Note: runners may start after `parallel_for_chunks` has returned. In this case they exit
+  //   without touching `func`, because there are no chunks left.
+  const auto runner = [state, size, chunk_size, num_chunks, profile_parent, progress_parent,
+                       cancellation_token, &func]() {
+    const ScopedProfileParent profile_parent_guard(profile_parent);
+    const ScopedProgressParent progress_parent_guard(progress_parent);
+    const ScopedCancellationToken cancellation_guard(cancellation_token);
+    while (true) {
+      const int begin = state->next.fetch_add(chunk_size);
+      if (const auto hook = internal::thread_pool_chunk_claimed_hook.load()) {
+        hook();
+      }
+      if (begin >= size) {
+        return;
+      }
+      if (!state->failed) {
+        try {
+          func(begin, std::min(begin + chunk_size, size));
+        } catch (...) {
+          std::lock_guard lock(state->mutex);
+          if (!state->error) {
+            state->error = std::current_exception();
+          }
+          state->failed = true;
+        }
+      }
+      if (++state->num_done == num_chunks) {
+        std::lock_guard lock(state->mutex);
+        state->all_done.notify_all();
+      }
+    }
+  };
+  const int num_runners = std::min<int>(num_chunks - 1, workers_.size());
+  for (EACH : range(num_runners)) {
+    push(runner);
+  }
+  runner();
+  // All chunks have been claimed; wait for the ones still running on other threads. Don't run
+  // unrelated tasks meanwhile: one of them could wait for a result that this thread is computing.
+  // Nested loops don't deadlock, because a loop only waits for chunks that have already started.
+  {
+    std::unique_lock lock(state->mutex);
+    state->all_done.wait(lock, [&]() { return state->num_done == num_chunks; });
+  }
+  if (state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+
+static int default_num_threads() {
+  const char* env_value = std::getenv("POLYKIT_NUM_THREADS");
+  if (env_value != nullptr && *env_value != '\0') {
+    const int num_threads = std::stoi(env_value);
+    CHECK_GE(num_threads, 1) << "Invalid POLYKIT_NUM_THREADS: " << env_value;
+    return num_threads;
+  }
+  return std::max<int>(std::thread::hardware_concurrency(), 1);
+}
+
+static std::unique_ptr<ThreadPool>& global_thread_pool_instance() {
+  static std::unique_ptr<ThreadPool> instance = std::make_unique<ThreadPool>(default_num_threads());
+  return instance;
+}
+
+ThreadPool& global_thread_pool() {
+  return *global_thread_pool_instance();
+}
+
+int parallelism_num_threads() {
+  return global_thread_pool().num_threads();
+}
+
+void set_parallelism_num_threads(int num_threads) {
+  CHECK_GE(num_threads, 1);
+  global_thread_pool_instance() = std::make_unique<ThreadPool>(num_threads);
+}
@@ -0,0 +1,72 @@
+// Work-stealing thread pool.
+//
+// Each worker has its own task deque: it takes tasks from the back of its own deque and steals
+// from the front of other deques when idle. A thread that starts a parallel loop processes chunks
+// of that loop until none are left, and then sleeps until chunks taken by other threads are done.
+// It never picks up unrelated tasks while waiting, and a loop only waits for chunks that other
+// threads have already started, so nested loops cannot deadlock. Waiting for a result computed by
+// another task (e.g. in `CallCache::apply_shared`) is safe as long as computing that result does
+// not itself require the waiting task to finish, which would be a deadlock in serial code too.
+//
+// The number of threads is taken from POLYKIT_NUM_THREADS environment variable if set, otherwise
+// from std::thread::hardware_concurrency(). It can be changed via `set_parallelism_num_threads`.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool {
+public:
+  // `num_threads` includes the calling thread, so the pool starts `num_threads - 1` workers.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int num_threads() const { return workers_.size() + 1; }
+
+  // Splits [0, size) into chunks of `chunk_size` and calls `func(begin, end)` for each chunk.
+  // Chunks are distributed dynamically, so uneven chunks are fine. The calling thread participates
+  // in the work, but only in this loop. Blocks until all chunks are processed. If `func` throws,
+  // the remaining chunks are skipped and the first exception is rethrown.
+  void parallel_for_chunks(int size, int chunk_size, const std::function<void(int, int)>& func);
+
+private:
+  using Task = std::function<void()>;
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void push(Task task);
+  bool try_run_one();
+  void worker_loop(int index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::atomic<int> num_queued_ = 0;
+  std::atomic<int> next_external_worker_ = 0;
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_up_;
+  bool stop_ = false;
+};
+
+ThreadPool& global_thread_pool();
+
+int parallelism_num_threads();
+// Must not be called while there are parallel computations in progress.
+void set_parallelism_num_threads(int num_threads);
+
+namespace internal {
+// Called by `parallel_for_chunks` runners each time they claim a chunk index, including the
+// final claim past the end. Exposed for testing: lets tests widen races between runners.
+extern std::atomic<void (*)()> thread_pool_chunk_claimed_hook;
+}  // namespace internal
@@ -0,0 +1,37 @@
+#include "lib/allocation_tracker.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+
+static const AllocationStageStats* find_stage(const AllocationReport& report, const std::string& name) {
+  for (const auto& stage : report.stages) {
+    if (stage.stage == name) {
+      return &stage;
+    }
+  }
+  return nullptr;
+}
+
+TEST(AllocationTrackerTest, StageStats) {
+  const int stage = register_allocation_stage("AllocationTrackerTest;StageStats");
+  internal::track_allocation(stage, 100);
+  internal::track_allocation(stage, 50);
+  internal::track_deallocation(stage, 100);
+  internal::track_allocation(stage, 20);
+
+  const auto report = allocation_report();
+  const auto* stats = find_stage(report, "AllocationTrackerTest;StageStats");
+  ASSERT_NE(stats, nullptr);
+  EXPECT_EQ(stats->num_allocations, 3);
+  EXPECT_EQ(stats->allocated_bytes, 170);
+  EXPECT_EQ(stats->live_bytes, 70);
+  EXPECT_EQ(stats->peak_live_bytes, 150);
+  EXPECT_THAT(to_json(report), testing::HasSubstr(
+    "{\"stage\": \"AllocationTrackerTest;StageStats\", \"allocations\": 3, \"allocated_bytes\": 170, "
+    "\"live_bytes\": 70, \"peak_live_bytes\": 150}"
+  ));
+
+  internal::track_deallocation(stage, 50);
+  internal::track_deallocation(stage, 20);
+}
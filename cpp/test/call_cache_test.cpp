@@ -0,0 +1,162 @@
+#include "lib/call_cache.h"
+
+#include <atomic>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "lib/parallel_util.h"
+#include "lib/thread_pool.h"
+
+
+static CallCacheStats stats_for(const std::string& name) {
+  for (const auto& stats : all_call_cache_stats()) {
+    if (stats.name == name) {
+      return stats;
+    }
+  }
+  return {};
+}
+
+TEST(CallCacheTest, HitsAndMisses) {
+  int num_calls = 0;
+  const auto square = [&](int x) {
+    ++num_calls;
+    return x * x;
+  };
+  CallCache<int, int> cache("test_hits_and_misses");
+  EXPECT_EQ(cache.apply(square, 3), 9);
+  EXPECT_EQ(cache.apply(square, 3), 9);
+  EXPECT_EQ(cache.apply(square, 4), 16);
+  EXPECT_EQ(num_calls, 2);
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.entries, 2);
+}
+
+TEST(CallCacheTest, SharedValueIsNotCopied) {
+  CallCache<std::vector<int>, int> cache("test_shared_value");
+  const auto make = [](int n) { return std::vector<int>(n, 1); };
+  const auto a = cache.apply_shared(make, 5);
+  const auto b = cache.apply_shared(make, 5);
+  EXPECT_EQ(a.get(), b.get());
+}
+
+TEST(CallCacheTest, EvictsLeastRecentlyUsed) {
+  int num_calls = 0;
+  const auto identity = [&](int x) {
+    ++num_calls;
+    return x;
+  };
+  CallCache<int, int> cache("test_lru", {.max_entries = 2});
+  cache.apply(identity, 1);
+  cache.apply(identity, 2);
+  cache.apply(identity, 1);  // 2 is now the least recently used
+  cache.apply(identity, 3);  // evicts 2
+  EXPECT_EQ(num_calls, 3);
+  cache.apply(identity, 1);
+  EXPECT_EQ(num_calls, 3);
+  cache.apply(identity, 2);
+  EXPECT_EQ(num_calls, 4);
+  const auto stats = cache.stats();
+  EXPECT_EQ(stats.entries, 2);
+  EXPECT_EQ(stats.evictions, 2);
+}
+
+TEST(CallCacheTest, BoundedByBytes) {
+  CallCache<std::string, int> cache(
+    "test_bytes", {.max_bytes = 10}, [](const std::string& s) -> int64_t { return s.size(); }
+  );
+  const auto make = [](int n) { return std::string(n, 'a'); };
+  cache.apply(make, 4);
+  cache.apply(make, 5);
+  EXPECT_EQ(cache.stats().bytes, 9);
+  cache.apply(make, 6);
+  EXPECT_EQ(cache.stats().bytes, 6);
+  EXPECT_EQ(cache.stats().entries, 1);
+}
+
+TEST(CallCacheTest, ExceptionIsNotCached) {
+  int num_calls = 0;
+  const auto fail_once = [&](int x) {
+    if (num_calls++ == 0) {
+      throw std::runtime_error("failure");
+    }
+    return x;
+  };
+  CallCache<int, int> cache("test_exception");
+  EXPECT_THROW(cache.apply(fail_once, 1), std::runtime_error);
+  EXPECT_EQ(cache.apply(fail_once, 1), 1);
+  EXPECT_EQ(cache.stats().entries, 1);
+}
+
+TEST(CallCacheTest, ConcurrentCallsComputeOnce) {
+  std::atomic<int> num_calls = 0;
+  CallCache<int, int> cache("test_concurrent");
+  const auto results = parallel_map(to_vector(range(1000)), [&](int i) {
+    return cache.apply([&](int x) {
+      ++num_calls;
+      return x * 10;
+    }, i % 10);
+  }, 1);
+  for (const int i : range(1000)) {
+    EXPECT_EQ(results[i], i % 10 * 10);
+  }
+  EXPECT_EQ(num_calls, 10);
+}
+
+// Values are computed with a nested parallel loop while other chunks of the outer loop wait for
+// them. Used to deadlock when a waiting thread picked up a chunk requesting the value it was
+// computing.
+TEST(CallCacheTest, ApplySharedInsideParallelLoop) {
+  ThreadPool pool(4);
+  std::atomic<int> num_calls = 0;
+  CallCache<int, int> cache("test_inside_parallel_loop");
+  const auto compute = [&](int x) {
+    ++num_calls;
+    std::atomic<int> sum = 0;
+    pool.parallel_for_chunks(100, 1, [&](int begin, int end) {
+      for (int i = begin; i < end; ++i) {
+        EXPECT_EQ(cache.apply([](int y) { return y; }, 1000 + i % 7), 1000 + i % 7);
+        sum += x;
+      }
+    });
+    return sum.load();
+  };
+  std::vector<int> results(200);
+  pool.parallel_for_chunks(results.size(), 1, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      results[i] = *cache.apply_shared(compute, i % 5);
+    }
+  });
+  for (const int i : range(results.size())) {
+    EXPECT_EQ(results[i], i % 5 * 100);
+  }
+  EXPECT_EQ(num_calls, 5);
+}
+
+TEST(CallCacheTest, ReentrantCallComputesDirectly) {
+  CallCache<int, int> cache("test_reentrant");
+  int depth = 0;
+  const std::function<int(int)> func = [&](int x) {
+    if (++depth == 1) {
+      return cache.apply(func, x) + 1;
+    }
+    return x;
+  };
+  EXPECT_EQ(cache.apply(func, 10), 11);
+  EXPECT_EQ(cache.apply(func, 10), 11);
+}
+
+TEST(CallCacheTest, Registry) {
+  CallCache<int, int, int> cache("test_registry");
+  cache.apply([](int a, int b) { return a + b; }, 1, 2);
+  EXPECT_EQ(stats_for("test_registry").entries, 1);
+  clear_all_call_caches();
+  EXPECT_EQ(stats_for("test_registry").entries, 0);
+  EXPECT_EQ(stats_for("test_registry").misses, 1);
+}
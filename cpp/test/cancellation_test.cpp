@@ -0,0 +1,99 @@
+#include "lib/cancellation.h"
+
+#include <atomic>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "lib/lyndon.h"
+#include "lib/parallel_util.h"
+#include "lib/polylog_qli.h"
+
+
+TEST(CancellationTest, NoToken) {
+  EXPECT_EQ(current_cancellation_token(), nullptr);
+  EXPECT_NO_THROW(check_cancellation());
+  EXPECT_NO_THROW(check_cancellation_periodically());
+}
+
+TEST(CancellationTest, Cancel) {
+  CancellationToken token;
+  ScopedCancellationToken cancellation_guard(&token);
+  EXPECT_NO_THROW(check_cancellation());
+  token.cancel();
+  EXPECT_THROW(check_cancellation(), OperationCancelled);
+  EXPECT_THROW(check_cancellation_periodically(), OperationCancelled);
+}
+
+TEST(CancellationTest, ScopeRestoresPreviousToken) {
+  CancellationToken outer;
+  CancellationToken inner;
+  ScopedCancellationToken outer_guard(&outer);
+  {
+    ScopedCancellationToken inner_guard(&inner);
+    EXPECT_EQ(current_cancellation_token(), &inner);
+  }
+  EXPECT_EQ(current_cancellation_token(), &outer);
+}
+
+TEST(CancellationTest, Deadline) {
+  CancellationToken token;
+  token.set_timeout(-1);
+  ScopedCancellationToken cancellation_guard(&token);
+  EXPECT_THROW(check_cancellation(), DeadlineExceeded);
+}
+
+TEST(CancellationTest, MemoryBudget) {
+  CancellationToken token;
+  token.set_memory_budget_bytes(1);
+  ScopedCancellationToken cancellation_guard(&token);
+  EXPECT_THROW(check_cancellation(), MemoryBudgetExceeded);
+  // Stays exceeded without resampling.
+  EXPECT_THROW(check_cancellation(), MemoryBudgetExceeded);
+}
+
+TEST(CancellationTest, GenerousLimits) {
+  CancellationToken token;
+  token.set_timeout(3600);
+  token.set_memory_budget_bytes(int64_t(1) << 50);
+  ScopedCancellationToken cancellation_guard(&token);
+  const auto expr = QLiVec(4, {1, 2, 3, 4, 5, 6});
+  EXPECT_EQ(to_lyndon_basis(expr).num_terms(), [&]() {
+    ScopedCancellationToken no_token(nullptr);
+    return to_lyndon_basis(expr).num_terms();
+  }());
+}
+
+TEST(CancellationTest, LyndonBasis) {
+  CancellationToken token;
+  token.cancel();
+  ScopedCancellationToken cancellation_guard(&token);
+  EXPECT_THROW(to_lyndon_basis(QLiVec(4, {1, 2, 3, 4, 5, 6})), OperationCancelled);
+}
+
+TEST(CancellationTest, PropagatesToParallelTasks) {
+  CancellationToken token;
+  ScopedCancellationToken cancellation_guard(&token);
+  std::atomic<int> tasks_with_token = 0;
+  parallel_for(100, [&](int) {
+    if (current_cancellation_token() == &token) {
+      ++tasks_with_token;
+    }
+  }, 1);
+  EXPECT_EQ(tasks_with_token, 100);
+}
+
+TEST(CancellationTest, StopsParallelTasks) {
+  CancellationToken token;
+  ScopedCancellationToken cancellation_guard(&token);
+  std::atomic<int> tasks_started = 0;
+  EXPECT_THROW(
+    parallel_for(10000, [&](int) {
+      ++tasks_started;
+      token.cancel();
+      check_cancellation();
+    }, 1),
+    OperationCancelled
+  );
+  EXPECT_LT(tasks_started, 10000);
+}
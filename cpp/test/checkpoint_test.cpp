@@ -0,0 +1,112 @@
+#include "lib/checkpoint.h"
+
+#include <atomic>
+#include <filesystem>
+#include <stdexcept>
+
+#include "gtest/gtest.h"
+
+#include "lib/delta.h"
+#include "lib/lyndon.h"
+#include "lib/polylog_space.h"
+#include "test_util/matchers.h"
+
+
+static std::string temp_path(const std::string& name) {
+  const std::string path = ::testing::TempDir() + "/checkpoint_test_" + name;
+  std::filesystem::remove(path);
+  return path;
+}
+
+TEST(CheckpointTest, SumResumesAfterFailure) {
+  const std::string path = temp_path("sum");
+  const auto term = [](int i) { return D(1 + i % 4, 5 + i / 4); };
+  DeltaExpr expected;
+  for (const int i : range(20)) {
+    expected += term(i);
+  }
+  {
+    SnapshotCheckpoint checkpoint(path, "sum", 0);
+    EXPECT_THROW(checkpointed_sum<DeltaExpr>(checkpoint, 20, [&](int i) -> DeltaExpr {
+      if (i == 12) {
+        throw std::runtime_error("crash");
+      }
+      return term(i);
+    }), std::runtime_error);
+  }
+  ASSERT_TRUE(std::filesystem::exists(path));
+  std::atomic<int> num_calls = 0;
+  SnapshotCheckpoint checkpoint(path, "sum", 0);
+  const auto sum = checkpointed_sum<DeltaExpr>(checkpoint, 20, [&](int i) {
+    ++num_calls;
+    return term(i);
+  });
+  EXPECT_EXPR_EQ(sum, expected);
+  EXPECT_LT(num_calls, 20);
+  EXPECT_FALSE(std::filesystem::exists(path));
+}
+
+TEST(CheckpointTest, SnapshotKeyMismatch) {
+  const std::string path = temp_path("key");
+  SnapshotCheckpoint checkpoint(path, "a");
+  checkpoint.save([](BinaryWriter& writer) { writer.write_pod(1); });
+  SnapshotCheckpoint other(path, "b");
+  EXPECT_DEATH(other.load([](BinaryReader&) {}), "different computation");
+  checkpoint.remove();
+}
+
+TEST(CheckpointTest, JournalDropsTruncatedRecord) {
+  const std::string path = temp_path("journal");
+  {
+    JournalCheckpoint journal(path, "journal");
+    EXPECT_EQ(journal.replay([](BinaryReader&) {}), 0);
+    for (const int i : range(3)) {
+      journal.append([&](BinaryWriter& writer) { serialize(writer, std::string(10, 'a' + i)); });
+    }
+  }
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 5);
+  std::vector<std::string> records;
+  {
+    JournalCheckpoint journal(path, "journal");
+    EXPECT_EQ(journal.replay([&](BinaryReader& reader) {
+      deserialize(reader, records.emplace_back());
+    }), 2);
+    journal.append([&](BinaryWriter& writer) { serialize(writer, std::string("d")); });
+  }
+  EXPECT_EQ(records, (std::vector<std::string>{std::string(10, 'a'), std::string(10, 'b')}));
+  records.clear();
+  JournalCheckpoint journal(path, "journal");
+  EXPECT_EQ(journal.replay([&](BinaryReader& reader) {
+    deserialize(reader, records.emplace_back());
+  }), 3);
+  EXPECT_EQ(records.back(), "d");
+  journal.remove();
+}
+
+TEST(CheckpointTest, SpaceMatrixResumes) {
+  const std::string path = temp_path("space");
+  const auto space = CB2(to_vector(range_incl(1, 7)));
+  const auto prepare = DISAMBIGUATE(to_lyndon_basis);
+  using ExprT = std::invoke_result_t<decltype(prepare), PolylogSpace::value_type>;
+  {
+    std::atomic<int> num_prepared = 0;
+    GetExprMatrixBuilder_t<ExprT> matrix_builder;
+    JournalCheckpoint journal(path, "CB2(7)");
+    EXPECT_THROW(add_space_to_matrix_builder(space, [&](const auto& expr) {
+      if (++num_prepared > 10) {
+        throw std::runtime_error("crash");
+      }
+      return prepare(expr);
+    }, matrix_builder, journal), std::runtime_error);
+  }
+  std::atomic<int> num_prepared = 0;
+  GetExprMatrixBuilder_t<ExprT> matrix_builder;
+  JournalCheckpoint journal(path, "CB2(7)");
+  add_space_to_matrix_builder(space, [&](const auto& expr) {
+    ++num_prepared;
+    return prepare(expr);
+  }, matrix_builder, journal);
+  EXPECT_EQ(matrix_rank(matrix_builder.make_matrix()), 20);
+  EXPECT_LT(num_prepared, space.size());
+  journal.remove();
+}
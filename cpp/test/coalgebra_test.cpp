@@ -7,8 +7,11 @@
 
 #include "gtest/gtest.h"
 
+#include "lib/gamma.h"
 #include "lib/iterated_integral.h"
+#include "lib/polylog_grqli.h"
 #include "lib/polylog_li.h"
+#include "lib/polylog_qli.h"
 #include "test_util/helpers.h"
 #include "test_util/matchers.h"
 
@@ -108,6 +111,48 @@ TEST(NComultiplyTest, IterationGivesZero) {
   )));
 }
 
+TEST(ComultiplyTest, KeySpaceMatchesObjectSpace) {
+  const DeltaExpr delta_expr = QLi6(1,2,3,4,5,6);
+  for (const std::vector<int>& form : std::vector<std::vector<int>>{{1,5}, {2,4}, {3,3}, {2,2,2}}) {
+    EXPECT_EXPR_EQ(
+      internal::icomultiply_impl_keys<DeltaICoExpr>(delta_expr, form),
+      internal::icomultiply_impl_objects<DeltaICoExpr>(delta_expr, form)
+    );
+  }
+  const GammaExpr gamma_expr = GrQLi3(5)(1,2,3,4);
+  for (const std::vector<int>& form : std::vector<std::vector<int>>{{1,2}}) {
+    EXPECT_EXPR_EQ(
+      internal::icomultiply_impl_keys<GammaICoExpr>(gamma_expr, form),
+      internal::icomultiply_impl_objects<GammaICoExpr>(gamma_expr, form)
+    );
+  }
+}
+
+TEST(NComultiplyTest, KeySpaceMatchesObjectSpace) {
+  const DeltaNCoExpr delta_coexpr = ncoproduct(QLi2(1,2,3,4), QLi3(1,2,3,4,5,6));
+  const auto gamma_word = [](const std::vector<std::vector<int>>& letters) {
+    return tensor_product(absl::MakeConstSpan(mapped(letters, [](const auto& l) { return G(l); })));
+  };
+  const GammaNCoExpr gamma_coexpr = ncoproduct(
+    gamma_word({{1,2}, {2,3}}),
+    gamma_word({{1,3}, {3,4}}) - gamma_word({{2,4}, {1,4}})
+  );
+  for (const std::vector<int>& form : std::vector<std::vector<int>>{{}, {1,1,3}, {1,2,2}, {3,1,1}}) {
+    EXPECT_EXPR_EQ(
+      internal::ncomultiply_impl_keys(delta_coexpr, sorted(form)),
+      internal::ncomultiply_impl_objects(delta_coexpr, sorted(form))
+    );
+  }
+  for (const std::vector<int>& form : std::vector<std::vector<int>>{{}, {1,1,2}}) {
+    EXPECT_EXPR_EQ(
+      internal::ncomultiply_impl_keys(gamma_coexpr, form),
+      internal::ncomultiply_impl_objects(gamma_coexpr, form)
+    );
+  }
+  EXPECT_FALSE(ncomultiply(delta_coexpr, {1,2,2}).is_zero());
+  EXPECT_FALSE(ncomultiply(gamma_coexpr, {1,1,2}).is_zero());
+}
+
 TEST(CoalgebraUtilTest, FilterCoExpr) {
   EXPECT_EXPR_EQ(
     filter_coexpr_predicate(
@@ -2,9 +2,28 @@
 
 #include "gtest/gtest.h"
 
+#include "lib/itertools.h"
 #include "test_util/matchers.h"
 
 
+static bool between(int point, std::pair<int, int> segment) {
+  const auto [a, b] = segment;
+  return a < point && point < b;
+}
+
+static bool are_weakly_separated_naive(const Delta& d1, const Delta& d2) {
+  const int x1 = d1.a().as_simple_var();
+  const int y1 = d1.b().as_simple_var();
+  const int x2 = d2.a().as_simple_var();
+  const int y2 = d2.b().as_simple_var();
+  if (!all_unique_unsorted(std::array{x1, y1, x2, y2})) {
+    return true;
+  }
+  const bool itersect = between(x1, {x2, y2}) != between(y1, {x2, y2});
+  return !itersect;
+}
+
+
 TEST(DeltaExprTest, SubstituteVariables) {
   const auto expr =
     +  D(x1, x2)
@@ -39,3 +58,38 @@ TEST(DeltaExprTest, SubstituteVariables) {
     -  D(x1, Zero)
   );
 }
+
+TEST(DeltaExprTest, WeaklySeparatedGolden) {
+  EXPECT_TRUE(are_weakly_separated(Delta(x1, x2), Delta(x1, x2)));
+  EXPECT_TRUE(are_weakly_separated(Delta(x1, x3), Delta(x2, x3)));
+  EXPECT_TRUE(are_weakly_separated(Delta(x1, x2), Delta(x3, x4)));
+  EXPECT_TRUE(are_weakly_separated(Delta(x1, x4), Delta(x2, x3)));
+  EXPECT_FALSE(are_weakly_separated(Delta(x1, x3), Delta(x2, x4)));
+  EXPECT_FALSE(are_weakly_separated(Delta(x2, x5), Delta(x4, x1)));
+}
+
+TEST(DeltaExprTest, WeaklySeparatedAgainstNaive) {
+  std::vector<Delta> deltas;
+  for (const auto& points : combinations(to_vector(range_incl(1, 8)), 2)) {
+    deltas.push_back(Delta(X(points[0]), X(points[1])));
+  }
+  for (const Delta& d1 : deltas) {
+    for (const Delta& d2 : deltas) {
+      EXPECT_EQ(are_weakly_separated(d1, d2), are_weakly_separated_naive(d1, d2))
+          << to_string(d1) << " vs " << to_string(d2);
+    }
+  }
+}
+
+TEST(DeltaExprTest, TermWeaklySeparated) {
+  EXPECT_TRUE(is_weakly_separated(DeltaExpr::ObjectT{Delta(x1, x2), Delta(x1, x3), Delta(x1, x4)}));
+  EXPECT_FALSE(is_weakly_separated(DeltaExpr::ObjectT{Delta(x1, x2), Delta(x1, x3), Delta(x2, x4)}));
+  EXPECT_FALSE(is_weakly_separated(DeltaNCoExpr::ObjectT{{Delta(x1, x3)}, {Delta(x1, x2), Delta(x2, x4)}}));
+  EXPECT_EXPR_EQ(
+    keep_non_weakly_separated(
+      + tensor_product(D(x1, x2), D(x1, x3))
+      + tensor_product(D(x1, x3), D(x2, x4))
+    ),
+    + tensor_product(D(x1, x3), D(x2, x4))
+  );
+}
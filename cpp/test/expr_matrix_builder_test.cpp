@@ -3,6 +3,8 @@
 #include "gtest/gtest.h"
 
 #include "lib/itertools.h"
+#include "lib/parallel_util.h"
+#include "lib/streaming_matrix_builder.h"
 #include "test_util/helpers.h"
 #include "test_util/matchers.h"
 
@@ -157,3 +159,108 @@ TEST(ExprMatrixBuilderTest, MixedTypes) {
     })
   );
 }
+
+TEST(ExprMatrixBuilderTest, ConcurrentAdd) {
+  std::vector<int> seeds;
+  for (const int i : range(1000)) {
+    seeds.push_back(i % 250);
+  }
+  ExprMatrixBuilder<SimpleVectorExpr> matrix_builder;
+  for_each_parallel(seeds, [&](const int x) {
+    matrix_builder.add_expr(SV({x}) + 2 * SV({x, x + 1}));
+  });
+  const Matrix m = matrix_builder.make_matrix();
+  EXPECT_EQ(m.rows(), 250);
+  EXPECT_EQ(m.cols(), 500);
+  EXPECT_EQ(m.as_triplets().size(), 500);
+}
+
+TEST(ExprMatrixBuilderTest, LayoutDoesNotDependOnInsertionOrder) {
+  std::vector<SimpleVectorExpr> exprs;
+  for (const int x : range(200)) {
+    exprs.push_back(SV({x % 17}) - 3 * SV({x, x % 5}) + SV({x % 11, 1}));
+  }
+  const auto build = [&](const std::vector<SimpleVectorExpr>& src, bool parallel) {
+    ExprMatrixBuilder<SimpleVectorExpr> matrix_builder(MatrixDedupe::up_to_scale);
+    if (parallel) {
+      for_each_parallel(src, [&](const auto& expr) { matrix_builder.add_expr(expr); });
+    } else {
+      for (const auto& expr : src) {
+        matrix_builder.add_expr(expr);
+      }
+    }
+    return matrix_builder.make_matrix().as_triplets();
+  };
+  const auto expected = build(exprs, false);
+  auto reversed = exprs;
+  absl::c_reverse(reversed);
+  EXPECT_EQ(build(reversed, false), expected);
+  EXPECT_EQ(build(exprs, true), expected);
+}
+
+TEST(ExprMatrixBuilderTest, DedupeUpToScale) {
+  ExprMatrixBuilder<SimpleVectorExpr> matrix_builder(MatrixDedupe::up_to_scale);
+  matrix_builder.add_expr( SV({1}) + 2 * SV({2}) + SV({3}));
+  matrix_builder.add_expr(-3 * SV({1}) - 6 * SV({2}) - 3 * SV({3}));
+  matrix_builder.add_expr( 2 * SV({1}) + 2 * SV({3}));
+  EXPECT_MATRIX_EQ_MODULO_REARRANGEMENT(
+    matrix_builder.make_matrix(),
+    matrix({
+      {1,  1},
+      {1,  0},
+    })
+  );
+}
+
+TEST(ExprMatrixBuilderTest, Streaming) {
+  const std::string filename = ::testing::TempDir() + "/expr_matrix_builder_test.bin";
+  // Tiny budget and chunk size: each column is transposed separately and each row is flushed.
+  StreamingExprMatrixBuilder<SimpleVectorExpr, StringExpr> matrix_builder(filename + ".rows", 1, 1);
+  matrix_builder.add_expr(SV({1}),  SS({"2"}));
+  matrix_builder.add_expr(SV({2}),  SS({"4"}));
+  matrix_builder.add_expr(SV({3}), -SS({"4"}));
+  matrix_builder.add_expr(SV({2}),  SS({"4"}));
+  matrix_builder.make_matrix_file(filename);
+  EXPECT_MATRIX_EQ_MODULO_REARRANGEMENT(
+    MappedMatrixFile(filename).to_matrix(),
+    matrix({
+      {1,  0,  0,  0},
+      {0,  1,  0,  1},
+      {0,  0,  1, -1},
+    })
+  );
+}
+
+TEST(ExprMatrixBuilderTest, StreamingDedupeReadsBack) {
+  const std::string filename = ::testing::TempDir() + "/expr_matrix_builder_test.bin";
+  StreamingExprMatrixBuilder<SimpleVectorExpr, StringExpr> matrix_builder(filename + ".rows", 1, 1);
+  matrix_builder.add_expr(SV({1}), SS({"1"}));
+  matrix_builder.add_expr(SV({2}), SS({"2"}) + SS({"3"}));
+  matrix_builder.add_expr(SV({1}), SS({"1"}));
+  matrix_builder.add_expr(SV({2}), SS({"2"}) + SS({"3"}));
+  matrix_builder.make_matrix_file(filename);
+  EXPECT_MATRIX_EQ_MODULO_REARRANGEMENT(
+    MappedMatrixFile(filename).to_matrix(),
+    matrix({
+      {1,  0},
+      {0,  1},
+    })
+  );
+}
+
+TEST(ExprMatrixBuilderTest, BlocksByGrading) {
+  ExprMatrixBuilder<SimpleVectorExpr> matrix_builder;
+  matrix_builder.add_expr(SV({1, 2}) + SV({2, 1}));
+  matrix_builder.add_expr(SV({1, 2}) - SV({2, 1}));
+  matrix_builder.add_expr(SV({3}) + SV({4, 4}));
+  matrix_builder.add_expr(SV({3}));
+  matrix_builder.add_expr(SV({5}));
+  const auto blocks = matrix_builder.make_matrix_blocks([](const std::vector<int>& monom) {
+    return sorted(monom);
+  });
+  ASSERT_EQ(blocks.size(), 3);
+  const auto block_sizes = sorted(mapped(blocks, [](const Matrix& block) {
+    return std::pair{block.rows(), block.cols()};
+  }));
+  EXPECT_EQ(block_sizes, (std::vector<std::pair<int, int>>{{1, 1}, {2, 2}, {2, 2}}));
+}
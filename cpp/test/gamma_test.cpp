@@ -39,6 +39,20 @@ static GammaExpr pullback_naive(const GammaExpr& expr, const std::vector<int>& b
   });
 }
 
+static GammaExpr substitute_variables_naive(const GammaExpr& expr, const std::vector<int>& new_points) {
+  return expr.mapped_expanding([&](const auto& term) -> GammaExpr {
+    std::vector<Gamma> new_term;
+    for (const Gamma& g : term) {
+      const Gamma new_g(mapped(g.index_vector(), [&](const int idx) { return new_points.at(idx - 1); }));
+      if (new_g.is_nil()) {
+        return {};
+      }
+      new_term.push_back(new_g);
+    }
+    return GammaExpr::single(new_term);
+  }).without_annotations();
+}
+
 static GammaExpr plucker_dual_naive(const GammaExpr& expr, const std::vector<int>& point_universe) {
   return expr.mapped([&](const auto& term) {
     return mapped(term, [&](const Gamma& g_src) {
@@ -61,6 +75,33 @@ TEST(GammaTest, SubstituteVariables) {
   );
 }
 
+TEST(GammaTest, SubstituteVariablesAgainstNaive) {
+  const auto expr =
+    + tensor_product(G({1,2,9}), G({3,10,12}))
+    - tensor_product(G({4,11,16}), G({1,8,9}))
+    + tensor_product(G({2,3,4}), G({5,6,7}))
+  ;
+  const std::vector<std::vector<int>> substitutions = {
+    {16,15,14,13,12,11,10,9,8,7,6,5,4,3,2,1},
+    {1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16},
+    {2,1,4,4,5,6,7,8,9,10,11,12,13,14,15,16},
+    {1,1,1,1,1,1,1,1,9,9,9,9,9,9,9,9},
+  };
+  for (const auto& new_points : substitutions) {
+    EXPECT_EXPR_EQ(substitute_variables(expr, new_points), substitute_variables_naive(expr, new_points));
+  }
+}
+
+TEST(GammaTest, ProjectOn) {
+  EXPECT_EXPR_EQ(
+    project_on(2,
+      + tensor_product(G({1,2,3}), G({2,4,9}))
+      + tensor_product(G({1,2,3}), G({1,4,9}))
+    ),
+    + tensor_product(G({1,3}), G({4,9}))
+  );
+}
+
 TEST(GammaTest, WeaklySeparatedGolden) {
   using v = std::vector<int>;
   EXPECT_TRUE(are_weakly_separated(Gamma(v{}), Gamma(v{})));
@@ -75,7 +116,7 @@ TEST(GammaTest, WeaklySeparatedGolden) {
 }
 
 TEST(GammaTest, WeaklySeparatedAgainstNaive) {
-  const int n = 32;
+  const int n = 256;
   for (const int b1 : range(n)) {
     for (const int b2 : range(n)) {
       Gamma g1{Gamma::BitsetT(b1)};
@@ -86,6 +127,25 @@ TEST(GammaTest, WeaklySeparatedAgainstNaive) {
   }
 }
 
+TEST(GammaTest, TermWeaklySeparatedAgainstPairwise) {
+  const std::vector<Gamma> gammas = mapped(combinations(to_vector(range_incl(1, 6)), 3), [](const auto& points) {
+    return Gamma(points);
+  });
+  for (const auto& term : combinations(gammas, 3)) {
+    bool expected = true;
+    for (const int i : range(term.size())) {
+      for (const int j : range(i)) {
+        expected = expected && are_weakly_separated_naive(term[i], term[j]);
+      }
+    }
+    EXPECT_EQ(is_weakly_separated(term), expected) << dump_to_string(term);
+    const GammaNCoExpr::ObjectT coterm = {{term[0]}, {term[1], term[2]}};
+    EXPECT_EQ(is_weakly_separated(coterm), expected) << dump_to_string(term);
+  }
+  EXPECT_TRUE(is_totally_weakly_separated(tensor_product(G({1,2,3}), G({1,2,4}))));
+  EXPECT_FALSE(is_totally_weakly_separated(tensor_product(G({1,2,3}), G({1,2,4})) + tensor_product(G({1,3,5}), G({2,4,6}))));
+}
+
 TEST(GammaTest, PullbackAgainstNaive) {
   const std::vector bonus_points = {2};
   const auto expr = tensor_product(G({1,3,4}), G({3,4,5}));
@@ -109,3 +109,16 @@ TEST(MatrixTest, ToStringAllOverflow) {
  0  0  0  0  0  0  0  .  .  .  0  0  0  0  0 20
 )"));
 }
+
+TEST(MatrixTest, BlocksRank) {
+  Matrix a;
+  a.insert(0, 0) = 1;
+  a.insert(0, 1) = 2;
+  a.insert(1, 0) = 2;
+  a.insert(1, 1) = 4;
+  Matrix b;
+  b.insert(0, 0) = 3;
+  b.insert(1, 1) = -1;
+  b.insert(2, 0) = 1;
+  EXPECT_EQ(matrix_blocks_rank({a, b, Matrix()}), 3);
+}
@@ -0,0 +1,78 @@
+#include "lib/linear_file.h"
+
+#include <cstring>
+#include <filesystem>
+
+#include "gtest/gtest.h"
+
+#include "lib/delta.h"
+#include "lib/gamma.h"
+#include "test_util/matchers.h"
+
+
+TEST(LinearFileTest, RoundTrip) {
+  const DeltaExpr expr = D(1, 2) - 3 * tensor_product(D(2, 4), D(1, 3)) + 200 * D(5, 6) - 70000 * D(1, 6);
+  EXPECT_EXPR_EQ(linear_from_bytes<DeltaExpr>(linear_to_bytes(expr)), expr);
+  EXPECT_EXPR_EQ(linear_from_bytes<DeltaExpr>(linear_to_bytes(DeltaExpr())), DeltaExpr());
+}
+
+TEST(LinearFileTest, Annotations) {
+  const GammaExpr expr = (G({1, 2, 3}) + G({2, 3, 4})).annotate("foo");
+  const GammaExpr loaded = linear_from_bytes<GammaExpr>(linear_to_bytes(expr));
+  EXPECT_EXPR_EQ(loaded, expr);
+  EXPECT_EQ(loaded.annotations().expression, expr.annotations().expression);
+}
+
+TEST(LinearFileTest, FrozenLookup) {
+  DeltaExpr expr;
+  for (const int a : range_incl(1, 5)) {
+    for (const int b : range_incl(6, 9)) {
+      expr += (a * 10 + b) * tensor_product(D(a, b), D(b, a + 1));
+    }
+  }
+  const std::string bytes = linear_to_bytes(expr);
+  const FrozenLinear<DeltaExpr::Param> frozen(bytes.data(), bytes.size());
+  EXPECT_EQ(frozen.num_terms(), expr.num_terms());
+  expr.foreach([&](const auto& term, int coeff) {
+    EXPECT_EQ(frozen[term], coeff);
+  });
+  EXPECT_EQ(frozen[DeltaExpr::ObjectT{Delta(1, 2)}], 0);
+  DeltaExpr collected;
+  frozen.foreach([&](const auto& term, int coeff) {
+    collected.add_to(term, coeff);
+  });
+  EXPECT_EXPR_EQ(collected, expr);
+}
+
+TEST(LinearFileTest, MappedFile) {
+  const std::string filename = ::testing::TempDir() + "/linear_file_test.bin";
+  const GammaExpr expr = tensor_product(G({1, 2}), G({2, 3})) - tensor_product(G({3, 4}), G({1, 4}));
+  save_linear_file(filename, expr);
+  {
+    const MappedLinearFile<GammaExpr::Param> mapped(filename);
+    EXPECT_EQ(mapped.expr().num_terms(), 2);
+    EXPECT_EXPR_EQ(mapped.expr().to_linear(), expr);
+  }
+  EXPECT_EXPR_EQ(load_linear_file<GammaExpr>(filename), expr);
+  std::filesystem::remove(filename);
+}
+
+TEST(LinearFileTest, TypeMismatchIsFatal) {
+  const std::string bytes = linear_to_bytes(D(1, 2));
+  EXPECT_DEATH(linear_from_bytes<GammaExpr>(bytes), "type mismatch");
+}
+
+TEST(LinearFileTest, CorruptedOffsetsAreFatal) {
+  const std::string bytes = linear_to_bytes(D(1, 2) + D(3, 4));
+  LinearFileHeader header;
+  std::memcpy(&header, bytes.data(), sizeof(header));
+
+  std::string bad_term_start = bytes;
+  const uint64_t huge_offset = uint64_t(1) << 40;
+  std::memcpy(&bad_term_start[header.term_starts_offset + sizeof(uint64_t)], &huge_offset, sizeof(huge_offset));
+  EXPECT_DEATH(linear_from_bytes<DeltaExpr>(bad_term_start), "Corrupted linear expression file");
+
+  std::string bad_key_size = bytes;
+  bad_key_size[header.terms_offset] = 0x7f;
+  EXPECT_DEATH(linear_from_bytes<DeltaExpr>(bad_key_size), "Unexpected end of binary data");
+}
@@ -0,0 +1,60 @@
+// Counters are compiled in only if LINEAR_STATS is set. Enable them for this test only: the param
+// type below is local to this file, so other translation units are not affected.
+#define LINEAR_STATS 1
+
+#include "lib/linear.h"
+
+#include <thread>
+
+#include "gtest/gtest.h"
+
+
+struct LinearStatsTestObject {
+  int value = 0;
+  bool operator==(const LinearStatsTestObject& other) const { return value == other.value; }
+  template <typename H>
+  friend H AbslHashValue(H h, const LinearStatsTestObject& obj) {
+    return H::combine(std::move(h), obj.value);
+  }
+};
+
+struct LinearStatsTestParam {
+  using ObjectT = LinearStatsTestObject;
+  using StorageT = int;
+  static ObjectT key_to_object(const StorageT& key) { return {key}; }
+  static StorageT object_to_key(const ObjectT& obj) { return obj.value; }
+};
+
+using LinearStatsTestExpr = BasicLinear<LinearStatsTestParam>;
+
+
+TEST(LinearStatsTest, CountsOperations) {
+  reset_linear_stats();
+  LinearStatsTestExpr expr;
+  for (int i = 0; i < 100; ++i) {
+    expr.add_to(LinearStatsTestObject{i}, 1);
+  }
+  expr.add_to(LinearStatsTestObject{0}, -1);
+  int sum = 0;
+  expr.foreach([&](const LinearStatsTestObject& obj, int) { sum += obj.value; });
+  EXPECT_EQ(sum, 99 * 100 / 2);
+
+  const auto stats = linear_stats().data.at(typeid(LinearStatsTestParam));
+  EXPECT_EQ(stats.num_inserts, 100);
+  EXPECT_EQ(stats.num_erases, 1);
+  EXPECT_GT(stats.num_rehashes, 0);
+  EXPECT_EQ(stats.num_object_to_key, 101);
+  EXPECT_EQ(stats.num_key_to_object, 99);
+}
+
+TEST(LinearStatsTest, AggregatesThreads) {
+  reset_linear_stats();
+  std::thread thread([]() {
+    LinearStatsTestExpr expr;
+    expr.add_to_key(1, 1);
+  });
+  thread.join();
+  LinearStatsTestExpr expr;
+  expr.add_to_key(2, 1);
+  EXPECT_EQ(linear_stats().data.at(typeid(LinearStatsTestParam)).num_inserts, 2);
+}
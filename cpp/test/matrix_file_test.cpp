@@ -0,0 +1,66 @@
+#include "lib/matrix_file.h"
+
+#include "gtest/gtest.h"
+
+
+bool operator==(const Matrix::Triplet& lhs, const Matrix::Triplet& rhs) {
+  return std::tie(lhs.row, lhs.col, lhs.value) == std::tie(rhs.row, rhs.col, rhs.value);
+}
+
+std::vector<Matrix::Triplet> sorted_triplets(const Matrix& matrix) {
+  auto triplets = matrix.as_triplets();
+  absl::c_sort(triplets, [](const auto& a, const auto& b) {
+    return std::tie(a.row, a.col) < std::tie(b.row, b.col);
+  });
+  return triplets;
+}
+
+Matrix example_matrix() {
+  Matrix matrix;
+  matrix.insert(0, 0) = 1;
+  matrix.insert(0, 3) = -2;
+  matrix.insert(2, 1) = 5;
+  matrix.insert(3, 3) = 7;
+  matrix.insert(1, 4) = -1;
+  return matrix;
+}
+
+
+TEST(MatrixFileTest, RoundTrip) {
+  const Matrix matrix = example_matrix();
+  for (const auto layout : {MatrixFileLayout::csr, MatrixFileLayout::csc}) {
+    const std::string filename = ::testing::TempDir() + "/matrix_file_test.bin";
+    save_matrix_file(filename, matrix, layout);
+    const MappedMatrixFile mapped(filename);
+    EXPECT_EQ(mapped.layout(), layout);
+    EXPECT_EQ(mapped.rows(), 4);
+    EXPECT_EQ(mapped.cols(), 5);
+    EXPECT_EQ(mapped.num_elements(), 5);
+    EXPECT_EQ(sorted_triplets(mapped.to_matrix()), sorted_triplets(matrix));
+  }
+}
+
+TEST(MatrixFileTest, Lines) {
+  const std::string filename = ::testing::TempDir() + "/matrix_file_test.bin";
+  save_matrix_file(filename, example_matrix(), MatrixFileLayout::csc);
+  const MappedMatrixFile mapped(filename);
+  ASSERT_EQ(mapped.num_lines(), 5);
+  EXPECT_EQ(mapped.line(2).size(), 0);
+  ASSERT_EQ(mapped.line(3).size(), 2);
+  EXPECT_EQ(mapped.line(3)[0].index, 0);
+  EXPECT_EQ(mapped.line(3)[0].value, -2);
+  EXPECT_EQ(mapped.line(3)[1].index, 3);
+  EXPECT_EQ(mapped.line(3)[1].value, 7);
+}
+
+TEST(MatrixFileTest, Rank) {
+  Matrix matrix = example_matrix();
+  matrix.insert(4, 0) = 2;
+  matrix.insert(4, 3) = -4;
+  for (const auto layout : {MatrixFileLayout::csr, MatrixFileLayout::csc}) {
+    const std::string filename = ::testing::TempDir() + "/matrix_file_test.bin";
+    save_matrix_file(filename, matrix, layout);
+    EXPECT_EQ(matrix_rank(MappedMatrixFile(filename)), 4);
+  }
+  EXPECT_EQ(matrix_rank(matrix), 4);
+}
@@ -1,5 +1,7 @@
 #include "lib/parallel_util.h"
 
+#include <atomic>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -10,3 +12,66 @@ TEST(ParallelUtilTest, MappedParallel) {
     testing::ElementsAre(2, 4, 6, 8, 10, 12, 14, 16)
   );
 }
+
+TEST(ParallelUtilTest, ForEachParallel) {
+  std::vector<std::atomic<int>> counters(8);
+  for_each_parallel(std::vector{0, 1, 2, 3, 4, 5, 6, 7, 3, 5}, [&](int x) { ++counters[x]; });
+  EXPECT_THAT(
+    mapped(counters, [](const auto& c) { return c.load(); }),
+    testing::ElementsAre(1, 1, 1, 2, 1, 2, 1, 1)
+  );
+}
+
+TEST(ParallelUtilTest, ParallelMap) {
+  EXPECT_EQ(
+    parallel_map(to_vector(range(1000)), [](int x) { return x * x; }),
+    mapped(range(1000), [](int x) { return x * x; })
+  );
+}
+
+TEST(ParallelUtilTest, ParallelReduce) {
+  EXPECT_EQ(
+    parallel_reduce(1000, 0L, [](int i) { return long(i); }, std::plus<long>{}),
+    999L * 1000 / 2
+  );
+  EXPECT_EQ(
+    parallel_reduce(10, std::string(), [](int i) { return std::to_string(i); }, std::plus<std::string>{}, 3),
+    "0123456789"
+  );
+}
+
+TEST(ParallelUtilTest, NestedParallelFor) {
+  std::atomic<int> count = 0;
+  parallel_for(16, [&](int) {
+    parallel_for(100, [&](int) { ++count; });
+  });
+  EXPECT_EQ(count, 1600);
+}
+
+TEST(ParallelUtilTest, MappedParallelByCost) {
+  const std::vector src = {3, 1, 4, 1, 5, 9, 2, 6};
+  std::vector<ParallelTaskTiming> timings;
+  EXPECT_EQ(
+    mapped_parallel_by_cost(src, [](int x) { return x + 1; }, [](int x) { return x; }, &timings),
+    mapped(src, [](int x) { return x + 1; })
+  );
+  ASSERT_EQ(timings.size(), src.size());
+  for (const int i : range(src.size())) {
+    EXPECT_EQ(timings[i].index, i);
+    EXPECT_EQ(timings[i].cost, src[i]);
+    EXPECT_GE(timings[i].seconds, 0);
+  }
+}
+
+TEST(ParallelUtilTest, ForEachParallelByCostSingleThreadOrder) {
+  const int old_num_threads = parallelism_num_threads();
+  set_parallelism_num_threads(1);
+  std::vector<int> order;
+  for_each_parallel_by_cost(
+    std::vector{2, 7, 1, 8, 2, 8},
+    [&](int x) { order.push_back(x); },
+    [](int x) { return x; }
+  );
+  EXPECT_THAT(order, testing::ElementsAre(8, 8, 7, 2, 2, 1));
+  set_parallelism_num_threads(old_num_threads);
+}
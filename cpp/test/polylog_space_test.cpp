@@ -4,6 +4,8 @@
 
 #include "lib/polylog_space.h"
 
+#include <filesystem>
+
 #include "gtest/gtest.h"
 
 #include "lib/itertools.h"
@@ -11,6 +13,7 @@
 #include "lib/polylog_grqli.h"
 #include "lib/polylog_qli.h"
 #include "lib/summation.h"
+#include "test_util/matchers.h"
 
 
 template<typename SpaceT, typename PrepareF>
@@ -168,6 +171,138 @@ TEST(PolylogSpaceTest, RankCB2) {
   EXPECT_EQ(simple_space_rank(CB2, 9), 56);
 }
 
+TEST(PolylogSpaceTest, RankCB2Graded) {
+  for (const int num_points : range_incl(6, 8)) {
+    const auto space = CB2(to_vector(range_incl(1, num_points)));
+    EXPECT_EQ(
+      space_rank_graded(space, DISAMBIGUATE(to_lyndon_basis)),
+      space_rank(space, DISAMBIGUATE(to_lyndon_basis))
+    );
+  }
+}
+
+TEST(PolylogSpaceTest, CachedRank) {
+  const std::string cache_dir = ::testing::TempDir() + "/polylog_space_test_cache";
+  std::filesystem::remove_all(cache_dir);
+  set_space_cache_dir(cache_dir);
+  const auto points = to_vector(range_incl(1, 7));
+  const SpaceCacheKey key{"CB", {2}, mapped(points, convert_to<X>), "to_lyndon_basis"};
+  int num_generated = 0;
+  const auto make_space = [&]() {
+    ++num_generated;
+    return CB2(points);
+  };
+  EXPECT_EQ(cached_space_rank(key, make_space, DISAMBIGUATE(to_lyndon_basis)), 20);
+  EXPECT_EQ(cached_space_rank(key, make_space, DISAMBIGUATE(to_lyndon_basis)), 20);
+  EXPECT_EQ(num_generated, 1);
+  set_space_cache_dir(std::nullopt);
+  std::filesystem::remove_all(cache_dir);
+}
+
+template<typename SpaceF>
+void EXPECT_ORBITS_SAME_AS_DIRECT(const SpaceF& make_space) {
+  const auto direct = make_space();
+  const auto orbits = [&]() {
+    ScopedSpaceGenerationMode mode(SpaceGenerationMode::orbits);
+    return make_space();
+  }();
+  ASSERT_EQ(direct.size(), orbits.size());
+  for (const int i : range(direct.size())) {
+    EXPECT_EQ(direct[i], orbits[i]) << annotations_one_liner(direct[i].annotations());
+  }
+}
+
+TEST(PolylogSpaceTest, OrbitGeneration) {
+  const auto points = to_vector(range_incl(1, 7));
+  EXPECT_ORBITS_SAME_AS_DIRECT([&]() { return CB2(points); });
+  EXPECT_ORBITS_SAME_AS_DIRECT([&]() { return CB3(slice(points, 0, 6)); });
+  EXPECT_ORBITS_SAME_AS_DIRECT([&]() { return CL3(slice(points, 0, 6)); });
+  EXPECT_ORBITS_SAME_AS_DIRECT([&]() { return GrL1(3, slice(points, 0, 6)); });
+  EXPECT_ORBITS_SAME_AS_DIRECT([&]() { return GrL2(3, slice(points, 0, 6)); });
+}
+
+TEST(PolylogSpaceTest, ParallelGeneration) {
+  const auto points = to_vector(range_incl(1, 6));
+  const auto direct = CL3(points);
+  ScopedSpaceGenerationMode mode(SpaceGenerationMode::direct_parallel);
+  EXPECT_EQ(CL3(points), direct);
+}
+
+TEST(PolylogSpaceTest, IsotypicProjection) {
+  const auto points = to_vector(range_incl(1, 6));
+  const auto space = CB2(points);
+  for (const auto component : {IsotypicComponent::trivial, IsotypicComponent::sign}) {
+    const auto projected = isotypic_projection(space, PointGroup::dihedral, component, points);
+    for (const auto& [permuted, sign] : point_group_elements(PointGroup::dihedral, points)) {
+      const int factor = component == IsotypicComponent::sign ? sign : 1;
+      for (const auto& expr : projected) {
+        EXPECT_EQ(substitute_variables(expr, permuted), factor * expr);
+      }
+    }
+    EXPECT_LE(
+      space_rank(projected, DISAMBIGUATE(to_lyndon_basis)),
+      space_rank(space, DISAMBIGUATE(to_lyndon_basis))
+    );
+  }
+}
+
+TEST(PolylogSpaceTest, UniqueSpaceElements) {
+  const PolylogSpace space = {
+    QLi2(1,2,3,4),
+    QLi2(1,2,3,5),
+    -QLi2(1,2,3,4),
+    QLi2(1,2,3,5),
+    QLi2(1,2,3,4) - QLi2(1,2,3,4),
+    2 * QLi2(1,2,3,4),
+  };
+  SpaceDedupeStats stats;
+  const auto unique = unique_space_elements(space, &stats);
+  ASSERT_EQ(unique.size(), 3);
+  EXPECT_EQ(unique[0], &space[0]);
+  EXPECT_EQ(unique[1], &space[1]);
+  EXPECT_EQ(unique[2], &space[5]);
+  EXPECT_EQ(stats.total, 6);
+  EXPECT_EQ(stats.zero, 1);
+  EXPECT_EQ(stats.duplicate, 1);
+  EXPECT_EQ(stats.negated, 1);
+}
+
+TEST(PolylogSpaceTest, SpaceContainsSmall) {
+  const auto space = CB2(to_vector(range_incl(1, 6)));
+  EXPECT_TRUE(space_contains(space, {QLi2(2,3,4,5)}, DISAMBIGUATE(to_lyndon_basis)));
+  EXPECT_FALSE(space_contains(space, {QLi3(1,2,3,4)}, DISAMBIGUATE(to_lyndon_basis)));
+}
+
+TEST(PolylogSpaceTest, SpaceComultiply) {
+  const auto space = L3(to_vector(range_incl(1, 5)));
+  const auto icomultiplied = space_icomultiply(space, {1,2});
+  ASSERT_EQ(icomultiplied.size(), space.size());
+  for (const int i : range(space.size())) {
+    EXPECT_EXPR_EQ(icomultiplied[i], icomultiply(space[i], {1,2}));
+  }
+
+  const auto co_space = simple_co_L(4, 2, 5);
+  const auto ncomultiplied = space_ncomultiply(co_space);
+  ASSERT_EQ(ncomultiplied.size(), co_space.size());
+  for (const int i : range(co_space.size())) {
+    EXPECT_EXPR_EQ(ncomultiplied[i], ncomultiply(co_space[i]));
+  }
+  const auto ranks = space_ncomultiply_mapping_ranks(co_space);
+  const auto expected_ranks = space_mapping_ranks(
+    co_space, DISAMBIGUATE(identity_function), DISAMBIGUATE(ncomultiply)
+  );
+  EXPECT_EQ(ranks.space(), expected_ranks.space());
+  EXPECT_EQ(ranks.image(), expected_ranks.image());
+}
+
+TEST(PolylogSpaceTest, SpaceCacheKeyEncoding) {
+  const SpaceCacheKey key{"CB", {2}, {1, 2, 3}, "to_lyndon_basis"};
+  EXPECT_EQ(encode_space_cache_key(key), encode_space_cache_key(key));
+  EXPECT_NE(encode_space_cache_key(key), encode_space_cache_key({"CB2", {}, {1, 2, 3}, "to_lyndon_basis"}));
+  EXPECT_NE(encode_space_cache_key(key), encode_space_cache_key({"CB", {2, 1}, {2, 3}, "to_lyndon_basis"}));
+  EXPECT_NE(encode_space_cache_key(key), encode_space_cache_key({"CB", {2}, {1, 2, X::Inf()}, "to_lyndon_basis"}));
+}
+
 TEST(PolylogSpaceTest, LARGE_RankCB3) {
   // (dim B3, A_{n-3}) in [ref]
   EXPECT_EQ(simple_space_rank(CB3, 6), 15);
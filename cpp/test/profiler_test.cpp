@@ -0,0 +1,53 @@
+#include "lib/profiler.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "lib/parallel_util.h"
+
+
+class HierarchicalProfilerTest : public testing::Test {
+protected:
+  void SetUp() override {
+    reset_hierarchical_profiler();
+    set_hierarchical_profiler_enabled(true);
+  }
+  void TearDown() override {
+    set_hierarchical_profiler_enabled(false);
+    reset_hierarchical_profiler();
+  }
+};
+
+static void profiled_leaf() {
+  PROFILE_SCOPE("leaf");
+}
+
+TEST_F(HierarchicalProfilerTest, Nested) {
+  {
+    PROFILE_SCOPE("outer");
+    profiled_leaf();
+    profiled_leaf();
+  }
+  const std::string json = hierarchical_profiler_to_json();
+  EXPECT_THAT(json, testing::HasSubstr("{\"name\": \"outer\", \"calls\": 1,"));
+  EXPECT_THAT(json, testing::HasSubstr("{\"name\": \"leaf\", \"calls\": 2,"));
+  const std::string folded = hierarchical_profiler_to_folded_stacks();
+  EXPECT_THAT(folded, testing::HasSubstr("outer;leaf "));
+  EXPECT_THAT(folded, testing::HasSubstr("outer "));
+}
+
+TEST_F(HierarchicalProfilerTest, ParallelTasksAttributedToParent) {
+  {
+    PROFILE_SCOPE("parallel");
+    parallel_for(100, [](int) { profiled_leaf(); }, 1);
+  }
+  const std::string json = hierarchical_profiler_to_json();
+  EXPECT_THAT(json, testing::HasSubstr("{\"name\": \"leaf\", \"calls\": 100,"));
+  EXPECT_THAT(hierarchical_profiler_to_folded_stacks(), testing::HasSubstr("parallel;leaf "));
+}
+
+TEST_F(HierarchicalProfilerTest, Disabled) {
+  set_hierarchical_profiler_enabled(false);
+  profiled_leaf();
+  EXPECT_THAT(hierarchical_profiler_to_json(), testing::Not(testing::HasSubstr("\"calls\": 1,")));
+}
@@ -0,0 +1,139 @@
+#include "lib/progress.h"
+
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "lib/parallel_util.h"
+
+
+class ProgressTest : public testing::Test {
+protected:
+  void SetUp() override {
+    set_progress_enabled(true);
+    set_progress_interval(0);
+    set_progress_callback([this](const ProgressEvent& event) {
+      std::lock_guard lock(mutex_);
+      events_.push_back(event);
+      threads_.push_back(std::this_thread::get_id());
+    });
+  }
+  void TearDown() override {
+    set_progress_enabled(false);
+    set_progress_interval(2.0);
+    set_progress_max_depth(0);
+    set_progress_callback(nullptr);
+  }
+
+  std::mutex mutex_;
+  std::vector<ProgressEvent> events_;
+  std::vector<std::thread::id> threads_;
+};
+
+TEST_F(ProgressTest, Basic) {
+  {
+    ProgressTracker progress("task", 4);
+    for (EACH : range(4)) {
+      progress.advance();
+    }
+  }
+  ASSERT_EQ(events_.size(), 5);
+  EXPECT_EQ(std::string(events_[0].task), "task");
+  EXPECT_EQ(events_[0].done, 1);
+  EXPECT_EQ(events_[0].total, 4);
+  EXPECT_GE(events_[0].eta_sec, 0);
+  EXPECT_FALSE(events_[0].finished);
+  EXPECT_EQ(events_[4].done, 4);
+  EXPECT_TRUE(events_[4].finished);
+}
+
+TEST_F(ProgressTest, UnknownTotal) {
+  {
+    ProgressTracker progress("task");
+    progress.advance(10);
+  }
+  ASSERT_EQ(events_.size(), 2);
+  EXPECT_EQ(events_[0].total, 0);
+  EXPECT_LT(events_[0].eta_sec, 0);
+}
+
+TEST_F(ProgressTest, RateLimited) {
+  set_progress_interval(1000);
+  {
+    ProgressTracker progress("task", 100);
+    for (EACH : range(100)) {
+      progress.advance();
+    }
+  }
+  EXPECT_TRUE(events_.empty());
+}
+
+TEST_F(ProgressTest, Disabled) {
+  set_progress_enabled(false);
+  {
+    ProgressTracker progress("task", 100);
+    progress.advance();
+  }
+  EXPECT_TRUE(events_.empty());
+}
+
+TEST_F(ProgressTest, NestedNotReportedByDefault) {
+  {
+    ProgressTracker outer("outer", 1);
+    {
+      ProgressTracker inner("inner", 1);
+      EXPECT_EQ(inner.depth(), 1);
+      inner.advance();
+    }
+    outer.advance();
+  }
+  ASSERT_EQ(events_.size(), 2);
+  EXPECT_EQ(std::string(events_[0].task), "outer");
+}
+
+TEST_F(ProgressTest, MaxDepth) {
+  set_progress_max_depth(1);
+  {
+    ProgressTracker outer("outer", 1);
+    {
+      ProgressTracker inner("inner", 1);
+      inner.advance();
+    }
+    outer.advance();
+  }
+  ASSERT_EQ(events_.size(), 4);
+  EXPECT_EQ(std::string(events_[0].task), "inner");
+  EXPECT_EQ(events_[0].depth, 1);
+}
+
+TEST_F(ProgressTest, ParallelMapReportsOnCallingThread) {
+  const auto result = parallel_map(to_vector(range(1000)), [](int x) {
+    ProgressTracker nested("nested", 1);
+    nested.advance();
+    return x * 2;
+  }, 1);
+  EXPECT_EQ(result[999], 1998);
+  ASSERT_FALSE(events_.empty());
+  for (const int i : range(events_.size())) {
+    EXPECT_EQ(std::string(events_[i].task), "parallel_map");
+    EXPECT_EQ(threads_[i], std::this_thread::get_id());
+  }
+  EXPECT_TRUE(events_.back().finished);
+  EXPECT_EQ(events_.back().done, 1000);
+}
+
+TEST_F(ProgressTest, Format) {
+  ProgressEvent event;
+  event.task = "process_space";
+  event.done = 1500;
+  event.total = 6000;
+  event.elapsed_sec = 3;
+  event.eta_sec = 9;
+  std::stringstream ss;
+  ss << event;
+  EXPECT_EQ(ss.str(), "process_space: 1'500 / 6'000 (25%), 3s elapsed, ETA 9s");
+}
@@ -0,0 +1,76 @@
+#include "lib/serialization.h"
+
+#include <sstream>
+
+#include "gtest/gtest.h"
+
+#include "lib/delta.h"
+#include "lib/epsilon.h"
+#include "lib/gamma.h"
+#include "test_util/matchers.h"
+
+
+template<typename T>
+T round_trip(const T& value) {
+  std::stringstream ss;
+  BinaryWriter writer(ss);
+  serialize(writer, value);
+  BinaryReader reader(ss);
+  T ret;
+  deserialize(reader, ret);
+  return ret;
+}
+
+TEST(SerializationTest, Containers) {
+  const std::vector<std::pair<std::string, std::vector<int>>> value = {{"a", {1, 2}}, {"", {}}};
+  EXPECT_EQ(round_trip(value), value);
+  const std::vector<bool> bits = {true, false, true};
+  EXPECT_EQ(round_trip(bits), bits);
+  const std::tuple<int, std::string> tuple = {3, "abc"};
+  EXPECT_EQ(round_trip(tuple), tuple);
+  const std::variant<int, std::string> variant = "abc";
+  EXPECT_EQ(round_trip(variant), variant);
+}
+
+TEST(SerializationTest, Varint) {
+  std::string buffer;
+  BinaryWriter writer(buffer);
+  const std::vector<int64_t> values = {0, 1, -1, 63, -64, 64, 300, -300, INT64_MAX, INT64_MIN};
+  for (const int64_t value : values) {
+    writer.write_signed_varint(value);
+  }
+  EXPECT_EQ(buffer[0], 0);
+  EXPECT_EQ(buffer[1], 2);
+  EXPECT_EQ(buffer[2], 1);
+  BinaryReader reader(buffer.data(), buffer.size());
+  for (const int64_t value : values) {
+    EXPECT_EQ(reader.read_signed_varint(), value);
+  }
+  EXPECT_TRUE(reader.at_end());
+}
+
+TEST(SerializationTest, Linear) {
+  const DeltaExpr delta = D(1, 2) - 3 * D(2, 4);
+  EXPECT_EXPR_EQ(round_trip(delta), delta);
+  const GammaExpr gamma = G({1, 2, 3}) + G({2, 3, 4});
+  EXPECT_EXPR_EQ(round_trip(gamma), gamma);
+  const EpsilonExpr epsilon = EVar(1) + 2 * EComplementIndexList({1, 2}) - EFormalSymbolPositive(LiParam(0, {1}, {{1}}));
+  EXPECT_EXPR_EQ(round_trip(epsilon), epsilon);
+}
+
+TEST(SerializationTest, Annotations) {
+  const DeltaExpr expr = (D(1, 2) + D(3, 4)).annotate("foo");
+  const DeltaExpr loaded = round_trip(expr);
+  EXPECT_EXPR_EQ(loaded, expr);
+  EXPECT_EQ(loaded.annotations().expression, expr.annotations().expression);
+}
+
+TEST(SerializationTest, TruncatedDataIsFatal) {
+  std::stringstream ss;
+  BinaryWriter writer(ss);
+  serialize(writer, std::string("abcdef"));
+  std::stringstream truncated(ss.str().substr(0, 4));
+  BinaryReader reader(truncated);
+  std::string value;
+  EXPECT_DEATH(deserialize(reader, value), "Unexpected end");
+}
@@ -0,0 +1,101 @@
+#include "lib/thread_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "lib/range.h"
+
+
+TEST(ThreadPoolTest, Sum) {
+  ThreadPool pool(4);
+  std::atomic<long> sum = 0;
+  pool.parallel_for_chunks(1000, 7, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      sum += i;
+    }
+  });
+  EXPECT_EQ(sum, 999 * 1000 / 2);
+}
+
+TEST(ThreadPoolTest, SingleThread) {
+  ThreadPool pool(1);
+  EXPECT_EQ(pool.num_threads(), 1);
+  int sum = 0;
+  pool.parallel_for_chunks(100, 3, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      sum += i;
+    }
+  });
+  EXPECT_EQ(sum, 99 * 100 / 2);
+}
+
+TEST(ThreadPoolTest, Nested) {
+  ThreadPool pool(4);
+  std::atomic<int> count = 0;
+  pool.parallel_for_chunks(20, 1, [&](int, int) {
+    pool.parallel_for_chunks(50, 2, [&](int begin, int end) {
+      count += end - begin;
+    });
+  });
+  EXPECT_EQ(count, 20 * 50);
+}
+
+TEST(ThreadPoolTest, WaitDoesNotRunOtherTasks) {
+  ThreadPool pool(4);
+  static thread_local int depth = 0;
+  std::atomic<bool> reentered = false;
+  pool.parallel_for_chunks(40, 1, [&](int, int) {
+    if (++depth > 1) {
+      reentered = true;
+    }
+    pool.parallel_for_chunks(8, 1, [&](int, int) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    });
+    --depth;
+  });
+  EXPECT_FALSE(reentered);
+}
+
+// Runners that start after all chunks have been claimed must not make the caller wait forever.
+// The hook delays every runner right after it claims a chunk, so on any number of CPUs some
+// runners are still in flight when the caller finishes its own chunks and starts waiting.
+TEST(ThreadPoolTest, LateRunners) {
+  ThreadPool pool(4);
+  internal::thread_pool_chunk_claimed_hook = []() {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  };
+  std::atomic<int> count = 0;
+  for (EACH : range(300)) {
+    pool.parallel_for_chunks(3, 1, [&](int begin, int end) { count += end - begin; });
+  }
+  internal::thread_pool_chunk_claimed_hook = nullptr;
+  EXPECT_EQ(count, 300 * 3);
+}
+
+TEST(ThreadPoolTest, Exception) {
+  ThreadPool pool(4);
+  EXPECT_THROW(
+    pool.parallel_for_chunks(100, 1, [](int begin, int) {
+      if (begin == 37) {
+        throw std::runtime_error("failure");
+      }
+    }),
+    std::runtime_error
+  );
+  // The pool must remain usable.
+  std::atomic<int> count = 0;
+  pool.parallel_for_chunks(100, 1, [&](int, int) { ++count; });
+  EXPECT_EQ(count, 100);
+}
+
+TEST(ThreadPoolTest, SetNumThreads) {
+  const int old_num_threads = parallelism_num_threads();
+  set_parallelism_num_threads(3);
+  EXPECT_EQ(parallelism_num_threads(), 3);
+  EXPECT_EQ(global_thread_pool().num_threads(), 3);
+  set_parallelism_num_threads(old_num_threads);
+}
@@ -0,0 +1,70 @@
+#include <memory>
+#include <optional>
+
+#include "pybind11/pybind11.h"
+#include "pybind11/stl.h"
+
+#include "cpp/lib/cancellation.h"
+
+
+namespace py = pybind11;
+
+// Context manager that bounds computations started within it:
+//
+//   with ComputationLimits(timeout_sec=60, memory_budget_mb=4096):
+//       ...
+//
+// Raises DeadlineExceeded or MemoryBudgetExceeded (both derived from OperationCancelled).
+class ComputationLimits {
+public:
+  ComputationLimits(std::optional<double> timeout_sec, std::optional<double> memory_budget_mb)
+    : timeout_sec_(timeout_sec) {
+    if (memory_budget_mb.has_value()) {
+      token_.set_memory_budget_bytes(static_cast<int64_t>(*memory_budget_mb * 1024 * 1024));
+    }
+  }
+
+  void enter() {
+    if (timeout_sec_.has_value()) {
+      token_.set_timeout(*timeout_sec_);
+    }
+    guard_ = std::make_unique<ScopedCancellationToken>(&token_);
+  }
+  void exit() {
+    guard_.reset();
+  }
+  void cancel() {
+    token_.cancel();
+  }
+
+private:
+  std::optional<double> timeout_sec_;
+  CancellationToken token_;
+  std::unique_ptr<ScopedCancellationToken> guard_;
+};
+
+
+void pybind_cancellation(py::module_& m) {
+  // Note: translators are tried in reverse order of registration, so subclasses go last.
+  const auto base = py::register_exception<OperationCancelled>(m, "OperationCancelled");
+  py::register_exception<DeadlineExceeded>(m, "DeadlineExceeded", base);
+  py::register_exception<MemoryBudgetExceeded>(m, "MemoryBudgetExceeded", base);
+
+  py::class_<ComputationLimits>(m, "ComputationLimits")
+    .def(
+      py::init<std::optional<double>, std::optional<double>>(),
+      py::kw_only(),
+      py::arg("timeout_sec") = py::none(),
+      py::arg("memory_budget_mb") = py::none()
+    )
+    .def("__enter__", [](ComputationLimits& self) -> ComputationLimits& {
+      self.enter();
+      return self;
+    }, py::return_value_policy::reference)
+    .def("__exit__", [](ComputationLimits& self, py::args) {
+      self.exit();
+      return false;
+    })
+    .def("cancel", &ComputationLimits::cancel)
+  ;
+}
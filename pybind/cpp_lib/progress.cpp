@@ -0,0 +1,51 @@
+#include <memory>
+#include <sstream>
+
+#include "pybind11/pybind11.h"
+
+#include "cpp/lib/progress.h"
+
+
+namespace py = pybind11;
+
+// Progress callbacks run on the thread that called into the library, which holds the GIL
+// unless the binding released it. Acquiring it again is a no-op in that case.
+static void py_set_progress_callback(py::object callback) {
+  if (callback.is_none()) {
+    set_progress_callback(nullptr);
+    return;
+  }
+  auto shared_callback = std::make_shared<py::object>(std::move(callback));
+  set_progress_callback([shared_callback](const ProgressEvent& event) {
+    py::gil_scoped_acquire gil;
+    (*shared_callback)(event);
+  });
+}
+
+
+void pybind_progress(py::module_& m) {
+  py::class_<ProgressEvent>(m, "ProgressEvent")
+    .def_property_readonly("task", [](const ProgressEvent& event) { return std::string(event.task); })
+    .def_readonly("depth", &ProgressEvent::depth)
+    .def_readonly("done", &ProgressEvent::done)
+    .def_readonly("total", &ProgressEvent::total)
+    .def_readonly("elapsed_sec", &ProgressEvent::elapsed_sec)
+    .def_readonly("eta_sec", &ProgressEvent::eta_sec)
+    .def_readonly("finished", &ProgressEvent::finished)
+    .def("__repr__", [](const ProgressEvent& event) {
+      std::stringstream ss;
+      ss << event;
+      return ss.str();
+    })
+  ;
+
+  m.def("set_progress_enabled", &set_progress_enabled);
+  m.def("set_progress_interval", &set_progress_interval);
+  m.def("set_progress_max_depth", &set_progress_max_depth);
+  m.def("set_progress_callback", &py_set_progress_callback, py::arg("callback") = py::none());
+
+  // Drop the Python callback before the interpreter shuts down.
+  py::module_::import("atexit").attr("register")(py::cpp_function([]() {
+    set_progress_callback(nullptr);
+  }));
+}
@@ -3,16 +3,20 @@
 
 namespace py = pybind11;
 
+void pybind_cancellation(py::module_&);
 void pybind_expressions(py::module_&);
 void pybind_format(py::module_&);
 void pybind_polylog(py::module_&);
+void pybind_progress(py::module_&);
 void pybind_ratio(py::module_&);
 void pybind_x(py::module_&);
 
 PYBIND11_MODULE(py_bindings, m) {
+  pybind_cancellation(m);
   pybind_expressions(m);
   pybind_format(m);
   pybind_polylog(m);
+  pybind_progress(m);
   pybind_ratio(m);
   pybind_x(m);
 }
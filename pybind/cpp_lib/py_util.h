@@ -6,6 +6,8 @@
 #include "pybind11/operators.h"
 #include "pybind11/pybind11.h"
 
+#include "cpp/lib/linear_file.h"
+
 
 template<typename T>
 class IterableRange {
@@ -99,5 +101,10 @@ void py_register_linear(const pybind11::module_& module, const char* name) {
       ss << expr;
       return ss.str();
     })
+    // Allows to pass expressions to other processes, e.g. via `multiprocessing`.
+    .def(py::pickle(
+      [](const LinearT& expr) { return py::bytes(linear_to_bytes(expr)); },
+      [](const py::bytes& bytes) { return linear_from_bytes<LinearT>(std::string_view(bytes)); }
+    ))
   ;
 }
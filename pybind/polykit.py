@@ -9,6 +9,17 @@ NoLineLimit = pb.NoLineLimit
 set_formatting = pb.set_formatting
 reset_formatting = pb.reset_formatting
 
+ProgressEvent = pb.ProgressEvent
+set_progress_enabled = pb.set_progress_enabled
+set_progress_interval = pb.set_progress_interval
+set_progress_max_depth = pb.set_progress_max_depth
+set_progress_callback = pb.set_progress_callback
+
+OperationCancelled = pb.OperationCancelled
+DeadlineExceeded = pb.DeadlineExceeded
+MemoryBudgetExceeded = pb.MemoryBudgetExceeded
+ComputationLimits = pb.ComputationLimits
+
 to_lyndon_basis = pb.to_lyndon_basis
 
 X = pb.X